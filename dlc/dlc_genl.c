@@ -0,0 +1,384 @@
+#include "dlc_genl.h"
+#include "dlc_tca_spec.h"
+
+#include <linux/err.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/rtnetlink.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
+#include <net/pkt_sched.h>
+#include <net/sch_generic.h>
+
+#define DLC_INSTANCES_HASH_BITS 10
+
+/* SET stages under this one, clients must use non zero ids */
+#define DLC_TXN_SET     0
+
+/* a transaction not committed this long after its first PREPARE is aborted */
+#define DLC_TXN_TIMEOUT (60 * HZ)
+
+/* both protected by RTNL */
+static DEFINE_HASHTABLE(dlc_instances, DLC_INSTANCES_HASH_BITS);
+static LIST_HEAD(dlc_pending);
+
+static struct genl_family dlc_genl_family;
+
+static void dlc_pending_expire(struct work_struct *work);
+static DECLARE_DELAYED_WORK(dlc_pending_gc, dlc_pending_expire);
+
+static u32 inst_hash(int ifindex, u32 handle)
+{
+    return jhash_2words(ifindex, handle, 0);
+}
+
+static struct net *inst_net(const struct dlc_genl_inst *inst)
+{
+    return dev_net(qdisc_dev(inst->sch));
+}
+
+void dlc_genl_register(struct dlc_genl_inst *inst, struct Qdisc *sch)
+{
+    ASSERT_RTNL();
+    inst->sch = sch;
+    inst->pending = NULL;
+    inst->txn = 0;
+    INIT_LIST_HEAD(&inst->pending_node);
+    hash_add(dlc_instances, &inst->node, inst_hash(qdisc_dev(sch)->ifindex, sch->handle));
+}
+
+static void inst_unstage(struct dlc_genl_inst *inst)
+{
+    list_del_init(&inst->pending_node);
+    dlc_config_free(inst->pending);
+    inst->pending = NULL;
+    inst->txn = 0;
+}
+
+void dlc_genl_unregister(struct dlc_genl_inst *inst)
+{
+    ASSERT_RTNL();
+    if (!inst->sch)
+        return;
+    if (inst->pending)
+        inst_unstage(inst);
+    hash_del(&inst->node);
+    inst->sch = NULL;
+}
+
+static struct dlc_genl_inst *inst_lookup(struct net *net, int ifindex, u32 handle)
+{
+    struct dlc_genl_inst *inst;
+
+    hash_for_each_possible(dlc_instances, inst, node, inst_hash(ifindex, handle)) {
+        if (qdisc_dev(inst->sch)->ifindex == ifindex && inst->sch->handle == handle &&
+            net_eq(inst_net(inst), net))
+            return inst;
+    }
+    return NULL;
+}
+
+static const struct nla_policy dlc_inst_policy[DLC_A_MAX + 1] = {
+    [DLC_A_IFINDEX] = { .type = NLA_U32 },
+    [DLC_A_HANDLE]  = { .type = NLA_U32 },
+    [DLC_A_OPTIONS] = { .type = NLA_BINARY },   /* length checked on prepare */
+};
+
+static const struct nla_policy dlc_genl_policy[DLC_A_MAX + 1] = {
+    [DLC_A_TXN]      = { .type = NLA_U32 },
+    [DLC_A_INSTANCE] = NLA_POLICY_NESTED(dlc_inst_policy),
+};
+
+/* Build options of one INSTANCE and stage them for txn */
+static int inst_stage(struct net *net, const struct nlattr *attr, u32 txn,
+                      struct netlink_ext_ack *extack)
+{
+    struct nlattr *tb[DLC_A_MAX + 1];
+    struct dlc_genl_inst *inst;
+    struct dlc_config *cfg;
+    int ret;
+
+    ret = nla_parse_nested(tb, DLC_A_MAX, attr, dlc_inst_policy, extack);
+    if (ret)
+        return ret;
+    if (!tb[DLC_A_IFINDEX] || !tb[DLC_A_HANDLE] || !tb[DLC_A_OPTIONS]) {
+        NL_SET_ERR_MSG_ATTR(extack, attr, "dlc: instance needs ifindex, handle and options");
+        return -EINVAL;
+    }
+    inst = inst_lookup(net, nla_get_u32(tb[DLC_A_IFINDEX]), nla_get_u32(tb[DLC_A_HANDLE]));
+    if (!inst) {
+        NL_SET_ERR_MSG_ATTR(extack, attr, "dlc: no dlc qdisc with this ifindex and handle");
+        return -ENOENT;
+    }
+    if (inst->pending && inst->txn != txn) {
+        NL_SET_ERR_MSG_ATTR(extack, attr, "dlc: instance is staged by another transaction");
+        return -EBUSY;
+    }
+
+    cfg = dlc_config_prepare(inst->sch, tb[DLC_A_OPTIONS], extack);
+    if (IS_ERR(cfg)) {
+        if (extack && !extack->_msg)
+            NL_SET_ERR_MSG_ATTR(extack, attr, "dlc: invalid options");
+        return PTR_ERR(cfg);
+    }
+
+    /* staged again in the same transaction: later options win */
+    if (inst->pending) {
+        dlc_config_free(inst->pending);
+    } else {
+        list_add_tail(&inst->pending_node, &dlc_pending);
+        inst->staged_at = jiffies;
+        schedule_delayed_work(&dlc_pending_gc, DLC_TXN_TIMEOUT);
+    }
+    inst->pending = cfg;
+    inst->txn = txn;
+    return 0;
+}
+
+static void txn_abort(struct net *net, u32 txn)
+{
+    struct dlc_genl_inst *inst, *tmp;
+
+    list_for_each_entry_safe(inst, tmp, &dlc_pending, pending_node)
+        if (inst->txn == txn && net_eq(inst_net(inst), net))
+            inst_unstage(inst);
+}
+
+/*
+ * Abandoned transactions (client died between PREPARE and COMMIT) would pin
+ * their configs and keep the instances busy forever: the oldest entries are
+ * at the head, their whole transaction goes once the first one times out.
+ */
+static void dlc_pending_expire(struct work_struct *work)
+{
+    struct dlc_genl_inst *inst;
+
+    rtnl_lock();
+    while (!list_empty(&dlc_pending)) {
+        inst = list_first_entry(&dlc_pending, struct dlc_genl_inst, pending_node);
+        if (time_before(jiffies, inst->staged_at + DLC_TXN_TIMEOUT)) {
+            schedule_delayed_work(&dlc_pending_gc,
+                                  inst->staged_at + DLC_TXN_TIMEOUT - jiffies);
+            break;
+        }
+        pr_info("dlc: transaction %u timed out, aborted\n", inst->txn);
+        txn_abort(inst_net(inst), inst->txn);
+    }
+    rtnl_unlock();
+}
+
+/*
+ * Nothing is swapped unless every config still fits its instance.
+ * All swaps first, each one only takes the tree lock of its qdisc; replaced
+ * models and tables are released afterwards, out of the switching window.
+ * Returns the number of instances or a negative error, the txn is gone.
+ */
+static int txn_commit(struct net *net, u32 txn, struct netlink_ext_ack *extack)
+{
+    struct dlc_genl_inst *inst, *tmp;
+    int n = 0;
+
+    list_for_each_entry(inst, &dlc_pending, pending_node) {
+        if (inst->txn == txn && net_eq(inst_net(inst), net) &&
+            dlc_config_stale(inst->sch, inst->pending)) {
+            NL_SET_ERR_MSG(extack, "dlc: an instance was changed after PREPARE, transaction aborted");
+            txn_abort(net, txn);
+            return -ESTALE;
+        }
+    }
+    list_for_each_entry(inst, &dlc_pending, pending_node) {
+        if (inst->txn == txn && net_eq(inst_net(inst), net)) {
+            dlc_config_commit(inst->sch, inst->pending);
+            n++;
+        }
+    }
+    list_for_each_entry_safe(inst, tmp, &dlc_pending, pending_node)
+        if (inst->txn == txn && net_eq(inst_net(inst), net))
+            inst_unstage(inst);
+    return n;
+}
+
+/* Every INSTANCE of the message, the first failure aborts the whole txn */
+static int txn_stage_msg(struct genl_info *info, u32 txn)
+{
+    struct net *net = genl_info_net(info);
+    const struct nlattr *attr;
+    int rem, ret = 0;
+
+    nla_for_each_attr(attr, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem) {
+        if (nla_type(attr) != DLC_A_INSTANCE)
+            continue;
+        ret = inst_stage(net, attr, txn, info->extack);
+        if (ret) {
+            txn_abort(net, txn);
+            break;
+        }
+    }
+    return ret;
+}
+
+static int get_txn(struct genl_info *info, u32 *txn)
+{
+    if (!info->attrs[DLC_A_TXN] || !nla_get_u32(info->attrs[DLC_A_TXN])) {
+        NL_SET_ERR_MSG(info->extack, "dlc: non zero transaction id required");
+        return -EINVAL;
+    }
+    *txn = nla_get_u32(info->attrs[DLC_A_TXN]);
+    return 0;
+}
+
+static int dlc_genl_prepare(struct sk_buff *skb, struct genl_info *info)
+{
+    u32 txn;
+    int ret;
+
+    ret = get_txn(info, &txn);
+    if (ret)
+        return ret;
+    rtnl_lock();
+    ret = txn_stage_msg(info, txn);
+    rtnl_unlock();
+    return ret;
+}
+
+static int dlc_genl_commit(struct sk_buff *skb, struct genl_info *info)
+{
+    u32 txn;
+    int ret, n;
+
+    ret = get_txn(info, &txn);
+    if (ret)
+        return ret;
+    rtnl_lock();
+    n = txn_commit(genl_info_net(info), txn, info->extack);
+    rtnl_unlock();
+    if (n < 0)
+        return n;
+    if (!n) {
+        NL_SET_ERR_MSG(info->extack, "dlc: nothing staged for this transaction");
+        return -ENOENT;
+    }
+    pr_debug("dlc: transaction %u committed on %d instances\n", txn, n);
+    return 0;
+}
+
+static int dlc_genl_abort(struct sk_buff *skb, struct genl_info *info)
+{
+    u32 txn;
+    int ret;
+
+    ret = get_txn(info, &txn);
+    if (ret)
+        return ret;
+    rtnl_lock();
+    txn_abort(genl_info_net(info), txn);
+    rtnl_unlock();
+    return 0;
+}
+
+static int dlc_genl_set(struct sk_buff *skb, struct genl_info *info)
+{
+    int ret;
+
+    rtnl_lock();
+    ret = txn_stage_msg(info, DLC_TXN_SET);
+    if (!ret)
+        ret = txn_commit(genl_info_net(info), DLC_TXN_SET, info->extack);
+    rtnl_unlock();
+    return ret < 0 ? ret : 0;
+}
+
+static int inst_fill(struct sk_buff *skb, const struct netlink_callback *cb,
+                     const struct dlc_genl_inst *inst)
+{
+    void *hdr;
+
+    hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                      &dlc_genl_family, NLM_F_MULTI, DLC_CMD_GET);
+    if (!hdr)
+        return -EMSGSIZE;
+    if (nla_put_u32(skb, DLC_A_IFINDEX, qdisc_dev(inst->sch)->ifindex) ||
+        nla_put_u32(skb, DLC_A_HANDLE, inst->sch->handle) ||
+        dlc_config_dump(inst->sch, skb, DLC_A_OPTIONS) ||
+        (inst->pending && nla_put_u32(skb, DLC_A_PENDING_TXN, inst->txn))) {
+        genlmsg_cancel(skb, hdr);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(skb, hdr);
+    return 0;
+}
+
+/* One message per instance of the netns, cb->args[0] is the resume index */
+static int dlc_genl_get_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+    struct net *net = sock_net(skb->sk);
+    struct dlc_genl_inst *inst;
+    unsigned long idx = 0;
+    int bkt;
+
+    rtnl_lock();
+    hash_for_each(dlc_instances, bkt, inst, node) {
+        if (!net_eq(inst_net(inst), net))
+            continue;
+        if (idx < cb->args[0]) {
+            idx++;
+            continue;
+        }
+        if (inst_fill(skb, cb, inst))
+            break;
+        idx++;
+    }
+    rtnl_unlock();
+    cb->args[0] = idx;
+    return skb->len;
+}
+
+static const struct genl_ops dlc_genl_ops[] = {
+    {
+        .cmd    = DLC_CMD_PREPARE,
+        .doit   = dlc_genl_prepare,
+        .flags  = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd    = DLC_CMD_COMMIT,
+        .doit   = dlc_genl_commit,
+        .flags  = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd    = DLC_CMD_ABORT,
+        .doit   = dlc_genl_abort,
+        .flags  = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd    = DLC_CMD_SET,
+        .doit   = dlc_genl_set,
+        .flags  = GENL_ADMIN_PERM,
+    },
+    {
+        .cmd    = DLC_CMD_GET,
+        .dumpit = dlc_genl_get_dump,
+    },
+};
+
+static struct genl_family dlc_genl_family = {
+    .name       = DLC_GENL_NAME,
+    .version    = DLC_GENL_VERSION,
+    .maxattr    = DLC_A_MAX,
+    .policy     = dlc_genl_policy,
+    .netnsok    = true,
+    .module     = THIS_MODULE,
+    .ops        = dlc_genl_ops,
+    .n_ops      = ARRAY_SIZE(dlc_genl_ops),
+};
+
+int dlc_genl_init(void)
+{
+    return genl_register_family(&dlc_genl_family);
+}
+
+void dlc_genl_exit(void)
+{
+    genl_unregister_family(&dlc_genl_family);
+    cancel_delayed_work_sync(&dlc_pending_gc);
+}
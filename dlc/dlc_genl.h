@@ -0,0 +1,42 @@
+#ifndef _DLC_GENL_H
+#define _DLC_GENL_H
+
+#include <linux/list.h>
+#include <linux/types.h>
+
+struct Qdisc;
+struct nlattr;
+struct sk_buff;
+struct netlink_ext_ack;
+struct dlc_config;
+
+/*
+ * Module-wide generic netlink control plane (DLC_GENL_NAME, see
+ * dlc_tca_spec.h). Every dlc qdisc is registered from init to destroy, so
+ * bulk messages can address it by ifindex and handle. Registration, staging
+ * and commits run under RTNL, like tc itself.
+ */
+struct dlc_genl_inst {
+    struct hlist_node node;         /* registry, by ifindex and handle */
+    struct list_head pending_node;  /* staged for a transaction */
+    struct Qdisc *sch;
+    struct dlc_config *pending;
+    unsigned long staged_at;        /* jiffies of the first PREPARE */
+    u32 txn;
+};
+
+int dlc_genl_init(void);
+void dlc_genl_exit(void);
+
+void dlc_genl_register(struct dlc_genl_inst *inst, struct Qdisc *sch);
+void dlc_genl_unregister(struct dlc_genl_inst *inst);
+
+/* Implemented by the qdisc: dlc_change() in two phases */
+struct dlc_config *dlc_config_prepare(struct Qdisc *sch, const struct nlattr *opt,
+                                      struct netlink_ext_ack *extack);
+bool dlc_config_stale(struct Qdisc *sch, const struct dlc_config *cfg);
+void dlc_config_commit(struct Qdisc *sch, struct dlc_config *cfg);
+void dlc_config_free(struct dlc_config *cfg);
+int dlc_config_dump(struct Qdisc *sch, struct sk_buff *skb, int attrtype);
+
+#endif
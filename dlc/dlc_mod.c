@@ -1,15 +1,20 @@
 #include "dlc_mod.h"
 #include <linux/random.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 
 void _set_dlc_init_probs(u32* init_probs){
-    init_probs[0] = DLC_PROB_SCALE;
+    init_probs[0] = dlc_prob_clamp(DLC_PROB_ONE);
     init_probs[1] = 0;
     init_probs[2] = 0;
     return;
 }
 
-/*probs are scaled to DLC_PROB_SCALE*/
+/*
+ * p_loss and mu are scaled to DLC_PROB_SCALE (as passed from tc),
+ * resulting probs are scaled to DLC_PROB_ONE (2^32).
+ */
 void _set_dlc_transition_probs(
         u32 transition_probs[MC_MAX_STATES][MC_MAX_STATES],
         u32 p_loss,
@@ -17,22 +22,28 @@ void _set_dlc_transition_probs(
         u32 mean_burst_len,
         u32 mean_good_burst_len
 ){
-    u32 p32 = DLC_PROB_SCALE / mean_burst_len;
-    u64 t = ((u64)DLC_PROB_SCALE * DLC_PROB_SCALE / (DLC_PROB_SCALE - p_loss) - DLC_PROB_SCALE)
-            * DLC_PROB_SCALE
-            / (mean_burst_len * (DLC_PROB_SCALE - mu));
-    u64 p23 = ((DLC_PROB_SCALE - mu) * t) / mu;
-    u64 p21 = DLC_PROB_SCALE / mean_good_burst_len - p23;
-    u64 p12 = ((u64)mu * DLC_PROB_SCALE) / ((DLC_PROB_SCALE - mu) * mean_good_burst_len) - t;
-    transition_probs[0][0] = DLC_PROB_SCALE - p12;
-    transition_probs[0][1] = p12;
+    /* x = p_loss / (1 - p_loss) */
+    u64 x = div64_u64((u64)p_loss << DLC_PROB_SHIFT, DLC_PROB_SCALE - p_loss);
+    u64 t = div_u64(mul_u64_u32_div(x, DLC_PROB_SCALE, DLC_PROB_SCALE - mu), mean_burst_len);
+    u64 p32 = div_u64(DLC_PROB_ONE, mean_burst_len);
+    u64 p23 = mu ? div_u64(mul_u64_u32_div(x, DLC_PROB_SCALE, mu), mean_burst_len) : 0;
+    s64 p21, p12;
+
+    p23 = min_t(u64, p23, DLC_PROB_ONE);
+    p21 = (s64)div_u64(DLC_PROB_ONE, mean_good_burst_len) - (s64)p23;
+    p12 = (s64)div64_u64((u64)mu << DLC_PROB_SHIFT, (u64)(DLC_PROB_SCALE - mu) * mean_good_burst_len) - (s64)t;
+    p21 = clamp_t(s64, p21, 0, DLC_PROB_ONE - p23);
+    p12 = clamp_t(s64, p12, 0, DLC_PROB_ONE);
+
+    transition_probs[0][0] = dlc_prob_clamp(DLC_PROB_ONE - p12);
+    transition_probs[0][1] = dlc_prob_clamp(p12);
     transition_probs[0][2] = 0;
-    transition_probs[1][0] = p21;
-    transition_probs[1][1] = DLC_PROB_SCALE - p21 - p23;
-    transition_probs[1][2] = p23;
+    transition_probs[1][0] = dlc_prob_clamp(p21);
+    transition_probs[1][1] = dlc_prob_clamp(DLC_PROB_ONE - p21 - p23);
+    transition_probs[1][2] = dlc_prob_clamp(p23);
     transition_probs[2][0] = 0;
-    transition_probs[2][1] = p32;
-    transition_probs[2][2] = DLC_PROB_SCALE - p32;
+    transition_probs[2][1] = dlc_prob_clamp(p32);
+    transition_probs[2][2] = dlc_prob_clamp(DLC_PROB_ONE - p32);
     // printk(KERN_DEBUG "Dlc: transition probs\n[%u, %u, %u]\n[%u, %u, %u]\n[%u, %u, %u]\n",
     //     transition_probs[0][0], transition_probs[0][1], transition_probs[0][2],
     //     transition_probs[1][0], transition_probs[1][1], transition_probs[1][2],
@@ -40,6 +51,96 @@ void _set_dlc_transition_probs(
     return;
 };
 
+/* threshold below which row `row` goes to a state < col; ONE past the last reachable state */
+static u64 fast_thresh(const u32 thresh[][MC_MAX_STATES], const u32 row_last[], u32 row, u32 col)
+{
+    if (col >= row_last[row])
+        return DLC_PROB_ONE;
+    return thresh[row][col];
+}
+
+/* M/M/1/K chain as built by dlc_queue_state_v2_init(): same down probability in every row */
+static bool queue_is_birth_death(const struct markov_chain_const *mc, u64 *down)
+{
+    u32 top = mc->num_states - 1;
+    u32 i, j;
+
+    if (mc->num_states < 2)
+        return false;
+    *down = mc->transition_probs[1][0];
+    for (i = 0; i <= top; i++) {
+        u32 lo = i ? i - 1 : 0;
+        u32 hi = i < top ? i + 1 : top;
+
+        for (j = 0; j <= top; j++) {
+            if (j != lo && j != hi && mc->transition_probs[i][j])
+                return false;
+        }
+        if (i < top && mc->transition_probs[i][lo] != *down)
+            return false;
+        if (i == top && mc->transition_probs[top][top - 1] != *down)
+            return false;
+    }
+    /* whole mass goes down: never go up */
+    if (mc->row_last[0] == 0)
+        *down = DLC_PROB_ONE;
+    return true;
+}
+
+static bool dlc_fast_model_build(struct dlc_mod_data *dlc_data)
+{
+    struct markov_chain *mc = &dlc_data->main_chain;
+    struct dlc_fast_model *f = &dlc_data->fast;
+    struct dlc_state *states = mc->states;
+
+    if (mc->num_states != DLC_NUM_STATES ||
+        states[DLC_IDX_SIMPLE].type != DLC_STATE_SIMPLE ||
+        states[DLC_IDX_QUEUE].type != DLC_STATE_QUEUE_V2 ||
+        states[DLC_IDX_LOSS].type != DLC_STATE_LOSS)
+        return false;
+    if (mc->transition_probs[DLC_IDX_SIMPLE][DLC_IDX_LOSS] ||
+        mc->transition_probs[DLC_IDX_LOSS][DLC_IDX_SIMPLE])
+        return false;
+    if (!queue_is_birth_death(&states[DLC_IDX_QUEUE].queue.mm1k_chain, &f->queue_down))
+        return false;
+
+    f->base[DLC_IDX_SIMPLE] = DLC_IDX_SIMPLE;
+    f->lo[DLC_IDX_SIMPLE] = fast_thresh(mc->transition_thresh, mc->row_last, DLC_IDX_SIMPLE, 0);
+    f->hi[DLC_IDX_SIMPLE] = DLC_PROB_ONE;
+    f->base[DLC_IDX_QUEUE] = DLC_IDX_SIMPLE;
+    f->lo[DLC_IDX_QUEUE] = fast_thresh(mc->transition_thresh, mc->row_last, DLC_IDX_QUEUE, 0);
+    f->hi[DLC_IDX_QUEUE] = fast_thresh(mc->transition_thresh, mc->row_last, DLC_IDX_QUEUE, 1);
+    f->base[DLC_IDX_LOSS] = DLC_IDX_QUEUE;
+    f->lo[DLC_IDX_LOSS] = fast_thresh(mc->transition_thresh, mc->row_last, DLC_IDX_LOSS, 1);
+    f->hi[DLC_IDX_LOSS] = DLC_PROB_ONE;
+
+    f->simple_delay = states[DLC_IDX_SIMPLE].simple.delay_mean;
+    f->simple_jitter = states[DLC_IDX_SIMPLE].simple.jitter;
+    f->simple_table = states[DLC_IDX_SIMPLE].simple.delay_table;
+    f->simple_size = states[DLC_IDX_SIMPLE].simple.delay_table_size;
+
+    f->queue_top = states[DLC_IDX_QUEUE].queue.mm1k_chain.num_states - 1;
+    f->queue_states = states[DLC_IDX_QUEUE].queue.mm1k_chain.states;
+
+    f->loss_delay = states[DLC_IDX_LOSS].loss.max_delay;
+    return true;
+}
+
+static int dlc_mod_check_params(u32 jitter_steps, u32 p_loss, u32 mu,
+                                u32 mean_burst_len, u32 mean_good_burst_len)
+{
+    if (!jitter_steps || jitter_steps >= MC_MAX_STATES)
+        return -EINVAL;
+    if (!mean_burst_len || !mean_good_burst_len)
+        return -EINVAL;
+    if (p_loss >= DLC_PROB_SCALE || mu >= DLC_PROB_SCALE)
+        return -EINVAL;
+    /* losses are reachable only through queue state */
+    if (p_loss && !mu)
+        return -EINVAL;
+    return 0;
+}
+
 int dlc_mod_init(
         struct dlc_mod_data *dlc_data,
         s64 delay,
@@ -50,70 +151,190 @@ int dlc_mod_init(
         u32 mu,
         u32 mean_burst_len,
         u32 mean_good_burst_len,
-        struct disttable* dist
+        struct disttable* dist,
+        int node
 ) {
     struct dlc_state* states;
-    struct dlc_simple_state simple_state;
-    struct dlc_queue_state_v2 queue_state;
-    struct dlc_loss_state loss_state;
     u32 (*transition_probs)[MC_MAX_STATES]; 
     u32* init_probs;
-    
+    int ret;
+
+    ret = dlc_mod_check_params(jitter_steps, p_loss, mu, mean_burst_len, mean_good_burst_len);
+    if (ret) {
+        pr_info("dlc_model: invalid model parameters\n");
+        return ret;
+    }
+
     // allocate memory since kernel stack is too small
-    states = kvmalloc(sizeof(struct dlc_state) * DLC_NUM_STATES, GFP_KERNEL);
+    states = kvzalloc(sizeof(struct dlc_state) * DLC_NUM_STATES, GFP_KERNEL);
     if (!states)
         return -ENOMEM;
 
     dlc_data->delay_dist = dist;
+    dlc_data->node = node;
 
-    dlc_simple_state_init(&simple_state, delay, jitter / jitter_steps, dlc_data->delay_dist);
     states[0].type = DLC_STATE_SIMPLE;
-    states[0].simple = simple_state;
+    ret = dlc_simple_state_init(&states[0].simple, delay, jitter / jitter_steps, dlc_data->delay_dist, node);
+    if (ret) {
+        kvfree(states);
+        return ret;
+    }
 
-    dlc_queue_state_v2_init(&queue_state, jitter_steps, delay, jitter, mm1_rho);
+    /* init in place: queue state holds whole inner chain, too big for stack */
     states[1].type = DLC_STATE_QUEUE_V2;
-    states[1].queue = queue_state;
+    ret = dlc_queue_state_v2_init(&states[1].queue, jitter_steps, delay, jitter, mm1_rho, node);
+    if (ret) {
+        dlc_simple_state_destroy(&states[0].simple);
+        kvfree(states);
+        return ret;
+    }
 
-    dlc_loss_state_init(&loss_state, delay + jitter);
     states[2].type = DLC_STATE_LOSS;
-    states[2].loss = loss_state;
+    dlc_loss_state_init(&states[2].loss, delay + jitter);
 
-    init_probs = kvmalloc(sizeof(u32) * MC_MAX_STATES, GFP_KERNEL);
-    if (!init_probs){
-        kvfree(states);
-        return -ENOMEM;
-    }
+    ret = -ENOMEM;
+    init_probs = kvzalloc(sizeof(u32) * MC_MAX_STATES, GFP_KERNEL);
+    if (!init_probs)
+        goto free_states;
     _set_dlc_init_probs(init_probs);
-    transition_probs = kvmalloc(sizeof(u32[MC_MAX_STATES][MC_MAX_STATES]), GFP_KERNEL);
+    transition_probs = kvzalloc(sizeof(u32[MC_MAX_STATES][MC_MAX_STATES]), GFP_KERNEL);
     if (!transition_probs) {
-        kvfree(states);
         kvfree(init_probs);
-        return -ENOMEM;
+        goto free_states;
     }
     _set_dlc_transition_probs(transition_probs, p_loss, mu, mean_burst_len, mean_good_burst_len);
 
-    markov_chain_init(&dlc_data->main_chain, DLC_NUM_STATES, states, transition_probs, init_probs); // note: memcpy on array
-    printk(KERN_INFO "DLC module initialized\n");
+    ret = markov_chain_init(&dlc_data->main_chain, DLC_NUM_STATES, states, transition_probs, init_probs,
+                            node); // note: memcpy on array
+    if (!ret) {
+        dlc_data->use_fast = dlc_fast_model_build(dlc_data);
+        printk(KERN_INFO "DLC module initialized%s\n", dlc_data->use_fast ? " (fast path)" : "");
+    }
 
     // cleanup since markov_chain_init copy arrays to itself
-    kvfree(states);
     kvfree(init_probs);
     kvfree(transition_probs);
+    if (!ret) {
+        kvfree(states);
+        return 0;
+    }
+
+free_states:
+    dlc_simple_state_destroy(&states[0].simple);
+    markov_chain_const_destroy(&states[1].queue.mm1k_chain);
+    kvfree(states);
+    return ret;
+}
+
+int dlc_mod_set_tick(struct dlc_mod_data *dlc_data, u64 tick)
+{
+    struct markov_chain_const *mm1k = &dlc_data->main_chain.states[DLC_IDX_QUEUE].queue.mm1k_chain;
+    int ret;
+
+    if (!tick)
+        return 0;
+    if (dlc_data->main_chain.states[DLC_IDX_QUEUE].type != DLC_STATE_QUEUE_V2)
+        return -EINVAL;
+
+    ret = markov_chain_powers_init(&dlc_data->main_powers, dlc_data->main_chain.num_states,
+                                   dlc_data->main_chain.transition_probs, dlc_data->node);
+    if (ret)
+        return ret;
+    ret = markov_chain_powers_init(&dlc_data->queue_powers, mm1k->num_states, mm1k->transition_probs,
+                                   dlc_data->node);
+    if (ret) {
+        markov_chain_powers_destroy(&dlc_data->main_powers);
+        return ret;
+    }
+    dlc_data->tick = tick;
+    printk(KERN_INFO "DLC time-driven mode: tick %llu ns, powers main=%u queue=%u\n",
+           tick, dlc_data->main_powers.num_powers, dlc_data->queue_powers.num_powers);
     return 0;
 }
 
-struct dlc_packet_state dlc_mod_handle_packet(struct dlc_mod_data *dlc_data, struct sk_buff *skb)
+void dlc_mod_runtime_init_seed(struct dlc_mod_runtime *rt, const struct dlc_mod_data *dlc_data,
+                               u64 seed)
+{
+    rt->model = dlc_data;
+    rt->last_time = 0;
+    prandom_seed_state(&rt->rnd, seed);
+    rt->main_state = markov_chain_initial(&dlc_data->main_chain, &rt->rnd);
+    rt->queue_state = markov_chain_const_initial(
+        &dlc_data->main_chain.states[DLC_IDX_QUEUE].queue.mm1k_chain, &rt->rnd);
+}
+
+void dlc_mod_runtime_init(struct dlc_mod_runtime *rt, const struct dlc_mod_data *dlc_data)
+{
+    dlc_mod_runtime_init_seed(rt, dlc_data, get_random_u64());
+}
+
+void dlc_mod_advance_time(struct dlc_mod_runtime *rt, u64 now)
+{
+    const struct dlc_mod_data *dlc_data = rt->model;
+    u64 k;
+
+    if (unlikely(!rt->last_time)) {
+        rt->last_time = now;
+        return;
+    }
+    if (now < rt->last_time + dlc_data->tick)
+        return;
+
+    k = div64_u64(now - rt->last_time, dlc_data->tick);
+    rt->last_time += k * dlc_data->tick;
+
+    rt->main_state = markov_chain_powers_jump(&dlc_data->main_powers, rt->main_state, k, &rt->rnd);
+    rt->queue_state = markov_chain_powers_jump(&dlc_data->queue_powers, rt->queue_state, k, &rt->rnd);
+}
+
+static inline struct dlc_packet_state dlc_fast_step(struct dlc_mod_runtime *rt)
+{
+    const struct dlc_fast_model *f = &rt->model->fast;
+    u32 curr = rt->main_state;
+    u32 rnd = dlc_random_u32(&rt->rnd);
+    struct dlc_packet_state pkt_state = { .loss = false };
+    u32 q;
+
+    curr = f->base[curr] + (rnd >= f->lo[curr]) + (rnd >= f->hi[curr]);
+    rt->main_state = curr;
+
+    if (curr == DLC_IDX_QUEUE) {
+        q = rt->queue_state;
+        if (dlc_random_u32(&rt->rnd) < f->queue_down)
+            q = q ? q - 1 : 0;
+        else
+            q = q < f->queue_top ? q + 1 : q;
+        rt->queue_state = q;
+        pkt_state.delay = f->queue_states[q].delay;
+    } else if (curr == DLC_IDX_SIMPLE) {
+        if (f->simple_table)
+            pkt_state.delay = f->simple_table[reciprocal_scale(dlc_random_u32(&rt->rnd), f->simple_size)];
+        else
+            pkt_state.delay = tabledist(f->simple_delay, f->simple_jitter, NULL, &rt->rnd);
+    } else {
+        pkt_state.delay = f->loss_delay;
+        pkt_state.loss = true;
+    }
+    return pkt_state;
+}
+
+struct dlc_packet_state dlc_mod_handle_packet(struct dlc_mod_runtime *rt, struct sk_buff *skb)
 { 
-    struct dlc_state *state;
+    const struct dlc_mod_data *dlc_data = rt->model;
+    const struct dlc_state *state;
     struct dlc_packet_state pkt_state;
 
-    state = markov_chain_step(&dlc_data->main_chain);
+    if (likely(dlc_data->use_fast))
+        return dlc_fast_step(rt);
+
+    rt->main_state = markov_chain_next(&dlc_data->main_chain, rt->main_state, &rt->rnd);
+    state = &dlc_data->main_chain.states[rt->main_state];
     switch (state->type) {
         case DLC_STATE_SIMPLE:
-            pkt_state = dlc_simple_state_step(&state->simple);
+            pkt_state = dlc_simple_state_step(&state->simple, &rt->rnd);
             break;
         case DLC_STATE_QUEUE_V2:
-            pkt_state = dlc_queue_state_v2_step(&state->queue);
+            pkt_state = dlc_queue_state_v2_step(&state->queue, &rt->queue_state, &rt->rnd);
             break;
         case DLC_STATE_LOSS:
             pkt_state = dlc_loss_state_step(&state->loss);
@@ -126,12 +347,32 @@ struct dlc_packet_state dlc_mod_handle_packet(struct dlc_mod_data *dlc_data, str
     return pkt_state;
 }
 
+/* Same as n calls of dlc_mod_handle_packet(), e.g. for segments of GSO skb */
+void dlc_mod_handle_packets(struct dlc_mod_runtime *rt, struct sk_buff *skb,
+                            struct dlc_packet_state *pkt_states, u32 n)
+{
+    u32 i;
+
+    if (likely(rt->model->use_fast)) {
+        for (i = 0; i < n; i++)
+            pkt_states[i] = dlc_fast_step(rt);
+        return;
+    }
+    for (i = 0; i < n; i++)
+        pkt_states[i] = dlc_mod_handle_packet(rt, skb);
+}
+
 void dlc_mod_destroy(struct dlc_mod_data *dlc_data){
     int i;
     for (i = 0; i < dlc_data->main_chain.num_states; i++){
         if (dlc_data->main_chain.states[i].type == DLC_STATE_QUEUE_V2){ // write here all states with internal chains
             markov_chain_const_destroy(&(dlc_data->main_chain.states[i].queue.mm1k_chain));
         }
+        if (dlc_data->main_chain.states[i].type == DLC_STATE_SIMPLE){ // and all states with own tables
+            dlc_simple_state_destroy(&(dlc_data->main_chain.states[i].simple));
+        }
     }
     markov_chain_destroy(&(dlc_data->main_chain));
+    markov_chain_powers_destroy(&dlc_data->main_powers);
+    markov_chain_powers_destroy(&dlc_data->queue_powers);
 }
@@ -3,17 +3,78 @@
 
 #include "states.h"
 
+#include <linux/numa.h>
 #include <linux/types.h>
 #include <linux/skbuff.h>
 
 #define DLC_NUM_STATES 3
 
+/* Indexes of states in main chain, as built by dlc_mod_init() */
+#define DLC_IDX_SIMPLE  0
+#define DLC_IDX_QUEUE   1
+#define DLC_IDX_LOSS    2
+
+/*
+ * Fused parameters for the SIMPLE -> QUEUE_V2 -> LOSS topology.
+ * Transitions [SIMPLE][LOSS] and [LOSS][SIMPLE] are known to be zero, so
+ * every main chain row is described by two thresholds:
+ *   next = base[s] + (rnd >= lo[s]) + (rnd >= hi[s])
+ * Thresholds are 2^32-scaled and u64, DLC_PROB_ONE means "never".
+ * The M/M/1/K chain is birth-death: rnd < queue_down moves one step down
+ * (stays at 0), otherwise one step up (stays at top).
+ */
+struct dlc_fast_model {
+    u64 lo[DLC_NUM_STATES];
+    u64 hi[DLC_NUM_STATES];
+    u32 base[DLC_NUM_STATES];
+
+    /* SIMPLE */
+    s64 simple_delay;
+    s64 simple_jitter;
+    const s64 *simple_table;            /* owned by SIMPLE state */
+    u32 simple_size;
+
+    /* QUEUE_V2 */
+    u64 queue_down;
+    u32 queue_top;
+    const struct dlc_const_state *queue_states;
+
+    /* LOSS */
+    s64 loss_delay;
+};
+
+/*
+ * Model built from parameters, immutable after init and shared between
+ * instances (see dlc_template.h). Per-instance state is dlc_mod_runtime.
+ */
 struct dlc_mod_data {
     /* Markov chain for overall DLC model */
     struct markov_chain main_chain;
 
-    /* Pre-built distribution tables (from netem), passed from userspace setup */
+    /* Specialized step, used when main_chain matches the default topology */
+    bool use_fast;
+    struct dlc_fast_model fast;
+
+    /* Pre-built distribution tables (from netem), passed from userspace setup.
+     * Only read on init to build per-state delay tables. */
     struct disttable* delay_dist;   /* read only */
+
+    /* NUMA node of all allocations of the model (NUMA_NO_NODE = any) */
+    int node;
+
+    /* Time-driven mode: chains also age by one step per tick of idle time */
+    u64 tick;                       /* ns, 0 = off */
+    struct markov_chain_powers main_powers;
+    struct markov_chain_powers queue_powers;    /* of M/M/1/K chain */
+};
+
+/* Per-instance state of a model */
+struct dlc_mod_runtime {
+    const struct dlc_mod_data *model;
+    u32 main_state;
+    u32 queue_state;                /* state of M/M/1/K chain */
+    u64 last_time;                  /* time-driven mode */
+    struct rnd_state rnd;           /* all model draws, part of checkpoint */
 };
 
 /* Called on init, from tc/netlink or sysfs */
@@ -26,11 +87,25 @@ int dlc_mod_init(struct dlc_mod_data *dlc_data,
                  u32 mu,
                  u32 mean_burst_len,
                  u32 mean_good_burst_len,
-                 struct disttable* dist
+                 struct disttable* dist,
+                 int node
 );
 
+/* Enables time-driven mode, called after dlc_mod_init() */
+int dlc_mod_set_tick(struct dlc_mod_data *dlc_data, u64 tick);
+
+/* Start runtime with a fresh random seed, initial states drawn from it */
+void dlc_mod_runtime_init(struct dlc_mod_runtime *rt, const struct dlc_mod_data *dlc_data);
+void dlc_mod_runtime_init_seed(struct dlc_mod_runtime *rt, const struct dlc_mod_data *dlc_data,
+                               u64 seed);
+
+/* Age the chains by (now - last_time) / tick steps, O(log k) */
+void dlc_mod_advance_time(struct dlc_mod_runtime *rt, u64 now);
+
 /* Called per packet */
-struct dlc_packet_state dlc_mod_handle_packet(struct dlc_mod_data *dlc_data, struct sk_buff *skb);
+struct dlc_packet_state dlc_mod_handle_packet(struct dlc_mod_runtime *rt, struct sk_buff *skb);
+void dlc_mod_handle_packets(struct dlc_mod_runtime *rt, struct sk_buff *skb,
+                            struct dlc_packet_state *pkt_states, u32 n);
 
 void dlc_mod_destroy(struct dlc_mod_data *dlc_data);
 
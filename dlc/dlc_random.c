@@ -6,27 +6,31 @@
  * std deviation sigma.  Uses table lookup to approximate the desired
  * distribution, and a uniformly-distributed pseudo-random source.
  */
-s64 tabledist(s64 mu, s32 sigma, const struct disttable *dist)
+s64 tabledist(s64 mu, s32 sigma, const struct disttable *dist, struct rnd_state *state)
 {
-    s64 x;
-    long t;
     u32 rnd;
 
     if (sigma == 0)
         return mu;
 
-    rnd = prandom_u32();
+    rnd = dlc_random_u32(state);
 
     /* default uniform distribution */
     if (dist == NULL)
-        return ((rnd % (2 * (u32)sigma)) + mu) - sigma;
+        return ((s64)reciprocal_scale(rnd, 2 * (u32)sigma) + mu) - sigma;
+
+    return tabledist_value(mu, sigma, dist->table[reciprocal_scale(rnd, dist->size)]);
+}
+
+s64 tabledist_value(s64 mu, s32 sigma, s16 t)
+{
+    s64 x;
 
-    t = dist->table[rnd % dist->size];
-    x = (sigma % NETEM_DIST_SCALE) * t;
+    x = (s64)(sigma % NETEM_DIST_SCALE) * t;
     if (x >= 0)
         x += NETEM_DIST_SCALE/2;
     else
         x -= NETEM_DIST_SCALE/2;
 
-    return  x / NETEM_DIST_SCALE + (sigma / NETEM_DIST_SCALE) * t + mu;
+    return  x / NETEM_DIST_SCALE + (s64)(sigma / NETEM_DIST_SCALE) * t + mu;
 }
\ No newline at end of file
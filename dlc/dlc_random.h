@@ -2,6 +2,8 @@
 #define _DLC_RANDOM_H
 
 #include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
 #include <linux/random.h>
 
 struct disttable {
@@ -9,9 +11,34 @@ struct disttable {
     s16 table[0];
 };
 
-s64 tabledist(s64 mu, s32 sigma, const struct disttable *dist);
+/*
+ * Model draws come from a per-instance prandom state kept in the runtime,
+ * so the whole runtime can be checkpointed and restored exactly.
+ */
+static inline u32 dlc_random_u32(struct rnd_state *rnd)
+{
+    return prandom_u32_state(rnd);
+}
+
+s64 tabledist(s64 mu, s32 sigma, const struct disttable *dist, struct rnd_state *rnd);
+
+/* value tabledist() returns for table entry t */
+s64 tabledist_value(s64 mu, s32 sigma, s16 t);
 
 // 100% = 1.0 = P(X) = 1 = dlc_prob_scale; 
+// Scale of probabilities passed from userspace (tc_dlc_qopt)
 #define DLC_PROB_SCALE 100000
 
+/*
+ * Internal probabilities are scaled to 2^32, so a draw is a plain compare
+ * of a raw random word against a threshold. 1.0 itself saturates to U32_MAX.
+ */
+#define DLC_PROB_SHIFT  32
+#define DLC_PROB_ONE    (1ULL << DLC_PROB_SHIFT)
+
+static inline u32 dlc_prob_clamp(u64 p)
+{
+    return p >= DLC_PROB_ONE ? U32_MAX : (u32)p;
+}
+
 #endif
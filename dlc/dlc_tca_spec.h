@@ -12,6 +12,15 @@ enum {
     TCA_DLC_MODEL,      // for dumping
     TCA_MARKOV_CHAIN,   // for dumping
     TCA_MARKOV_PROBS,    // for dumping
+    TCA_DLC_SLOT,
+    TCA_DLC_NOREORDER,  /* u32, 1 = clamp time_to_send to previous packet's */
+    TCA_DLC_LIMITS,
+    TCA_DLC_GSO,
+    TCA_DLC_TICK,       /* u64 ns, chains also age by one step per tick */
+    TCA_DLC_CHECKPOINT, /* struct tc_dlc_checkpoint, runtime state of the model */
+    TCA_DLC_STATS_RESET,    /* u32, any value: zero struct tc_dlc_xstats */
+    TCA_DLC_BYPASS,     /* struct tc_dlc_bypass */
+    TCA_DLC_RATE_TRACE, /* struct tc_dlc_rate_step[], empty = off */
     __TCA_DLC_MAX,
 };
 
@@ -30,6 +39,146 @@ struct tc_dlc_qopt {
     __u32   rate;                   /* max packet send rate */
 };
 
+/* Slot (aggregated) delivery: packets are released in batches on slot
+ * boundaries, at most max_packets/max_bytes per slot (0 = unlimited) */
+struct tc_dlc_slot {
+    __u64   period;                 /* slot length (ns), 0 = off */
+    __u32   max_packets;
+    __u32   max_bytes;
+};
+
+enum {
+    TC_DLC_OVERFLOW_TAIL,   /* drop arriving packet */
+    TC_DLC_OVERFLOW_HEAD,   /* drop earliest-due packets until it fits */
+};
+
+/* Admission limits on top of packet limit, checked before the model step */
+struct tc_dlc_limits {
+    __u64   bytes;                  /* max sum of packet lengths, 0 = unlimited */
+    __u64   mem;                    /* max sum of skb truesize, 0 = unlimited */
+    __u32   overflow;               /* TC_DLC_OVERFLOW_* */
+};
+
+enum {
+    TC_DLC_GSO_OFF,         /* one decision per skb */
+    TC_DLC_GSO_SEGMENT,     /* segment GSO skbs, one decision per segment */
+    TC_DLC_GSO_ARITH,       /* decide per segment, segment only if needed */
+};
+
+/* GSO skbs with more segments are always segmented in arith mode */
+#define DLC_GSO_MAX_SEGS    64
+
+struct tc_dlc_gso {
+    __u32   mode;                   /* TC_DLC_GSO_* */
+    __u32   max_spread;             /* arith: max delay difference of segments
+                                       kept in one skb (ns) */
+};
+
+/* Packets matching any set criterion skip the model: no loss, no delay,
+ * served from a direct FIFO before the tfifo. All zero = off */
+struct tc_dlc_bypass {
+    __u32   mark;
+    __u32   mark_mask;              /* (skb->mark & mark_mask) == mark, 0 = off */
+    __u32   prio_map;               /* bit i: skb->priority == i (0..TC_PRIO_MAX) */
+    __u32   limit;                  /* direct FIFO packets, 0 = qdisc limit */
+    __u64   dscp_map;               /* bit i: IPv4/IPv6 DSCP == i */
+};
+
+/* Time-varying link capacity: used instead of the constant rate, starts on
+ * the change that uploads it and repeats after the last step */
+struct tc_dlc_rate_step {
+    __u32   duration;               /* us */
+    __u32   rate;                   /* kbit/s, 0 = no capacity */
+};
+
+#define TC_DLC_CHECKPOINT_VERSION   1
+
+/* Runtime state of the model: dumped with the qdisc, restored on change if
+ * given. Restoring it on the same model resumes the exact packet sequence */
+struct tc_dlc_checkpoint {
+    __u32   version;                /* TC_DLC_CHECKPOINT_VERSION */
+    __u32   main_states;            /* model shape, must match on restore */
+    __u32   queue_states;
+    __u32   main_state;
+    __u32   queue_state;
+    __u32   rnd[4];                 /* prandom state s1..s4 */
+    __u32   pad;
+    __u64   tick_age;               /* ns since last tick step, ~0 = not started */
+};
+
+/*
+ * Lateness of released packets (now - time_to_send, ns), log-linear buckets:
+ * bucket 0 is below 2^MIN_SHIFT, the last one 2^MAX_SHIFT and above; every
+ * power of two in between is split into 2^SUB_BITS equal buckets.
+ */
+#define TC_DLC_LAT_SUB_BITS     2
+#define TC_DLC_LAT_MIN_SHIFT    10
+#define TC_DLC_LAT_MAX_SHIFT    36
+#define TC_DLC_LAT_BUCKETS      (2 + ((TC_DLC_LAT_MAX_SHIFT - TC_DLC_LAT_MIN_SHIFT) << TC_DLC_LAT_SUB_BITS))
+
+/*
+ * xstats: scheduling accuracy. One histogram per qdisc, written by dequeue
+ * under the qdisc lock and copied under sch_tree_lock on dump.
+ */
+struct tc_dlc_xstats {
+    __u64   released;               /* packets with recorded lateness */
+    __u64   late_sum;               /* ns */
+    __u64   late_max;               /* ns */
+    __u64   late_p50;               /* ns, upper bound of the bucket */
+    __u64   late_p99;
+    __u64   late_p999;
+    __u64   wd_fires;               /* timer expiries seen by dequeue */
+    __u64   wd_empty;               /* of them, ones that released nothing */
+    __u64   bypassed;               /* packets sent through the bypass FIFO */
+    __u64   hist[TC_DLC_LAT_BUCKETS];
+};
+
+/*
+ * Generic netlink family DLC_GENL_NAME: bulk control of dlc instances,
+ * addressed by ifindex and qdisc handle in the netns of the socket.
+ *
+ *   PREPARE {TXN, INSTANCE...}  build and stage options, any error aborts TXN
+ *   COMMIT  {TXN}               swap every staged instance of TXN in
+ *   ABORT   {TXN}               drop staged options of TXN
+ *   SET     {INSTANCE...}       PREPARE and COMMIT of one message
+ *   GET                         dump, one message per instance of the netns:
+ *                               IFINDEX, HANDLE, OPTIONS [, PENDING_TXN]
+ *
+ * INSTANCE nests IFINDEX, HANDLE and OPTIONS; OPTIONS is laid out as
+ * TCA_OPTIONS of tc (struct tc_dlc_qopt, then TCA_DLC_* attributes) and
+ * changes the instance the way tc qdisc change does. TXN is chosen by the
+ * client, non zero; an instance is staged for one TXN at a time. COMMIT fails
+ * with ESTALE if a staged instance was changed meanwhile, and a TXN not
+ * committed within 60 s of its first PREPARE is aborted; both drop the TXN.
+ */
+#define DLC_GENL_NAME       "dlc"
+#define DLC_GENL_VERSION    1
+
+enum {
+    DLC_CMD_UNSPEC,
+    DLC_CMD_PREPARE,
+    DLC_CMD_COMMIT,
+    DLC_CMD_ABORT,
+    DLC_CMD_SET,
+    DLC_CMD_GET,
+    __DLC_CMD_MAX,
+};
+
+#define DLC_CMD_MAX (__DLC_CMD_MAX - 1)
+
+enum {
+    DLC_A_UNSPEC,
+    DLC_A_TXN,          /* u32 */
+    DLC_A_INSTANCE,     /* nested, repeated */
+    DLC_A_IFINDEX,      /* u32 */
+    DLC_A_HANDLE,       /* u32, as tcm_handle */
+    DLC_A_OPTIONS,      /* binary, as TCA_OPTIONS */
+    DLC_A_PENDING_TXN,  /* u32, GET: instance is staged for this TXN */
+    __DLC_A_MAX,
+};
+
+#define DLC_A_MAX (__DLC_A_MAX - 1)
+
 // for dumping
 struct tc_dlc_model {
     __u32 mc_num_states;
@@ -0,0 +1,128 @@
+#include "dlc_template.h"
+
+#include <linux/err.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+
+#define DLC_TEMPLATE_HASH_BITS 8
+
+struct dlc_template {
+    struct hlist_node node;
+    unsigned int refcnt;            /* protected by dlc_templates_lock */
+    u32 hash;
+    struct dlc_mod_params params;
+    struct disttable *dist;         /* own copy, part of the key */
+    struct dlc_mod_data model;
+};
+
+static DEFINE_HASHTABLE(dlc_templates, DLC_TEMPLATE_HASH_BITS);
+static DEFINE_MUTEX(dlc_templates_lock);
+
+static size_t dist_bytes(const struct disttable *dist)
+{
+    return sizeof(*dist) + dist->size * sizeof(dist->table[0]);
+}
+
+static u32 template_hash(const struct dlc_mod_params *params, const struct disttable *dist)
+{
+    u32 hash = jhash(params, sizeof(*params), 0);
+
+    if (dist)
+        hash = jhash(dist, dist_bytes(dist), hash);
+    return hash;
+}
+
+static bool template_match(const struct dlc_template *t, const struct dlc_mod_params *params,
+                           const struct disttable *dist)
+{
+    if (memcmp(&t->params, params, sizeof(*params)))
+        return false;
+    if (!t->dist || !dist)
+        return t->dist == dist;
+    return t->dist->size == dist->size && !memcmp(t->dist, dist, dist_bytes(dist));
+}
+
+static struct dlc_template *template_create(const struct dlc_mod_params *params,
+                                            const struct disttable *dist, u32 hash)
+{
+    struct dlc_template *t;
+    int ret = -ENOMEM;
+
+    t = kvzalloc_node(sizeof(*t), GFP_KERNEL, params->node);
+    if (!t)
+        return ERR_PTR(-ENOMEM);
+    if (dist) {
+        t->dist = kvmalloc_node(dist_bytes(dist), GFP_KERNEL, params->node);
+        if (!t->dist)
+            goto free_template;
+        memcpy(t->dist, dist, dist_bytes(dist));
+    }
+    t->params = *params;
+    t->hash = hash;
+    t->refcnt = 1;
+
+    ret = dlc_mod_init(&t->model,
+                       params->delay, params->jitter, params->mm1_rho, params->jitter_steps,
+                       params->p_loss, params->mu, params->mean_burst_len, params->mean_good_burst_len,
+                       t->dist, params->node);
+    if (ret)
+        goto free_dist;
+    ret = dlc_mod_set_tick(&t->model, params->tick);
+    if (ret) {
+        dlc_mod_destroy(&t->model);
+        goto free_dist;
+    }
+    return t;
+
+free_dist:
+    kvfree(t->dist);
+free_template:
+    kvfree(t);
+    return ERR_PTR(ret);
+}
+
+struct dlc_mod_data *dlc_template_get(const struct dlc_mod_params *params,
+                                      const struct disttable *dist)
+{
+    u32 hash = template_hash(params, dist);
+    struct dlc_template *t;
+
+    mutex_lock(&dlc_templates_lock);
+    hash_for_each_possible(dlc_templates, t, node, hash) {
+        if (t->hash == hash && template_match(t, params, dist)) {
+            t->refcnt++;
+            goto unlock;
+        }
+    }
+    /* built under the lock, so equal concurrent requests share one build */
+    t = template_create(params, dist, hash);
+    if (!IS_ERR(t))
+        hash_add(dlc_templates, &t->node, hash);
+unlock:
+    mutex_unlock(&dlc_templates_lock);
+    return IS_ERR(t) ? ERR_CAST(t) : &t->model;
+}
+
+void dlc_template_put(struct dlc_mod_data *model)
+{
+    struct dlc_template *t;
+
+    if (!model)
+        return;
+    t = container_of(model, struct dlc_template, model);
+
+    mutex_lock(&dlc_templates_lock);
+    if (--t->refcnt) {
+        mutex_unlock(&dlc_templates_lock);
+        return;
+    }
+    hash_del(&t->node);
+    mutex_unlock(&dlc_templates_lock);
+
+    dlc_mod_destroy(&t->model);
+    kvfree(t->dist);
+    kvfree(t);
+}
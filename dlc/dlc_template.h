@@ -0,0 +1,31 @@
+#ifndef _DLC_TEMPLATE_H
+#define _DLC_TEMPLATE_H
+
+#include "dlc_mod.h"
+
+/*
+ * Module-wide cache of immutable models. Instances with equal parameters and
+ * delay distribution share one refcounted dlc_mod_data, only their
+ * dlc_mod_runtime differs. Get/put may sleep (mutex, allocations).
+ * The NUMA node is part of the key: instances on different nodes get their
+ * own node-local copy.
+ */
+struct dlc_mod_params {
+    s64 delay;
+    s64 jitter;
+    s64 mm1_rho;
+    u32 jitter_steps;
+    u32 p_loss;
+    u32 mu;
+    u32 mean_burst_len;
+    u32 mean_good_burst_len;
+    s32 node;               /* NUMA node to allocate on, NUMA_NO_NODE = any */
+    u64 tick;               /* struct is hashed as bytes: no holes */
+};
+
+/* Returns shared model or ERR_PTR(), dist may be NULL */
+struct dlc_mod_data *dlc_template_get(const struct dlc_mod_params *params,
+                                      const struct disttable *dist);
+void dlc_template_put(struct dlc_mod_data *model);
+
+#endif
@@ -0,0 +1,320 @@
+#include "dlc_timer.h"
+
+#include <linux/bitmap.h>
+#include <linux/hrtimer.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <net/sch_generic.h>
+
+/*
+ * Two levels: level 0 has one bucket per granularity slot for the next
+ * DLC_WHEEL_SIZE slots, level 1 one bucket per DLC_WHEEL_SIZE slots (one level
+ * 0 turn) for the turns after. A level 1 bucket is cascaded down when its turn
+ * begins, so every level 0 bucket holds a single slot and is due when walked.
+ * Timers beyond level 1 (SIZE^2 slots, 13 s at 50 us) wait in its last bucket.
+ */
+#define DLC_WHEEL_BITS  9
+#define DLC_WHEEL_SIZE  (1U << DLC_WHEEL_BITS)
+#define DLC_WHEEL_MASK  (DLC_WHEEL_SIZE - 1)
+#define DLC_WHEEL_LEVELS 2
+
+static bool shared_timer;
+module_param(shared_timer, bool, 0444);
+MODULE_PARM_DESC(shared_timer, "Use per-CPU timer wheels instead of one hrtimer per qdisc");
+
+static unsigned int timer_granularity_us = 50;
+module_param(timer_granularity_us, uint, 0444);
+MODULE_PARM_DESC(timer_granularity_us, "Wakeup coalescing granularity of shared timer (us)");
+
+struct dlc_wheel {
+    DECLARE_BITMAP(pending, DLC_WHEEL_SIZE);
+    struct hlist_head buckets[DLC_WHEEL_SIZE];
+};
+
+struct dlc_timer_base {
+    spinlock_t lock;
+    struct hrtimer timer;
+    u64 clk;                /* first slot not walked yet */
+    u64 next_expiry;        /* hrtimer is armed for it, U64_MAX = idle */
+    struct dlc_wheel wheel[DLC_WHEEL_LEVELS];
+};
+
+static DEFINE_PER_CPU(struct dlc_timer_base, dlc_timer_bases);
+static u64 granularity_ns;
+static bool service_running;
+
+static inline u64 slot_of(u64 t)
+{
+    return div64_u64(t, granularity_ns);
+}
+
+static void dlc_timer_kick(struct dlc_timer *t)
+{
+    WRITE_ONCE(t->fired, 1);
+    rcu_read_lock();
+    __netif_schedule(qdisc_root(t->qdisc));
+    rcu_read_unlock();
+}
+
+/* Level and bucket of a slot not walked yet */
+static void dlc_timer_link(struct dlc_timer_base *base, struct dlc_timer *t)
+{
+    u64 slot = slot_of(t->expires);
+    u64 turn;
+
+    if (slot - base->clk < DLC_WHEEL_SIZE) {
+        t->level = 0;
+        t->idx = slot & DLC_WHEEL_MASK;
+    } else {
+        turn = min(slot >> DLC_WHEEL_BITS, (base->clk >> DLC_WHEEL_BITS) + DLC_WHEEL_MASK);
+        t->level = 1;
+        t->idx = turn & DLC_WHEEL_MASK;
+    }
+    hlist_add_head(&t->node, &base->wheel[t->level].buckets[t->idx]);
+    __set_bit(t->idx, base->wheel[t->level].pending);
+}
+
+static void dlc_timer_unlink(struct dlc_timer_base *base, struct dlc_timer *t)
+{
+    struct dlc_wheel *w = &base->wheel[t->level];
+
+    hlist_del_init(&t->node);
+    if (hlist_empty(&w->buckets[t->idx]))
+        __clear_bit(t->idx, w->pending);
+}
+
+/* first offset >= off from clk (of the level) with a non-empty bucket, DLC_WHEEL_SIZE if none */
+static unsigned int next_pending(const struct dlc_wheel *w, u64 clk, unsigned int off)
+{
+    unsigned int start = clk & DLC_WHEEL_MASK;
+    unsigned int pos, bit;
+
+    if (off >= DLC_WHEEL_SIZE)
+        return DLC_WHEEL_SIZE;
+    pos = (start + off) & DLC_WHEEL_MASK;
+    if (pos >= start) {
+        bit = find_next_bit(w->pending, DLC_WHEEL_SIZE, pos);
+        if (bit < DLC_WHEEL_SIZE)
+            return bit - start;
+        bit = find_first_bit(w->pending, start);
+    } else {
+        bit = find_next_bit(w->pending, start, pos);
+    }
+    return bit < start ? bit + DLC_WHEEL_SIZE - start : DLC_WHEEL_SIZE;
+}
+
+static void expire_bucket(struct dlc_timer_base *base, unsigned int idx)
+{
+    struct dlc_timer *t;
+    struct hlist_node *tmp;
+
+    hlist_for_each_entry_safe(t, tmp, &base->wheel[0].buckets[idx], node) {
+        hlist_del_init(&t->node);
+        dlc_timer_kick(t);
+    }
+    __clear_bit(idx, base->wheel[0].pending);
+}
+
+/* clk entered a new turn: its level 1 bucket goes down (or stays, if clamped) */
+static void cascade(struct dlc_timer_base *base)
+{
+    unsigned int idx = (base->clk >> DLC_WHEEL_BITS) & DLC_WHEEL_MASK;
+    struct dlc_timer *t;
+    struct hlist_node *tmp;
+    HLIST_HEAD(list);
+
+    hlist_move_list(&base->wheel[1].buckets[idx], &list);
+    __clear_bit(idx, base->wheel[1].pending);
+    hlist_for_each_entry_safe(t, tmp, &list, node) {
+        hlist_del_init(&t->node);
+        dlc_timer_link(base, t);
+    }
+}
+
+/*
+ * Walk every slot up to now_slot, one turn at a time, idle turns skipped.
+ * Whenever clk lands on the start of a turn, that turn is cascaded at once,
+ * so level 1 never holds a timer of the turn of clk.
+ */
+static void dlc_timer_run(struct dlc_timer_base *base, u64 now_slot)
+{
+    while (base->clk <= now_slot) {
+        u64 last = min(now_slot, base->clk | DLC_WHEEL_MASK);
+        unsigned int n = last - base->clk + 1;
+        unsigned int off;
+
+        for (off = next_pending(&base->wheel[0], base->clk, 0); off < n;
+             off = next_pending(&base->wheel[0], base->clk, off + 1))
+            expire_bucket(base, (base->clk + off) & DLC_WHEEL_MASK);
+        base->clk = last + 1;
+        if (base->clk & DLC_WHEEL_MASK)
+            break;
+
+        if (bitmap_empty(base->wheel[0].pending, DLC_WHEEL_SIZE)) {
+            u64 turn = base->clk >> DLC_WHEEL_BITS;
+
+            off = next_pending(&base->wheel[1], turn, 0);
+            if (off == DLC_WHEEL_SIZE || turn + off > (now_slot >> DLC_WHEEL_BITS)) {
+                base->clk = max(base->clk, now_slot + 1);
+                if (!(base->clk & DLC_WHEEL_MASK))
+                    cascade(base);
+                break;
+            }
+            base->clk = (turn + off) << DLC_WHEEL_BITS;
+        }
+        cascade(base);
+    }
+}
+
+/*
+ * Level 0 buckets hold one slot each, the first pending one is the earliest;
+ * a pending level 1 bucket wakes up at the start of its turn to cascade.
+ */
+static u64 dlc_next_expiry(const struct dlc_timer_base *base)
+{
+    u64 turn = base->clk >> DLC_WHEEL_BITS;
+    u64 next = U64_MAX;
+    unsigned int off;
+
+    off = next_pending(&base->wheel[0], base->clk, 0);
+    if (off < DLC_WHEEL_SIZE)
+        next = (base->clk + off) * granularity_ns;
+    off = next_pending(&base->wheel[1], turn, 1);
+    if (off < DLC_WHEEL_SIZE)
+        next = min(next, ((turn + off) << DLC_WHEEL_BITS) * granularity_ns);
+    return next;
+}
+
+static enum hrtimer_restart dlc_timer_fire(struct hrtimer *timer)
+{
+    struct dlc_timer_base *base = container_of(timer, struct dlc_timer_base, timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+    spin_lock(&base->lock);
+    dlc_timer_run(base, slot_of(ktime_get_ns()));
+    base->next_expiry = dlc_next_expiry(base);
+    if (base->next_expiry != U64_MAX) {
+        hrtimer_set_expires(timer, ns_to_ktime(base->next_expiry));
+        ret = HRTIMER_RESTART;
+    }
+    spin_unlock(&base->lock);
+    return ret;
+}
+
+/* Unlink t from its wheel, unless it is already queued here for expires */
+static bool dlc_timer_detach(struct dlc_timer *t, u64 expires)
+{
+    struct dlc_timer_base *base = per_cpu_ptr(&dlc_timer_bases, t->cpu);
+    bool queued = false;
+
+    spin_lock(&base->lock);
+    if (!hlist_unhashed(&t->node)) {
+        if (t->expires == expires && t->cpu == smp_processor_id())
+            queued = true;
+        else
+            dlc_timer_unlink(base, t);
+    }
+    spin_unlock(&base->lock);
+    return queued;
+}
+
+void dlc_timer_init(struct dlc_timer *t, struct Qdisc *qdisc)
+{
+    INIT_HLIST_NODE(&t->node);
+    t->expires = 0;
+    t->cpu = 0;
+    t->fired = 0;
+    t->qdisc = qdisc;
+}
+
+/* Queue t on the wheel of current CPU, replaces previous expiry */
+void dlc_timer_schedule(struct dlc_timer *t, u64 expires)
+{
+    struct dlc_timer_base *base;
+    u64 slot;
+
+    if (test_bit(__QDISC_STATE_DEACTIVATED, &qdisc_root_sleeping(t->qdisc)->state))
+        return;
+
+    slot = slot_of(expires + granularity_ns - 1);
+    expires = slot * granularity_ns;
+
+    local_bh_disable();
+    if (dlc_timer_detach(t, expires))
+        goto out;
+
+    base = this_cpu_ptr(&dlc_timer_bases);
+    spin_lock(&base->lock);
+    if (slot < base->clk) {
+        /* slot is already walked */
+        spin_unlock(&base->lock);
+        dlc_timer_kick(t);
+        goto out;
+    }
+    t->expires = expires;
+    t->cpu = smp_processor_id();
+    dlc_timer_link(base, t);
+    if (expires < base->next_expiry) {
+        base->next_expiry = expires;
+        hrtimer_start(&base->timer, ns_to_ktime(expires), HRTIMER_MODE_ABS_PINNED_SOFT);
+    }
+    spin_unlock(&base->lock);
+out:
+    local_bh_enable();
+}
+
+void dlc_timer_cancel(struct dlc_timer *t)
+{
+    if (!service_running)
+        return;
+    local_bh_disable();
+    dlc_timer_detach(t, 0);
+    local_bh_enable();
+}
+
+bool dlc_timer_enabled(void)
+{
+    return service_running;
+}
+
+int dlc_timer_service_init(void)
+{
+    int cpu, i, l;
+
+    if (!shared_timer)
+        return 0;
+
+    granularity_ns = (u64)max(timer_granularity_us, 1U) * NSEC_PER_USEC;
+    for_each_possible_cpu(cpu) {
+        struct dlc_timer_base *base = per_cpu_ptr(&dlc_timer_bases, cpu);
+
+        spin_lock_init(&base->lock);
+        hrtimer_init(&base->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_PINNED_SOFT);
+        base->timer.function = dlc_timer_fire;
+        base->clk = slot_of(ktime_get_ns());
+        base->next_expiry = U64_MAX;
+        for (l = 0; l < DLC_WHEEL_LEVELS; l++) {
+            bitmap_zero(base->wheel[l].pending, DLC_WHEEL_SIZE);
+            for (i = 0; i < DLC_WHEEL_SIZE; i++)
+                INIT_HLIST_HEAD(&base->wheel[l].buckets[i]);
+        }
+    }
+    service_running = true;
+    pr_info("dlc: shared timer service, granularity %llu ns\n", granularity_ns);
+    return 0;
+}
+
+void dlc_timer_service_exit(void)
+{
+    int cpu;
+
+    if (!service_running)
+        return;
+    for_each_possible_cpu(cpu)
+        hrtimer_cancel(&per_cpu_ptr(&dlc_timer_bases, cpu)->timer);
+    service_running = false;
+}
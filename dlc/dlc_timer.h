@@ -0,0 +1,34 @@
+#ifndef _DLC_TIMER_H
+#define _DLC_TIMER_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+struct Qdisc;
+
+/*
+ * Module-wide timer service: instead of one hrtimer per qdisc (qdisc_watchdog),
+ * every CPU owns one hrtimer and a two-level timing wheel. Qdiscs register their
+ * next due time in the wheel of the current CPU, the timer fires once per
+ * granularity slot at most and schedules every qdisc that became due.
+ * Enabled with module param shared_timer=1.
+ */
+struct dlc_timer {
+    struct hlist_node node;
+    u64 expires;            /* ns, rounded up to granularity; 0 = not queued */
+    int cpu;                /* wheel the timer is queued on */
+    u16 level;              /* and its bucket there */
+    u16 idx;
+    int fired;              /* set on expiry, the owner takes it with xchg() */
+    struct Qdisc *qdisc;
+};
+
+bool dlc_timer_enabled(void);
+int dlc_timer_service_init(void);
+void dlc_timer_service_exit(void);
+
+void dlc_timer_init(struct dlc_timer *t, struct Qdisc *qdisc);
+void dlc_timer_schedule(struct dlc_timer *t, u64 expires);
+void dlc_timer_cancel(struct dlc_timer *t);
+
+#endif
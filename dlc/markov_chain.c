@@ -4,55 +4,72 @@
 #include <linux/random.h>
 #include <linux/string.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
 
-static u32 select_initial_state(u32 num_states, u32 init_distribution[]) {
-    u32 rnd = get_random_u32() % DLC_PROB_SCALE;
-    u32 cum_prob = 0;
+static u32 select_initial_state(u32 num_states, const u32 init_distribution[], u32 rnd) {
+    u64 cum_prob = 0;
+    u32 last = 0;
     u32 i;
 
     for (i = 0; i < num_states; i++) {
+        if (!init_distribution[i])
+            continue;
+        last = i;
         cum_prob += init_distribution[i];
         if (rnd < cum_prob)
             return i;
     }
-    return num_states - 1; /* защита от ошибки округления */
+    return last; /* защита от ошибки округления */
 }
 
-static u32 calc_next_state_idx(u32 curr_state, u32 num_states, u32 transition_probs[][MC_MAX_STATES]){
-    u32 rnd = get_random_u32() % DLC_PROB_SCALE;
-    u32 next_state = num_states;
-    u32 cum_prob = 0;
-    u32 i;
+/* Called once on init: per-row cumulative thresholds in 2^32 scale */
+static void build_thresholds(u32 num_states, u32 transition_probs[][MC_MAX_STATES],
+                             u32 thresh[][MC_MAX_STATES], u32 row_last[])
+{
+    u32 i, j;
+    u64 cum_prob;
 
     for (i = 0; i < num_states; i++) {
-        cum_prob += transition_probs[curr_state][i];
-        if (rnd < cum_prob) {
-            next_state = i;
-            break;
+        cum_prob = 0;
+        row_last[i] = i;    /* empty row: stay */
+        for (j = 0; j < num_states; j++) {
+            cum_prob += transition_probs[i][j];
+            thresh[i][j] = dlc_prob_clamp(cum_prob);
+            if (transition_probs[i][j])
+                row_last[i] = j;
         }
     }
-    if (next_state == num_states) {
-        pr_info("dlc_model: failed to calc next state, use 0\n");
-        next_state = 0;
+}
+
+static inline u32 calc_next_state_idx(u32 curr_state, const u32 thresh[][MC_MAX_STATES], const u32 row_last[],
+                                      u32 rnd){
+    u32 last = row_last[curr_state];
+    u32 i;
+
+    for (i = 0; i < last; i++) {
+        if (rnd < thresh[curr_state][i])
+            return i;
     }
-    return next_state;
+    return last;
 }
 
-void markov_chain_init(struct markov_chain *mc, u32 num_states, 
+int markov_chain_init(struct markov_chain *mc, u32 num_states, 
                        struct dlc_state *states_array, 
                        u32 transition_probs[][MC_MAX_STATES],
-                       u32 init_distribution[MC_MAX_STATES])
+                       u32 init_distribution[MC_MAX_STATES],
+                       int node)
 {
     u32 i, j;
 
-    if (num_states > MC_MAX_STATES)
+    if (num_states > MC_MAX_STATES) {
         pr_info("dlc_model: num_states (%d) too big, cut to %d\n", num_states, MC_MAX_STATES);
         num_states = MC_MAX_STATES;
+    }
     mc->num_states = num_states;
-    mc->states = kvmalloc(sizeof(struct dlc_state) * num_states, GFP_KERNEL);
+    mc->states = kvmalloc_node(sizeof(struct dlc_state) * num_states, GFP_KERNEL, node);
     if (!mc->states){
         pr_err("dlc_model: failed to allocate memory for states\n");
-        return;
+        return -ENOMEM;
     }
     memcpy(mc->states, states_array, sizeof(struct dlc_state) * num_states);
     for (i = 0; i < num_states; i++) {
@@ -60,17 +77,19 @@ void markov_chain_init(struct markov_chain *mc, u32 num_states,
             mc->transition_probs[i][j] = transition_probs[i][j];
         }
     }
+    build_thresholds(num_states, mc->transition_probs, mc->transition_thresh, mc->row_last);
 
     memcpy(mc->init_distribution, init_distribution, sizeof(u32) * num_states);
+    return 0;
+}
 
-    /* выбор начального состояния согласно начальному распределению */
-    mc->curr_state = select_initial_state(num_states, mc->init_distribution);
+/* выбор начального состояния согласно начальному распределению */
+u32 markov_chain_initial(const struct markov_chain *mc, struct rnd_state *rnd) {
+    return select_initial_state(mc->num_states, mc->init_distribution, dlc_random_u32(rnd));
 }
 
-struct dlc_state* markov_chain_step(struct markov_chain *mc) {
-    u32 next_state = calc_next_state_idx(mc->curr_state, mc->num_states, mc->transition_probs);
-    mc->curr_state = next_state;
-    return &mc->states[mc->curr_state];
+u32 markov_chain_next(const struct markov_chain *mc, u32 curr_state, struct rnd_state *rnd) {
+    return calc_next_state_idx(curr_state, mc->transition_thresh, mc->row_last, dlc_random_u32(rnd));
 }
 
 void markov_chain_destroy(struct markov_chain *mc){
@@ -80,21 +99,23 @@ void markov_chain_destroy(struct markov_chain *mc){
 
 ///////////////////////////
 
-void markov_chain_const_init(struct markov_chain_const *mc, u32 num_states, 
+int markov_chain_const_init(struct markov_chain_const *mc, u32 num_states, 
     struct dlc_const_state *states_array, 
     u32 transition_probs[][MC_MAX_STATES],
-    u32 init_distribution[MC_MAX_STATES])
+    u32 init_distribution[MC_MAX_STATES],
+    int node)
 {
     u32 i, j;
 
-    if (num_states > MC_MAX_STATES)
-    pr_info("dlc_model: num_states (%d) too big, cut to %d\n", num_states, MC_MAX_STATES);
-    num_states = MC_MAX_STATES;
+    if (num_states > MC_MAX_STATES) {
+        pr_info("dlc_model: num_states (%d) too big, cut to %d\n", num_states, MC_MAX_STATES);
+        num_states = MC_MAX_STATES;
+    }
     mc->num_states = num_states;
-    mc->states = kvmalloc(sizeof(struct dlc_const_state) * num_states, GFP_KERNEL);
+    mc->states = kvmalloc_node(sizeof(struct dlc_const_state) * num_states, GFP_KERNEL, node);
     if (!mc->states){
         pr_err("dlc_model: failed to allocate memory for states\n");
-        return;
+        return -ENOMEM;
     }
     memcpy(mc->states, states_array, sizeof(struct dlc_const_state) * num_states);
 
@@ -103,17 +124,159 @@ void markov_chain_const_init(struct markov_chain_const *mc, u32 num_states,
             mc->transition_probs[i][j] = transition_probs[i][j];
         }
     }
+    build_thresholds(num_states, mc->transition_probs, mc->transition_thresh, mc->row_last);
     memcpy(mc->init_distribution, init_distribution, sizeof(u32) * num_states);
-    mc->curr_state = select_initial_state(num_states, mc->init_distribution);
+    return 0;
+}
+
+u32 markov_chain_const_initial(const struct markov_chain_const *mc, struct rnd_state *rnd) {
+    return select_initial_state(mc->num_states, mc->init_distribution, dlc_random_u32(rnd));
 }
 
-struct dlc_const_state* markov_chain_const_step(struct markov_chain_const *mc) {
-    u32 next_state = calc_next_state_idx(mc->curr_state, mc->num_states, mc->transition_probs);
-    mc->curr_state = next_state;
-    return &mc->states[mc->curr_state];
+u32 markov_chain_const_next(const struct markov_chain_const *mc, u32 curr_state, struct rnd_state *rnd) {
+    return calc_next_state_idx(curr_state, mc->transition_thresh, mc->row_last, dlc_random_u32(rnd));
 }
 
 void markov_chain_const_destroy(struct markov_chain_const *mc){
     kvfree(mc->states);
     mc->states = NULL;
 }
+
+///////////////////////////
+
+/* rows of P^(2^i) closer than this are treated as equal (~1e-6) */
+#define MC_POWERS_EPS   (1U << 12)
+
+static bool rows_converged(const u32 *m, u32 n)
+{
+    u32 i, j;
+
+    for (i = 1; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            u32 a = m[j], b = m[i * n + j];
+
+            if ((a > b ? a - b : b - a) > MC_POWERS_EPS)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* dst = src * src, all 2^32-scaled */
+static void square_matrix(u32 *dst, const u32 *src, u32 n)
+{
+    u32 i, j, l;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            u64 sum = 0;
+
+            for (l = 0; l < n; l++)
+                sum += ((u64)src[i * n + l] * src[l * n + j]) >> DLC_PROB_SHIFT;
+            dst[i * n + j] = dlc_prob_clamp(sum);
+        }
+    }
+}
+
+static void power_thresholds(struct markov_chain_powers *pw, u32 p, const u32 *m)
+{
+    u32 n = pw->num_states;
+    u32 *thresh = pw->thresh + p * n * n;
+    u32 i, j;
+
+    for (i = 0; i < n; i++) {
+        u64 cum_prob = 0;
+
+        pw->row_last[p * n + i] = i;
+        for (j = 0; j < n; j++) {
+            cum_prob += m[i * n + j];
+            thresh[i * n + j] = dlc_prob_clamp(cum_prob);
+            if (m[i * n + j])
+                pw->row_last[p * n + i] = j;
+        }
+    }
+}
+
+int markov_chain_powers_init(struct markov_chain_powers *pw, u32 num_states,
+                             u32 transition_probs[][MC_MAX_STATES], int node)
+{
+    u32 n = min_t(u32, num_states, MC_MAX_STATES);
+    u32 *buf, *cur, *next;
+    u32 i, j;
+
+    memset(pw, 0, sizeof(*pw));
+    pw->num_states = n;
+    pw->thresh = kvmalloc_node(sizeof(u32) * MC_MAX_POWERS * n * n, GFP_KERNEL, node);
+    pw->row_last = kvmalloc_node(sizeof(u32) * MC_MAX_POWERS * n, GFP_KERNEL, node);
+    buf = kvmalloc(sizeof(u32) * 2 * n * n, GFP_KERNEL);
+    if (!pw->thresh || !pw->row_last || !buf) {
+        kvfree(buf);
+        markov_chain_powers_destroy(pw);
+        return -ENOMEM;
+    }
+    cur = buf;
+    next = buf + n * n;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            cur[i * n + j] = transition_probs[i][j];
+
+    while (pw->num_powers < MC_MAX_POWERS) {
+        power_thresholds(pw, pw->num_powers++, cur);
+        if (rows_converged(cur, n)) {
+            pw->converged = true;
+            break;
+        }
+        square_matrix(next, cur, n);
+        swap(cur, next);
+    }
+    kvfree(buf);
+    return 0;
+}
+
+static u32 powers_draw(const struct markov_chain_powers *pw, u32 p, u32 curr_state,
+                       struct rnd_state *rnd_state)
+{
+    u32 n = pw->num_states;
+    const u32 *thresh = pw->thresh + (p * n + curr_state) * n;
+    u32 last = pw->row_last[p * n + curr_state];
+    u32 rnd = dlc_random_u32(rnd_state);
+    u32 i;
+
+    for (i = 0; i < last; i++) {
+        if (rnd < thresh[i])
+            return i;
+    }
+    return last;
+}
+
+/* State after k steps from curr_state: one draw per set bit of k */
+u32 markov_chain_powers_jump(const struct markov_chain_powers *pw, u32 curr_state, u64 k,
+                             struct rnd_state *rnd)
+{
+    u32 top = pw->num_powers - 1;
+    u32 p;
+
+    if (!k || !pw->num_powers)
+        return curr_state;
+    if (pw->converged && (k >> top))
+        return powers_draw(pw, top, curr_state, rnd);
+
+    /* not mixed after 2^MC_MAX_POWERS steps (periodic chain), cut the jump */
+    if (k >> pw->num_powers)
+        k = (1ULL << pw->num_powers) - 1;
+    for (p = 0; k; p++, k >>= 1) {
+        if (k & 1)
+            curr_state = powers_draw(pw, p, curr_state, rnd);
+    }
+    return curr_state;
+}
+
+void markov_chain_powers_destroy(struct markov_chain_powers *pw)
+{
+    kvfree(pw->thresh);
+    kvfree(pw->row_last);
+    pw->thresh = NULL;
+    pw->row_last = NULL;
+    pw->num_powers = 0;
+}
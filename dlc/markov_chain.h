@@ -2,6 +2,7 @@
 #define _MARKOV_CHAIN_H
 
 #include <linux/types.h>
+#include <linux/random.h>
 
 #define MC_MAX_STATES 32  /* должно гарантировать вместимость */
 
@@ -11,41 +12,78 @@ struct dlc_const_state;
 struct markov_chain {
     struct dlc_state* states;
     u32 num_states;
-    u32 curr_state;
 
-    /* Вероятности scaled на 0..DLC_PROB_SCALE (для точности 0.001%) */
+    /* Вероятности scaled на 0..DLC_PROB_ONE (2^32, насыщается до U32_MAX) */
     u32 transition_probs[MC_MAX_STATES][MC_MAX_STATES];
 
-    /* начальное распределение состояний scaled на 0..DLC_PROB_SCALE */
+    /* cumulative row thresholds: next state is the first j with rnd < thresh[i][j] */
+    u32 transition_thresh[MC_MAX_STATES][MC_MAX_STATES];
+    /* last reachable state of a row, taken when rnd is above all thresholds */
+    u32 row_last[MC_MAX_STATES];
+
+    /* начальное распределение состояний scaled на 0..DLC_PROB_ONE */
     u32 init_distribution[MC_MAX_STATES];
 };
 
-void markov_chain_init(struct markov_chain *mc, u32 num_states, 
+/* Allocations of the chain go to NUMA node `node` (NUMA_NO_NODE = any) */
+int markov_chain_init(struct markov_chain *mc, u32 num_states, 
                        struct dlc_state *states_array, 
                        u32 transition_probs[][MC_MAX_STATES],
-                       u32 init_distribution[MC_MAX_STATES]);
+                       u32 init_distribution[MC_MAX_STATES],
+                       int node);
 
-struct dlc_state* markov_chain_step(struct markov_chain *mc);
+/*
+ * Chains are immutable after init (shared by instances), the state and the
+ * PRNG are the caller's
+ */
+u32 markov_chain_initial(const struct markov_chain *mc, struct rnd_state *rnd);
+u32 markov_chain_next(const struct markov_chain *mc, u32 curr_state, struct rnd_state *rnd);
 
 void markov_chain_destroy(struct markov_chain *mc);
 
 
+/*
+ * Cached binary powers P^(2^i) of a transition matrix, for jumping k steps
+ * ahead in O(log k). Stored as cumulative rows like transition_thresh.
+ * Squaring stops once all rows of a power are equal (chain has mixed):
+ * every larger jump is then one draw from that row.
+ */
+#define MC_MAX_POWERS 32
+
+struct markov_chain_powers {
+    u32 num_states;
+    u32 num_powers;
+    bool converged;
+    u32 *thresh;        /* [num_powers][num_states][num_states] */
+    u32 *row_last;      /* [num_powers][num_states] */
+};
+
+int markov_chain_powers_init(struct markov_chain_powers *pw, u32 num_states,
+                             u32 transition_probs[][MC_MAX_STATES], int node);
+u32 markov_chain_powers_jump(const struct markov_chain_powers *pw, u32 curr_state, u64 k,
+                             struct rnd_state *rnd);
+void markov_chain_powers_destroy(struct markov_chain_powers *pw);
+
+
 /* Used in dlc_queue_state_v2 to deal with cyclic dependency.*/
 struct markov_chain_const {
     struct dlc_const_state* states;
     u32 num_states;
-    u32 curr_state;
 
     u32 transition_probs[MC_MAX_STATES][MC_MAX_STATES];
+    u32 transition_thresh[MC_MAX_STATES][MC_MAX_STATES];
+    u32 row_last[MC_MAX_STATES];
     u32 init_distribution[MC_MAX_STATES];
 };
 
-void markov_chain_const_init(struct markov_chain_const *mc, u32 num_states, 
+int markov_chain_const_init(struct markov_chain_const *mc, u32 num_states, 
     struct dlc_const_state *states_array, 
     u32 transition_probs[][MC_MAX_STATES],
-    u32 init_distribution[MC_MAX_STATES]);
+    u32 init_distribution[MC_MAX_STATES],
+    int node);
 
-struct dlc_const_state* markov_chain_const_step(struct markov_chain_const *mc);
+u32 markov_chain_const_initial(const struct markov_chain_const *mc, struct rnd_state *rnd);
+u32 markov_chain_const_next(const struct markov_chain_const *mc, u32 curr_state, struct rnd_state *rnd);
 
 void markov_chain_const_destroy(struct markov_chain_const *mc);
 
@@ -7,7 +7,7 @@ int dlc_const_state_init(struct dlc_const_state *state, s64 delay){
     return 0;
 }
 
-struct dlc_packet_state dlc_const_state_step(struct dlc_const_state *state) {
+struct dlc_packet_state dlc_const_state_step(const struct dlc_const_state *state) {
     struct dlc_packet_state res = {
         .delay = state->delay,
         .loss = false
@@ -19,30 +19,50 @@ struct dlc_packet_state dlc_const_state_step(struct dlc_const_state *state) {
 int dlc_simple_state_init(struct dlc_simple_state *state, 
                            s64 delay_mean,
                            s64 jitter,
-                           struct disttable* distr
+                           struct disttable* distr,
+                           int node
                         )
 {
+    u32 i;
+
     state->delay_mean = delay_mean;
     state->jitter = jitter;
     state->distr = distr;
+    state->delay_table = NULL;
+    state->delay_table_size = 0;
+
+    if (!distr || !jitter)
+        return 0;
+
+    state->delay_table = kvmalloc_node(sizeof(s64) * distr->size, GFP_KERNEL, node);
+    if (!state->delay_table)
+        return -ENOMEM;
+    for (i = 0; i < distr->size; i++)
+        state->delay_table[i] = tabledist_value(delay_mean, jitter, distr->table[i]);
+    state->delay_table_size = distr->size;
     return 0;
 }
 
-struct dlc_packet_state dlc_simple_state_step(struct dlc_simple_state *state) {
+struct dlc_packet_state dlc_simple_state_step(const struct dlc_simple_state *state, struct rnd_state *rnd) {
     struct dlc_packet_state res = {
-        .delay = tabledist(state->delay_mean, state->jitter, state->distr),
+        .delay = dlc_simple_state_delay(state, rnd),
         .loss = false
     };
     return res;
 }
 
+void dlc_simple_state_destroy(struct dlc_simple_state *state) {
+    kvfree(state->delay_table);
+    state->delay_table = NULL;
+}
+
 
 int dlc_loss_state_init(struct dlc_loss_state *state, s64 max_delay) {
     state->max_delay = max_delay;
     return 0;
 }
 
-struct dlc_packet_state dlc_loss_state_step(struct dlc_loss_state *state) {
+struct dlc_packet_state dlc_loss_state_step(const struct dlc_loss_state *state) {
     struct dlc_packet_state res = {
         .delay = state->max_delay,
         .loss = true
@@ -51,9 +71,11 @@ struct dlc_packet_state dlc_loss_state_step(struct dlc_loss_state *state) {
 }
 
 
-int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64 delay, s64 jitter, s64 rho){
+int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64 delay, s64 jitter, s64 rho,
+                            int node){
     int i = 0;
-    s64 p_min, p_plus;
+    int ret;
+    u64 p_min, p_plus;
     s64 delay_step = jitter / num_steps;
     u32 k_states = num_steps + 1;
     struct dlc_const_state* const_states;
@@ -64,12 +86,12 @@ int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64
     const_states = kvmalloc(sizeof(struct dlc_const_state) * MC_MAX_STATES, GFP_KERNEL);
     if (!const_states)
         return -ENOMEM;
-    init_probs = kvmalloc(sizeof(u32) * MC_MAX_STATES, GFP_KERNEL);
+    init_probs = kvzalloc(sizeof(u32) * MC_MAX_STATES, GFP_KERNEL);
     if (!init_probs){
         kvfree(const_states);
         return -ENOMEM;
     }
-    trans_probs = kvmalloc(sizeof(u32[MC_MAX_STATES][MC_MAX_STATES]), GFP_KERNEL);
+    trans_probs = kvzalloc(sizeof(u32[MC_MAX_STATES][MC_MAX_STATES]), GFP_KERNEL);
     if (!trans_probs) {
         kvfree(const_states);
         kvfree(init_probs);
@@ -83,29 +105,32 @@ int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64
         dlc_const_state_init(&(const_states[i]), delay + i * delay_step);
     }
 
-    p_min = ((s64) DLC_PROB_SCALE * DLC_PROB_SCALE) / (DLC_PROB_SCALE + rho);    // todo: check scaling just in case
-    p_plus = ((s64) DLC_PROB_SCALE * rho) / (DLC_PROB_SCALE + rho);    
-    printk(KERN_DEBUG "DLC: state_queue p_min=%lld, p_plus=%lld\n", p_min, p_plus);
-    trans_probs[0][0] = DLC_PROB_SCALE - p_plus;
-    trans_probs[0][1] = p_plus;
-    trans_probs[k_states - 1][k_states - 1] = DLC_PROB_SCALE - p_min;
-    trans_probs[k_states - 1][k_states - 2] = p_min;
+    /* rho comes scaled by DLC_PROB_SCALE, probabilities are 2^32-scaled */
+    p_plus = div64_u64((u64)rho << DLC_PROB_SHIFT, DLC_PROB_SCALE + rho);
+    p_min = DLC_PROB_ONE - p_plus;
+    printk(KERN_DEBUG "DLC: state_queue p_min=%llu, p_plus=%llu\n", p_min, p_plus);
+    trans_probs[0][0] = dlc_prob_clamp(DLC_PROB_ONE - p_plus);
+    trans_probs[0][1] = dlc_prob_clamp(p_plus);
+    trans_probs[k_states - 1][k_states - 1] = dlc_prob_clamp(DLC_PROB_ONE - p_min);
+    trans_probs[k_states - 1][k_states - 2] = dlc_prob_clamp(p_min);
     for (i = 1; i < k_states - 1; i++){
-        trans_probs[i][i-1] = p_min;
-        trans_probs[i][i+1] = p_plus;
+        trans_probs[i][i-1] = dlc_prob_clamp(p_min);
+        trans_probs[i][i+1] = dlc_prob_clamp(p_plus);
     }
 
-    init_probs[0] = DLC_PROB_SCALE;
-    markov_chain_const_init(&state->mm1k_chain, k_states, const_states, trans_probs, init_probs);  // note: memcpy on arrays
+    init_probs[0] = dlc_prob_clamp(DLC_PROB_ONE);
+    ret = markov_chain_const_init(&state->mm1k_chain, k_states, const_states, trans_probs, init_probs, node);  // note: memcpy on arrays
 
     // cleanup since markov_chain_init copy arrays to itself
     kvfree(const_states);
     kvfree(init_probs);
     kvfree(trans_probs);
-    return 0;
+    return ret;
 }
 
-struct dlc_packet_state dlc_queue_state_v2_step(struct dlc_queue_state_v2 *state) {
-    struct dlc_const_state *curr_state = markov_chain_const_step(&state->mm1k_chain);
-    return dlc_const_state_step(curr_state);
+/* inner chain state is kept per instance in *curr */
+struct dlc_packet_state dlc_queue_state_v2_step(const struct dlc_queue_state_v2 *state, u32 *curr,
+                                                struct rnd_state *rnd) {
+    *curr = markov_chain_const_next(&state->mm1k_chain, *curr, rnd);
+    return dlc_const_state_step(&state->mm1k_chain.states[*curr]);
 }
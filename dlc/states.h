@@ -27,7 +27,15 @@ struct dlc_const_state {
 struct dlc_simple_state {
     s64 delay_mean;       /* среднее значение задержки в мкс */
     s64 jitter;           /* jitter в мкс */
-    struct disttable* distr;    /* read-only */
+    struct disttable* distr;    /* read-only, source for delay_table */
+
+    /*
+     * Final delays (ns), one per distr entry, so every entry keeps its weight.
+     * A sample is one reciprocal_scale() index and one load.
+     * NULL for constant delay or default uniform distribution.
+     */
+    s64 *delay_table;
+    u32 delay_table_size;
 };
 
 /* {delay, loss} ~ {M/M/1/K(), 0} */
@@ -63,19 +71,31 @@ struct dlc_packet_state {
 };
 
 int dlc_const_state_init(struct dlc_const_state *state, s64 delay);
-struct dlc_packet_state dlc_const_state_step(struct dlc_const_state *state);
+struct dlc_packet_state dlc_const_state_step(const struct dlc_const_state *state);
 
 int dlc_simple_state_init(struct dlc_simple_state *state, 
                            s64 delay_mean,
                            s64 jitter,
-                           struct disttable *delay_dist);
-struct dlc_packet_state dlc_simple_state_step(struct dlc_simple_state *state);
+                           struct disttable *delay_dist,
+                           int node);
+struct dlc_packet_state dlc_simple_state_step(const struct dlc_simple_state *state, struct rnd_state *rnd);
+void dlc_simple_state_destroy(struct dlc_simple_state *state);
+
+static inline s64 dlc_simple_state_delay(const struct dlc_simple_state *state, struct rnd_state *rnd)
+{
+    if (state->delay_table)
+        return state->delay_table[reciprocal_scale(dlc_random_u32(rnd), state->delay_table_size)];
+    return tabledist(state->delay_mean, state->jitter, NULL, rnd);
+}
 
 int dlc_loss_state_init(struct dlc_loss_state *state, s64 max_delay);
-struct dlc_packet_state dlc_loss_state_step(struct dlc_loss_state *state);
+struct dlc_packet_state dlc_loss_state_step(const struct dlc_loss_state *state);
 
 // rho = lambda/mu (general naming for M/M/1/k); scaled by DLC_PROB_SCALE
-int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64 delay, s64 jitter, s64 rho);
-struct dlc_packet_state dlc_queue_state_v2_step(struct dlc_queue_state_v2 *state);
+// num_steps must be in [1, MC_MAX_STATES - 1]
+int dlc_queue_state_v2_init(struct dlc_queue_state_v2 *state, u32 num_steps, s64 delay, s64 jitter, s64 rho,
+                            int node);
+struct dlc_packet_state dlc_queue_state_v2_step(const struct dlc_queue_state_v2 *state, u32 *curr,
+                                                struct rnd_state *rnd);
 
 #endif
@@ -1,5 +1,7 @@
 import argparse
-from typing import List, Optional, Tuple
+import os
+import subprocess
+from typing import Dict, List, Optional, Tuple
 
 import numpy as np
 import scipy.stats as sps
@@ -72,6 +74,23 @@ def get_delay_and_loss(clt_file: str, srv_file: str, max_delay: float = MAX_DELA
     return delays, losses
 
 
+DLC_TRACE = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools', 'dlc_trace')
+
+
+def analyze_traces(clt_file: str, srv_file: str, max_delay: float = MAX_DELAY) -> Dict[str, float]:
+    """Run compiled analyzer (tools/dlc_trace) directly on pcap files."""
+    out = subprocess.run([DLC_TRACE, '-m', str(max_delay), clt_file, srv_file],
+                         capture_output=True, text=True, check=True).stdout
+    res = {}
+    for line in out.splitlines():
+        key, _, value = line.partition(' ')
+        if key == 'burst_hist':
+            res[key] = {k: int(v) for k, v in (item.split(':') for item in value.split())}
+        else:
+            res[key] = float(value)
+    return res
+
+
 def print_stats() -> None:
     print("average loss:", get_average_loss(losses))
     print("average delay:", get_average_delay(delays, losses))
@@ -0,0 +1,235 @@
+"""Run the experiments.py grid on K isolated testbeds at once.
+
+Every slot is a pair of network namespaces (sender/receiver) joined by its own
+veth pair, with its own qdisc, NFLOG group, captures and iperf3 port.
+Slot processes are pinned to a dedicated CPU, so slots do not disturb each other,
+and fixed sleeps are replaced with readiness checks.
+"""
+from __future__ import annotations
+
+import argparse
+import dataclasses
+import os
+import queue
+import select
+import shlex
+import signal
+import subprocess
+import threading
+import time
+
+import exp_utils
+import experiments as exps
+
+IPERF_PORT = 5201
+READY_TIMEOUT = 10.0
+WORKDIR = 'parallel'
+
+
+@dataclasses.dataclass
+class Slot:
+    idx: int
+    cpu: int
+
+    @property
+    def snd_ns(self) -> str:
+        return f'dlcs{self.idx}'
+
+    @property
+    def rcv_ns(self) -> str:
+        return f'dlcr{self.idx}'
+
+    @property
+    def dev(self) -> str:
+        return f'dlc{self.idx}a'
+
+    @property
+    def peer(self) -> str:
+        return f'dlc{self.idx}b'
+
+    @property
+    def rcv_ip(self) -> str:
+        return f'10.2.{self.idx}.2'
+
+    @property
+    def snd_ip(self) -> str:
+        return f'10.2.{self.idx}.1'
+
+    @property
+    def nflog_group(self) -> int:
+        return 100 + self.idx
+
+    def path(self, name: str) -> str:
+        return os.path.join(WORKDIR, f'slot{self.idx}_{name}')
+
+
+class SlotRunner:
+    def __init__(self, slot: Slot, mode: str):
+        self.slot = slot
+        self.mode = mode
+        self.processes: list[subprocess.Popen] = []
+        self.logfile = open(slot.path('log.txt'), 'w')
+
+    def run_fg(self, cmd: str, check: bool = True):
+        return subprocess.run(shlex.split(cmd), stdout=self.logfile, stderr=self.logfile, check=check)
+
+    def run_bg(self, cmd: str, stderr=None):
+        proc = subprocess.Popen(shlex.split(cmd), stdout=self.logfile,
+                                stderr=stderr or self.logfile, preexec_fn=os.setsid)
+        self.processes.append(proc)
+        return proc
+
+    def ns(self, ns: str, cmd: str) -> str:
+        return f'taskset -c {self.slot.cpu} ip netns exec {ns} {cmd}'
+
+    def setup(self):
+        s = self.slot
+        self.teardown()
+        for ns in (s.snd_ns, s.rcv_ns):
+            self.run_fg(f'ip netns add {ns}')
+            self.run_fg(f'ip netns exec {ns} ip link set dev lo up')
+        self.run_fg(f'ip link add {s.dev} type veth peer name {s.peer}')
+        self.run_fg(f'ip link set {s.dev} netns {s.snd_ns}')
+        self.run_fg(f'ip link set {s.peer} netns {s.rcv_ns}')
+        self.run_fg(f'ip netns exec {s.snd_ns} ip addr add {s.snd_ip}/24 dev {s.dev}')
+        self.run_fg(f'ip netns exec {s.snd_ns} ip link set dev {s.dev} up')
+        self.run_fg(f'ip netns exec {s.rcv_ns} ip addr add {s.rcv_ip}/24 dev {s.peer}')
+        self.run_fg(f'ip netns exec {s.rcv_ns} ip link set dev {s.peer} up')
+        self.run_fg(f'ip netns exec {s.snd_ns} iptables -A OUTPUT -o {s.dev} -p udp '
+                    f'-j NFLOG --nflog-group {s.nflog_group}')
+
+    def teardown(self):
+        for ns in (self.slot.snd_ns, self.slot.rcv_ns):
+            self.run_fg(f'ip netns del {ns}', check=False)
+
+    def wait_tcpdump(self, proc: subprocess.Popen):
+        """tcpdump reports 'listening on' once the capture is armed"""
+        deadline = time.monotonic() + READY_TIMEOUT
+        buf = b''
+        while b'listening on' not in buf:
+            left = deadline - time.monotonic()
+            if left <= 0 or proc.poll() is not None:
+                raise RuntimeError(f'slot {self.slot.idx}: tcpdump not ready: {buf.decode(errors="replace")}')
+            ready, _, _ = select.select([proc.stderr], [], [], left)
+            if ready:
+                buf += os.read(proc.stderr.fileno(), 4096)
+        # keep draining into the log so tcpdump never blocks on a full pipe
+        threading.Thread(target=self._drain, args=(proc,), daemon=True).start()
+
+    def _drain(self, proc: subprocess.Popen):
+        for line in proc.stderr:
+            self.logfile.write(line.decode(errors='replace'))
+
+    def wait_listen(self):
+        cmd = f'ip netns exec {self.slot.rcv_ns} ss -Hltn sport = :{IPERF_PORT}'
+        deadline = time.monotonic() + READY_TIMEOUT
+        while time.monotonic() < deadline:
+            out = subprocess.run(shlex.split(cmd), capture_output=True, text=True).stdout
+            if out.strip():
+                return
+            time.sleep(0.01)
+        raise RuntimeError(f'slot {self.slot.idx}: iperf3 server not listening')
+
+    def stop_processes(self):
+        # SIGINT lets tcpdump flush its output file before exit
+        for proc in self.processes:
+            try:
+                os.killpg(os.getpgid(proc.pid), signal.SIGINT)
+            except ProcessLookupError:
+                pass
+        for proc in self.processes:
+            try:
+                proc.wait(timeout=READY_TIMEOUT)
+            except subprocess.TimeoutExpired:
+                os.killpg(os.getpgid(proc.pid), signal.SIGKILL)
+                proc.wait()
+        self.processes.clear()
+
+    def run(self, p: exps.ExpParams) -> exps.AnalyzeResults:
+        s = self.slot
+        clt_file, srv_file = s.path(exps.CLT_FILE), s.path(exps.SRV_FILE)
+        try:
+            self.run_fg(f'ip netns exec {s.snd_ns} {exps.get_qdisc_cmd(p, s.dev, self.mode)}')
+            clt = self.run_bg(self.ns(s.snd_ns, f'{exps.TCPDUMP} -i nflog:{s.nflog_group} -s 0 -w {clt_file}'),
+                              stderr=subprocess.PIPE)
+            srv = self.run_bg(self.ns(s.rcv_ns, f'{exps.TCPDUMP} -i {s.peer} udp -s 100 -w {srv_file}'),
+                              stderr=subprocess.PIPE)
+            self.wait_tcpdump(clt)
+            self.wait_tcpdump(srv)
+            self.run_bg(self.ns(s.rcv_ns, f'iperf3 -s -1 -p {IPERF_PORT}'))
+            self.wait_listen()
+            self.run_fg(self.ns(s.snd_ns, f'iperf3 -c {s.rcv_ip} -p {IPERF_PORT} -u -b 40m -k {exps.N_PKTS}'))
+        except Exception as e:
+            print(f'Error slot {s.idx} exp_run:', e, flush=True)
+            return exps.AnalyzeResults(-1, -1, -1, -1, -1)
+        finally:
+            self.stop_processes()
+            self.run_fg(f'ip netns exec {s.snd_ns} {exps.TC} qdisc del dev {s.dev} root', check=False)
+
+        try:
+            max_delay = (p.delay + p.jitter) * 2 / 1000
+            res = exp_utils.analyze_traces(clt_file, srv_file, max_delay=max_delay)
+            return exps.AnalyzeResults(res['loss'], res['delay'], res['jitter'], res['mean_burst'], res['corr'])
+        except Exception as e:
+            print(f'Error slot {s.idx} exp_analyze:', e, flush=True)
+            return exps.AnalyzeResults(-1, -1, -1, -1, -1)
+
+
+def worker(runner: SlotRunner, jobs: queue.Queue, res_file, res_lock: threading.Lock):
+    while True:
+        try:
+            p = jobs.get_nowait()
+        except queue.Empty:
+            return
+        print(f'[slot {runner.slot.idx}] loss={p.loss}, mu={p.mu}, jitter={p.jitter}, exp_i={p.exp_i}', flush=True)
+        r = runner.run(p)
+        with res_lock:
+            res_file.write(exps.format_result(p, r))
+            res_file.flush()
+
+
+MAX_SLOTS = 256     # slot index is one octet of 10.2.<idx>.0/24
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='parallel dlc/netem experiments')
+    parser.add_argument('-k', '--slots', type=int, default=min(os.cpu_count(), MAX_SLOTS),
+                        help=f'number of isolated testbeds, 1..{MAX_SLOTS} (default: cpu count)')
+    parser.add_argument('--first-cpu', type=int, default=0, help='pin slot i to cpu first_cpu + i')
+    parser.add_argument('--mode', choices=['DLC', 'NETEM'], default=exps.MODE)
+    args = parser.parse_args()
+    if not 1 <= args.slots <= MAX_SLOTS:
+        parser.error(f'--slots must be in 1..{MAX_SLOTS}')
+    return args
+
+
+if __name__ == '__main__':
+    if os.geteuid() != 0:
+        exit("You need to have root privileges to run this script.\nPlease try again, this time using 'sudo'. Exiting.")
+    args = parse_args()
+    os.makedirs(WORKDIR, exist_ok=True)
+    n_cpus = os.cpu_count()
+    runners = [SlotRunner(Slot(i, (args.first_cpu + i) % n_cpus), args.mode) for i in range(args.slots)]
+
+    jobs: queue.Queue = queue.Queue()
+    for p in exps.get_exp_grid():
+        jobs.put(p)
+
+    print(f'Starting {args.mode} exps on {args.slots} slots!')
+    res_lock = threading.Lock()
+    try:
+        for r in runners:
+            r.setup()
+        with open(exps.RES_FILE, 'w') as res_file:
+            res_file.write(exps.RES_HEADER)
+            threads = [threading.Thread(target=worker, args=(r, jobs, res_file, res_lock)) for r in runners]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+    finally:
+        for r in runners:
+            r.stop_processes()
+            r.teardown()
+            r.logfile.close()
+    print('Complete!')
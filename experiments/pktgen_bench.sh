@@ -0,0 +1,151 @@
+#!/bin/bash
+# Line-rate benchmark of dlc (and netem as a baseline) with in-kernel pktgen.
+#
+# pktgen runs in queue_xmit mode on one end of a veth pair, so every packet
+# goes through the root qdisc. The other end lives in its own namespace where
+# a bounded tcpdump sample measures achieved delay from the pktgen timestamps.
+#
+# Output (CSV, stdout):
+#   qdisc,pkt_size,delay_ms,jitter_ms,loss_pct,limit,mpps,cycles_per_pkt,
+#   delay_cfg_ms,delay_meas_ms,qdisc_drops
+#
+# Sweep is controlled with environment variables, e.g.
+#   QDISCS="dlc netem" SIZES="60 1514" DELAYS="0 1 10" sudo -E ./pktgen_bench.sh
+
+set -euo pipefail
+
+TC=${TC:-./iproute2_dlc/tc/tc}
+DLC_TRACE=${DLC_TRACE:-./DLC_Model_module/tools/dlc_trace}
+TCPDUMP=${TCPDUMP:-/tmp/tcpdump}
+
+QDISCS=${QDISCS:-"dlc netem"}
+SIZES=${SIZES:-"60 1514"}
+DELAYS=${DELAYS:-"0 1 10"}            # ms
+JITTERS=${JITTERS:-"0 1"}             # ms
+LOSSES=${LOSSES:-"0 1"}               # %
+LIMITS=${LIMITS:-"1000 100000"}       # packets
+COUNT=${COUNT:-2000000}               # packets per run
+SAMPLE=${SAMPLE:-20000}               # packets captured for delay measurement
+CPU=${CPU:-1}                         # pktgen thread (kpktgend_$CPU)
+
+NS=dlcbench
+DEV=dlcb0
+PEER=dlcb1
+SRC_IP=10.3.0.1
+DST_IP=10.3.0.2
+PGDIR=/proc/net/pktgen
+WORKDIR=$(mktemp -d /tmp/dlc_bench.XXXXXX)
+
+pgset() {
+    echo "$2" > "$PGDIR/$1"
+}
+
+setup() {
+    modprobe pktgen
+    ip netns add $NS
+    ip link add $DEV type veth peer name $PEER
+    ip link set $PEER netns $NS
+    ip addr add $SRC_IP/24 dev $DEV
+    ip link set $DEV up
+    ip netns exec $NS ip addr add $DST_IP/24 dev $PEER
+    ip netns exec $NS ip link set $PEER up
+
+    pgset kpktgend_$CPU "rem_device_all"
+    pgset kpktgend_$CPU "add_device $DEV"
+}
+
+cleanup() {
+    [ -e $PGDIR/kpktgend_$CPU ] && pgset kpktgend_$CPU "rem_device_all" || true
+    ip link del $DEV 2>/dev/null || true
+    ip netns del $NS 2>/dev/null || true
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+qdisc_cmd() {
+    local qdisc=$1 delay=$2 jitter=$3 loss=$4 limit=$5
+    local jit=""
+
+    [ "$jitter" != 0 ] && jit="${jitter}ms"
+    case $qdisc in
+    dlc)
+        echo "$TC qdisc add dev $DEV root dlc limit $limit delay ${delay}ms $jit loss ${loss}% mu 30% mean_burst_len 3 mean_good_burst_len 15"
+        ;;
+    netem)
+        echo "$TC qdisc add dev $DEV root netem limit $limit delay ${delay}ms $jit loss ${loss}%"
+        ;;
+    esac
+}
+
+# cycles spent on the pktgen cpu while the run lasts
+run_pktgen() {
+    if command -v perf >/dev/null; then
+        perf stat -x, -e cycles -C "$CPU" -- sh -c "echo start > $PGDIR/pgctrl" 2>&1 >/dev/null \
+            | awk -F, '/cycles/ { print $1 }'
+    else
+        echo start > $PGDIR/pgctrl
+        echo NA
+    fi
+}
+
+bench_one() {
+    local qdisc=$1 size=$2 delay=$3 jitter=$4 loss=$5 limit=$6
+    local pcap=$WORKDIR/rcv.pcap cycles pps sent drops meas
+
+    $(qdisc_cmd "$qdisc" "$delay" "$jitter" "$loss" "$limit")
+
+    pgset $DEV "count $COUNT"
+    pgset $DEV "pkt_size $size"
+    pgset $DEV "clone_skb 0"
+    pgset $DEV "delay 0"
+    pgset $DEV "xmit_mode queue_xmit"
+    pgset $DEV "dst $DST_IP"
+    pgset $DEV "dst_mac $(ip netns exec $NS cat /sys/class/net/$PEER/address)"
+    pgset $DEV "udp_dst_min 9"
+    pgset $DEV "udp_dst_max 9"
+
+    ip netns exec $NS $TCPDUMP -i $PEER -s 100 -c "$SAMPLE" -w "$pcap" udp 2>"$WORKDIR/tcpdump.log" &
+    local tcpdump_pid=$!
+    until grep -q "listening on" "$WORKDIR/tcpdump.log"; do sleep 0.01; done
+
+    cycles=$(run_pktgen)
+
+    # let the tfifo drain before reading the qdisc counters
+    sleep $(awk -v d="$delay" -v j="$jitter" 'BEGIN { print (d + 4 * j) / 1000 + 0.1 }')
+    kill -INT $tcpdump_pid 2>/dev/null || true
+    wait $tcpdump_pid 2>/dev/null || true
+
+    pps=$(grep -o '[0-9]*pps' $PGDIR/$DEV | tr -d 'pps')
+    sent=$(awk '/^Result: OK/ { print $5 }' $PGDIR/$DEV)
+    drops=$($TC -s qdisc show dev $DEV | awk '/dropped/ { gsub(",", "", $7); print $7; exit }')
+    meas=$($DLC_TRACE -g "$pcap" | awk '/^delay / { printf "%.4f", $2 * 1000 }')
+
+    $TC qdisc del dev $DEV root
+
+    awk -v q="$qdisc" -v s="$size" -v d="$delay" -v j="$jitter" -v l="$loss" -v lim="$limit" \
+        -v pps="$pps" -v c="$cycles" -v n="$sent" -v m="$meas" -v dr="$drops" 'BEGIN {
+        cpp = (c == "NA" || n == 0) ? "NA" : sprintf("%.1f", c / n)
+        printf "%s,%s,%s,%s,%s,%s,%.3f,%s,%s,%s,%s\n", q, s, d, j, l, lim, pps / 1e6, cpp, d, m, dr
+    }'
+}
+
+if [ "$(id -u)" != 0 ]; then
+    echo "root privileges required" >&2
+    exit 1
+fi
+
+setup
+echo "qdisc,pkt_size,delay_ms,jitter_ms,loss_pct,limit,mpps,cycles_per_pkt,delay_cfg_ms,delay_meas_ms,qdisc_drops"
+for qdisc in $QDISCS; do
+    for size in $SIZES; do
+        for delay in $DELAYS; do
+            for jitter in $JITTERS; do
+                for loss in $LOSSES; do
+                    for limit in $LIMITS; do
+                        bench_one "$qdisc" "$size" "$delay" "$jitter" "$loss" "$limit"
+                    done
+                done
+            done
+        done
+    done
+done
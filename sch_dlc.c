@@ -13,15 +13,32 @@
 #include <linux/rtnetlink.h>
 #include <linux/reciprocal_div.h>
 #include <linux/rbtree.h>
+#include <linux/if_vlan.h>
+#include <linux/version.h>
 
 #include <net/netlink.h>
 #include <net/pkt_sched.h>
 #include <net/inet_ecn.h>
+#include <net/dsfield.h>
 
+#include "dlc/dlc_genl.h"
 #include "dlc/dlc_mod.h"
+#include "dlc/dlc_template.h"
+#include "dlc/dlc_timer.h"
 #include "dlc/dlc_tca_spec.h"
 
 
+/*
+ * Lateness of released packets: written by dequeue under the qdisc lock,
+ * copied under it on dump.
+ */
+struct dlc_lateness {
+    u64 count;
+    u64 sum;
+    u64 max;
+    u64 hist[TC_DLC_LAT_BUCKETS];
+};
+
 struct dlc_sched_data {
     /* internal t(ime)fifo qdisc uses t_root and sch->limit */
     struct rb_root t_root;
@@ -31,13 +48,20 @@ struct dlc_sched_data {
     struct sk_buff  *t_tail;
 
     u32 t_len;
+    u64 t_bytes;    /* sum of qdisc_pkt_len() in tfifo */
+    u64 t_mem;      /* sum of skb->truesize in tfifo */
 
     /* optional qdisc for classful handling (NULL at dlc init) */
     struct Qdisc  *qdisc;
 
     struct qdisc_watchdog watchdog;
+    struct dlc_timer timer;     /* used instead of watchdog with shared_timer=1 */
+    struct dlc_genl_inst genl;  /* addressable by the bulk control plane */
+    u32 gen;                    /* bumped by every commit */
 
-    struct dlc_mod_data dlc_model;
+    struct dlc_mod_data *dlc_model;     /* shared, read only */
+    struct dlc_mod_runtime *dlc_rt;     /* own state of the model, on node */
+    int node;                           /* NUMA node of model, runtime and table */
     s64 latency;    // a.k.a delay
     s64 jitter;
     s64 mm1_rho;
@@ -49,8 +73,45 @@ struct dlc_sched_data {
 
     u32 limit;
     u64 rate;
+    bool noreorder;     /* single FIFO link: new packets go to the linear tail, t_root
+                         * only drains what was queued before it was turned on */
+    u64 tick;           /* time-driven model, ns */
+    struct tc_dlc_limits limits;
+
+    struct tc_dlc_gso gso;
+    struct dlc_packet_state gso_states[DLC_GSO_MAX_SEGS];  /* arith mode scratch */
 
     struct disttable *delay_dist;
+
+    /* capacity trace, rt_idx/rt_start is the step the link is transmitting in */
+    struct dlc_rate_trace *rate_trace;
+    u32 rt_idx;
+    u64 rt_start;
+
+    /* control traffic around the model, see dlc_bypass_match() */
+    struct tc_dlc_bypass bypass;
+    struct qdisc_skb_head bypass_q;     /* its packets are in sch->q.qlen too */
+    u64 bypassed;
+
+    struct tc_dlc_slot slot_config;
+    struct slotstate {
+        u64 slot_start;     /* current slot boundary */
+        s64 packets_left;   /* budget of the current slot */
+        s64 bytes_left;
+    } slot;
+
+    /* scheduling accuracy, see dlc_dump_stats() */
+    struct dlc_lateness lateness;
+    int wd_fired;       /* set by the watchdog callback, taken by dequeue */
+    u64 wd_fires;
+    u64 wd_empty;
+};
+
+struct dlc_rate_trace {
+    u32 len;
+    u64 period;         /* ns, sum of the steps */
+    u64 period_bits;    /* capacity of a period, U64_MAX if larger */
+    struct tc_dlc_rate_step steps[];
 };
 
 /* Time stamp put into socket buffer control block
@@ -69,6 +130,19 @@ static void dist_free(struct disttable *d)
     kvfree(d);
 }
 
+/*
+ * NUMA node the qdisc runs on: node of its TX queue when XPS set one
+ * (multiqueue setups, dlc under mq), else node of the device.
+ */
+static int dlc_numa_node(const struct Qdisc *sch)
+{
+    int node = netdev_queue_numa_node_read(sch->dev_queue);
+
+    if (node == NUMA_NO_NODE)
+        node = dev_to_node(&qdisc_dev(sch)->dev);
+    return node;
+}
+
 static inline struct dlc_skb_cb *dlc_skb_cb(struct sk_buff *skb)
 {
     /* we assume we can use skb next/prev/tstamp as storage for rb_node */
@@ -77,11 +151,66 @@ static inline struct dlc_skb_cb *dlc_skb_cb(struct sk_buff *skb)
 }
 
 
+static u64 dlc_slot_roundup(u64 x, u64 period)
+{
+    u64 rem;
+
+    div64_u64_rem(x, period, &rem);
+    return rem ? x - rem + period : x;
+}
+
 static u64 packet_time_ns(u64 len, const struct dlc_sched_data *q)
 {
     return div64_u64(len * NSEC_PER_SEC, q->rate);
 }
 
+/*
+* Time the last bit of len bytes is sent when the first one starts at t, with
+* capacity from the rate trace. The cursor only goes forward: packets are
+* computed in start order, a start behind it means the link is still busy.
+* An idle gap of whole periods is skipped at once, so is a packet larger than
+* a period's capacity, and every step carries at least one bit: a packet walks
+* less than two periods of steps.
+*/
+static u64 dlc_rate_trace_end(struct dlc_sched_data *q, u64 t, unsigned int len)
+{
+    const struct dlc_rate_trace *tr = q->rate_trace;
+    u64 bits = (u64)len * 8;
+
+    t = max(t, q->rt_start);
+    if (t - q->rt_start >= tr->period)
+        q->rt_start += tr->period * div64_u64(t - q->rt_start, tr->period);
+
+    for (;;) {
+        const struct tc_dlc_rate_step *s;
+        u64 end;
+
+        /* from a step boundary, whole periods carry exactly period_bits */
+        if (t == q->rt_start && bits > tr->period_bits) {
+            u64 k = div64_u64(bits - 1, tr->period_bits);
+
+            t += k * tr->period;
+            q->rt_start = t;
+            bits -= k * tr->period_bits;
+        }
+        s = &tr->steps[q->rt_idx];
+        end = q->rt_start + (u64)s->duration * NSEC_PER_USEC;
+
+        /* kbit/s is bits per ms */
+        if (t < end && s->rate) {
+            u64 need = div64_u64(bits * NSEC_PER_MSEC + s->rate - 1, s->rate);
+
+            if (need <= end - t)
+                return t + need;
+            bits -= div64_u64((end - t) * s->rate, NSEC_PER_MSEC);
+        }
+        t = max(t, end);
+        q->rt_start = end;
+        if (++q->rt_idx == tr->len)
+            q->rt_idx = 0;
+    }
+}
+
 static void tfifo_reset(struct Qdisc *sch)
 {
     struct dlc_sched_data *q = qdisc_priv(sch);
@@ -99,6 +228,8 @@ static void tfifo_reset(struct Qdisc *sch)
     q->t_head = NULL;
     q->t_tail = NULL;
     q->t_len = 0;
+    q->t_bytes = 0;
+    q->t_mem = 0;
 }
 
 static void tfifo_enqueue(struct sk_buff *nskb, struct Qdisc *sch)
@@ -129,38 +260,144 @@ static void tfifo_enqueue(struct sk_buff *nskb, struct Qdisc *sch)
         rb_insert_color(&nskb->rbnode, &q->t_root);
     }
     q->t_len++;
+    q->t_bytes += qdisc_pkt_len(nskb);
+    q->t_mem += nskb->truesize;
+    sch->q.qlen++;
+}
+
+static struct sk_buff *dlc_peek(struct dlc_sched_data *q)
+{
+    struct sk_buff *skb;
+    u64 t1, t2;
+
+    skb = skb_rb_first(&q->t_root);
+
+    if (!skb)
+        return q->t_head;
+    if (!q->t_head)
+        return skb;
+
+    t1 = dlc_skb_cb(skb)->time_to_send;
+    t2 = dlc_skb_cb(q->t_head)->time_to_send;
+    if (t1 < t2)
+        return skb;
+    return q->t_head;
+}
+
+static void dlc_erase_head(struct dlc_sched_data *q, struct sk_buff *skb)
+{
+    if (skb == q->t_head) {
+        q->t_head = skb->next;
+        if (!q->t_head)
+            q->t_tail = NULL;
+    } else {
+        rb_erase(&skb->rbnode, &q->t_root);
+    }
+    q->t_bytes -= qdisc_pkt_len(skb);
+    q->t_mem -= skb->truesize;
+}
+
+static bool dlc_over_limit(const struct dlc_sched_data *q, const struct Qdisc *sch,
+            const struct sk_buff *skb)
+{
+    if (q->t_len >= sch->limit)
+        return true;
+    if (q->limits.bytes && q->t_bytes + qdisc_pkt_len(skb) > q->limits.bytes)
+        return true;
+    if (q->limits.mem && q->t_mem + skb->truesize > q->limits.mem)
+        return true;
+    return false;
+}
+
+/* Drop the earliest-due packet of tfifo */
+static void dlc_drop_head(struct Qdisc *sch, struct sk_buff **to_free)
+{
+    struct dlc_sched_data *q = qdisc_priv(sch);
+    struct sk_buff *skb = dlc_peek(q);
+
+    dlc_erase_head(q, skb);
+    q->t_len--;
+    sch->q.qlen--;
+    /* skb->dev shares skb->rbnode area */
+    skb->dev = qdisc_dev(sch);
+    qdisc_qstats_backlog_dec(sch, skb);
+    qdisc_qstats_drop(sch);
+    __qdisc_drop(skb, to_free);
+}
+
+static bool dlc_bypass_on(const struct tc_dlc_bypass *b)
+{
+    return b->mark_mask || b->prio_map || b->dscp_map;
+}
+
+/* skb_protocol(skb, true) of newer kernels: the protocol under VLAN tags */
+static __be16 dlc_skb_protocol(struct sk_buff *skb)
+{
+    if (eth_type_vlan(skb->protocol))
+        return __vlan_get_protocol(skb, skb->protocol, NULL);
+    return skb->protocol;
+}
+
+static bool dlc_bypass_match(const struct dlc_sched_data *q, struct sk_buff *skb)
+{
+    const struct tc_dlc_bypass *b = &q->bypass;
+    int dscp = -1;
+
+    if (b->mark_mask && (skb->mark & b->mark_mask) == b->mark)
+        return true;
+    if (b->prio_map && skb->priority <= TC_PRIO_MAX &&
+        (b->prio_map & (1U << skb->priority)))
+        return true;
+    if (!b->dscp_map)
+        return false;
+
+    switch (dlc_skb_protocol(skb)) {
+    case htons(ETH_P_IP):
+        if (pskb_network_may_pull(skb, sizeof(struct iphdr)))
+            dscp = ipv4_get_dsfield(ip_hdr(skb)) >> 2;
+        break;
+    case htons(ETH_P_IPV6):
+        if (pskb_network_may_pull(skb, sizeof(struct ipv6hdr)))
+            dscp = ipv6_get_dsfield(ipv6_hdr(skb)) >> 2;
+        break;
+    }
+    return dscp >= 0 && (b->dscp_map & (1ULL << dscp));
+}
+
+/* Direct FIFO: the packet leaves as soon as the qdisc is dequeued */
+static int dlc_enqueue_bypass(struct sk_buff *skb, struct Qdisc *sch,
+            struct sk_buff **to_free)
+{
+    struct dlc_sched_data *q = qdisc_priv(sch);
+
+    if (q->bypass_q.qlen >= (q->bypass.limit ?: sch->limit))
+        return qdisc_drop(skb, sch, to_free);
+
+    __qdisc_enqueue_tail(skb, &q->bypass_q);
     sch->q.qlen++;
+    qdisc_qstats_backlog_inc(sch, skb);
+    q->bypassed++;
+    return NET_XMIT_SUCCESS;
 }
 
 /*
-* Insert one skb into qdisc.
-* Note: parent depends on return value to account for queue length.
-*   NET_XMIT_DROP: queue length didn't change.
-*      NET_XMIT_SUCCESS: one skb was queued.
+* Put one skb (or GSO segment) with model decision into tfifo.
+* Returns NET_XMIT_SUCCESS | __NET_XMIT_BYPASS if the model dropped it.
 */
-static int dlc_enqueue(struct sk_buff *skb, struct Qdisc *sch,
-            struct sk_buff **to_free)
+static int dlc_enqueue_one(struct sk_buff *skb, struct Qdisc *sch,
+            struct sk_buff **to_free, const struct dlc_packet_state *pkt_state)
 {
     struct dlc_sched_data *q = qdisc_priv(sch);
     /* We don't fill cb now as skb_unshare() may invalidate it */
     struct dlc_skb_cb *cb;
-    struct sk_buff *segs = NULL;
-    int count = 1;
+    s64 delay = pkt_state->delay;
     u64 now = ktime_get_ns();
 
-    struct dlc_packet_state pkt_state = dlc_mod_handle_packet(&(q->dlc_model), skb); // Call dlc_model
-    s64 delay = pkt_state.delay;
-    // printk(KERN_DEBUG "Dlc packet state: delay=%lld, loss=%d, curr_state=%u\n", 
-    //         pkt_state.delay, pkt_state.loss, q->dlc_model.main_chain.curr_state);
-
     /* Do not fool qdisc_drop_all() */
     skb->prev = NULL;
 
-    if (pkt_state.loss) {
+    if (pkt_state->loss) {
         // printk(KERN_DEBUG "Loss state, drop packet\n");
-        --count;
-    }
-    if (count == 0) {
         qdisc_qstats_drop(sch);
         __qdisc_drop(skb, to_free);
         return NET_XMIT_SUCCESS | __NET_XMIT_BYPASS;
@@ -169,21 +406,14 @@ static int dlc_enqueue(struct sk_buff *skb, struct Qdisc *sch,
     /* If a latency is expected, orphan the skb. (orphaning usually takes
     * place at TX completion time, so _before_ the link transit latency)
     */
-    if (q->latency || q->jitter || q->rate)
+    if (q->latency || q->jitter || q->rate || q->rate_trace)
         skb_orphan_partial(skb);
 
-
-    if (unlikely(q->t_len >= sch->limit)) {
-        /* re-link segs, so that qdisc_drop_all() frees them all */
-        skb->next = segs;
-        qdisc_drop_all(skb, sch, to_free);
-        return NET_XMIT_DROP;
-    }
     qdisc_qstats_backlog_inc(sch, skb);
 
     cb = dlc_skb_cb(skb);
 
-    if (q->rate) {
+    if (q->rate || q->rate_trace) {
         struct dlc_skb_cb *last = NULL;
 
         if (sch->q.tail)
@@ -215,103 +445,361 @@ static int dlc_enqueue(struct sk_buff *skb, struct Qdisc *sch,
             now = last->time_to_send;
         }
 
-        delay += packet_time_ns(qdisc_pkt_len(skb), q);
+        if (q->rate_trace)
+            delay = dlc_rate_trace_end(q, now + delay, qdisc_pkt_len(skb)) - now;
+        else
+            delay += packet_time_ns(qdisc_pkt_len(skb), q);
     }
 
     cb->time_to_send = now + delay;
+    /* FIFO link can't deliver before the previous packet, so the packet
+     * always goes to the tail of linear queue. Packets queued before
+     * noreorder was turned on may still sit in t_root: leave strictly after
+     * the last of them, dlc_peek() prefers t_head on equal times */
+    if (q->noreorder) {
+        if (q->t_root.rb_node)
+            cb->time_to_send = max_t(u64, cb->time_to_send,
+                                     dlc_skb_cb(skb_rb_last(&q->t_root))->time_to_send + 1);
+        if (q->t_tail)
+            cb->time_to_send = max_t(u64, cb->time_to_send, dlc_skb_cb(q->t_tail)->time_to_send);
+    }
     tfifo_enqueue(skb, sch);
 
     return NET_XMIT_SUCCESS;
 }
 
-static struct sk_buff *dlc_peek(struct dlc_sched_data *q)
+/*
+* GSO skb gets one model decision per segment.
+* Arith mode steps the model gso_segs times and keeps the skb whole unless
+* a segment is lost or delays differ more than max_spread, segment mode
+* always segments (as netem does).
+*/
+static int dlc_enqueue_gso(struct sk_buff *skb, struct Qdisc *sch,
+            struct sk_buff **to_free)
 {
-    struct sk_buff *skb = skb_rb_first(&q->t_root);
-    u64 t1, t2;
+    struct dlc_sched_data *q = qdisc_priv(sch);
+    struct dlc_packet_state *states = q->gso_states;
+    u32 n = skb_shinfo(skb)->gso_segs;
+    struct sk_buff *segs, *next;
+    u32 i;
+
+    if (q->gso.mode == TC_DLC_GSO_ARITH && n && n <= DLC_GSO_MAX_SEGS) {
+        struct dlc_packet_state whole = { .loss = false };
+        s64 min_delay = S64_MAX;
+
+        dlc_mod_handle_packets(q->dlc_rt, skb, states, n);
+        /* delays may be negative, start from a real one rather than 0 */
+        whole.delay = states[0].delay;
+        for (i = 0; i < n; i++) {
+            whole.loss |= states[i].loss;
+            min_delay = min(min_delay, states[i].delay);
+            whole.delay = max(whole.delay, states[i].delay);
+        }
+        /* the last segment can't arrive earlier than the largest delay */
+        if (!whole.loss && whole.delay - min_delay <= q->gso.max_spread)
+            return dlc_enqueue_one(skb, sch, to_free, &whole);
+    } else {
+        n = 0;  /* decide per segment after segmentation */
+    }
 
-    if (!skb)
-        return q->t_head;
-    if (!q->t_head)
-        return skb;
+    segs = skb_gso_segment(skb, netif_skb_features(skb) & ~NETIF_F_GSO_MASK);
+    if (IS_ERR_OR_NULL(segs))
+        return qdisc_drop(skb, sch, to_free);
+    consume_skb(skb);
 
-    t1 = dlc_skb_cb(skb)->time_to_send;
-    t2 = dlc_skb_cb(q->t_head)->time_to_send;
-    if (t1 < t2)
-        return skb;
-    return q->t_head;
+    for (i = 0; segs; segs = next, i++) {
+        struct dlc_packet_state pkt_state;
+
+        next = segs->next;
+        skb_mark_not_on_list(segs);
+        qdisc_skb_cb(segs)->pkt_len = segs->len;
+
+        if (unlikely(dlc_over_limit(q, sch, segs))) {
+            qdisc_drop(segs, sch, to_free);
+            continue;
+        }
+        if (i < n)
+            pkt_state = states[i];
+        else
+            pkt_state = dlc_mod_handle_packet(q->dlc_rt, segs);
+        dlc_enqueue_one(segs, sch, to_free, &pkt_state);
+    }
+    /* original skb is consumed, parents get corrected in dlc_enqueue() */
+    return NET_XMIT_SUCCESS;
 }
 
-static void dlc_erase_head(struct dlc_sched_data *q, struct sk_buff *skb)
+/*
+* Insert one skb into qdisc.
+* Note: parent depends on return value to account for queue length.
+*   NET_XMIT_DROP: queue length didn't change.
+*      NET_XMIT_SUCCESS: one skb was queued.
+*/
+static int dlc_enqueue(struct sk_buff *skb, struct Qdisc *sch,
+            struct sk_buff **to_free)
 {
-    if (skb == q->t_head) {
-        q->t_head = skb->next;
-        if (!q->t_head)
-            q->t_tail = NULL;
-    } else {
-        rb_erase(&skb->rbnode, &q->t_root);
+    struct dlc_sched_data *q = qdisc_priv(sch);
+    unsigned int prev_len = sch->q.qlen, prev_backlog = sch->qstats.backlog;
+    unsigned int pkt_len = qdisc_pkt_len(skb);
+    struct dlc_packet_state pkt_state;
+    int ret;
+
+    if (dlc_bypass_on(&q->bypass) && dlc_bypass_match(q, skb))
+        return dlc_enqueue_bypass(skb, sch, to_free);
+
+    /* limits are checked first, so overload does not cost a model step */
+    if (unlikely(dlc_over_limit(q, sch, skb))) {
+        if (q->limits.overflow != TC_DLC_OVERFLOW_HEAD)
+            return qdisc_drop(skb, sch, to_free);
+
+        while (q->t_len && dlc_over_limit(q, sch, skb))
+            dlc_drop_head(sch, to_free);
+        if (dlc_over_limit(q, sch, skb)) {
+            ret = qdisc_drop(skb, sch, to_free);
+            goto out;
+        }
+    }
+
+    if (q->tick)
+        dlc_mod_advance_time(q->dlc_rt, ktime_get_ns());
+
+    if (q->gso.mode != TC_DLC_GSO_OFF && skb_is_gso(skb)) {
+        ret = dlc_enqueue_gso(skb, sch, to_free);
+        goto out;
+    }
+
+    pkt_state = dlc_mod_handle_packet(q->dlc_rt, skb); // Call dlc_model
+    // printk(KERN_DEBUG "Dlc packet state: delay=%lld, loss=%d, curr_state=%u\n", 
+    //         pkt_state.delay, pkt_state.loss, q->dlc_rt->main_state);
+    ret = dlc_enqueue_one(skb, sch, to_free, &pkt_state);
+
+out:
+    /* Parents account one skb of pkt_len on success and nothing otherwise.
+     * Head drops and GSO segments change that, so fix them up (as netem) */
+    if (ret == NET_XMIT_SUCCESS) {
+        prev_len++;
+        prev_backlog += pkt_len;
     }
+    if (prev_len != sch->q.qlen || prev_backlog != sch->qstats.backlog)
+        qdisc_tree_reduce_backlog(sch, prev_len - sch->q.qlen,
+                                  prev_backlog - sch->qstats.backlog);
+    return ret;
 }
 
-static struct sk_buff *dlc_dequeue(struct Qdisc *sch)
+
+/* Open the slot containing now, refilling its budget */
+static u64 dlc_slot_start(struct dlc_sched_data *q, u64 now)
+{
+    u64 rem;
+    u64 start;
+
+    div64_u64_rem(now, q->slot_config.period, &rem);
+    start = now - rem;
+    if (start != q->slot.slot_start) {
+        q->slot.slot_start = start;
+        q->slot.packets_left = q->slot_config.max_packets ?: S64_MAX;
+        q->slot.bytes_left = q->slot_config.max_bytes ?: S64_MAX;
+    }
+    return start;
+}
+
+static void dlc_watchdog_schedule(struct dlc_sched_data *q, u64 expires)
+{
+    if (dlc_timer_enabled())
+        dlc_timer_schedule(&q->timer, expires);
+    else
+        qdisc_watchdog_schedule_ns(&q->watchdog, expires);
+}
+
+static void dlc_watchdog_cancel(struct dlc_sched_data *q)
+{
+    dlc_timer_cancel(&q->timer);
+    qdisc_watchdog_cancel(&q->watchdog);
+    WRITE_ONCE(q->wd_fired, 0);
+    WRITE_ONCE(q->timer.fired, 0);
+}
+
+/* qdisc_watchdog() that leaves a mark for dequeue */
+static enum hrtimer_restart dlc_watchdog_fire(struct hrtimer *timer)
+{
+    struct dlc_sched_data *q = container_of(timer, struct dlc_sched_data, watchdog.timer);
+
+    WRITE_ONCE(q->wd_fired, 1);
+    rcu_read_lock();
+    __netif_schedule(qdisc_root(q->watchdog.qdisc));
+    rcu_read_unlock();
+    return HRTIMER_NORESTART;
+}
+
+/* did a watchdog or shared timer expiry happen since the last call? */
+static bool dlc_watchdog_fired(struct dlc_sched_data *q)
+{
+    return xchg(&q->wd_fired, 0) | xchg(&q->timer.fired, 0);
+}
+
+/* log-linear bucket of a lateness, layout in dlc_tca_spec.h */
+static unsigned int dlc_lat_bucket(u64 ns)
+{
+    unsigned int e;
+
+    if (ns < (1ULL << TC_DLC_LAT_MIN_SHIFT))
+        return 0;
+    if (ns >= (1ULL << TC_DLC_LAT_MAX_SHIFT))
+        return TC_DLC_LAT_BUCKETS - 1;
+    e = fls64(ns) - 1;
+    return 1 + ((e - TC_DLC_LAT_MIN_SHIFT) << TC_DLC_LAT_SUB_BITS) +
+           ((ns >> (e - TC_DLC_LAT_SUB_BITS)) & ((1 << TC_DLC_LAT_SUB_BITS) - 1));
+}
+
+/* exclusive upper bound of a bucket */
+static u64 dlc_lat_bucket_end(unsigned int b)
+{
+    unsigned int e;
+
+    if (b == 0)
+        return 1ULL << TC_DLC_LAT_MIN_SHIFT;
+    if (b == TC_DLC_LAT_BUCKETS - 1)
+        return U64_MAX;
+    b--;
+    e = TC_DLC_LAT_MIN_SHIFT + (b >> TC_DLC_LAT_SUB_BITS);
+    return (1ULL << e) +
+           ((u64)((b & ((1 << TC_DLC_LAT_SUB_BITS) - 1)) + 1) << (e - TC_DLC_LAT_SUB_BITS));
+}
+
+static void dlc_lateness_record(struct dlc_sched_data *q, u64 ns)
+{
+    struct dlc_lateness *l = &q->lateness;
+
+    l->count++;
+    l->sum += ns;
+    if (ns > l->max)
+        l->max = ns;
+    l->hist[dlc_lat_bucket(ns)]++;
+}
+
+static void dlc_stats_reset(struct dlc_sched_data *q)
+{
+    memset(&q->lateness, 0, sizeof(q->lateness));
+    q->wd_fires = 0;
+    q->wd_empty = 0;
+    q->bypassed = 0;
+}
+
+/*
+* Move every due packet from tfifo to sch->q (or child qdisc), all judged
+* against the same now. sch->q.qlen already counts tfifo packets, so skbs
+* are linked to sch->q by hand. Returns time of the first packet still not
+* due, 0 if tfifo got empty.
+*/
+static u64 dlc_release_due(struct Qdisc *sch, u64 now)
 {
     struct dlc_sched_data *q = qdisc_priv(sch);
+    unsigned int dropped = 0, dropped_len = 0;
+    u64 slot_start = 0;
     struct sk_buff *skb;
+    u64 next = 0;
 
-tfifo_dequeue:
-    skb = __qdisc_dequeue_head(&sch->q);
-    if (skb) {
-deliver:
-        qdisc_qstats_backlog_dec(sch, skb);
-        qdisc_bstats_update(sch, skb);
-        return skb;
-    }
-    skb = dlc_peek(q);
-    if (skb) {
-        u64 time_to_send;
-        u64 now = ktime_get_ns();
+    if (q->slot_config.period)
+        slot_start = dlc_slot_start(q, now);
 
+    while ((skb = dlc_peek(q))) {
         /* if more time remaining? */
-        time_to_send = dlc_skb_cb(skb)->time_to_send;
-
-        if (time_to_send <= now) {
-            dlc_erase_head(q, skb);
-            q->t_len--;
-            skb->next = NULL;
-            skb->prev = NULL;
-            /* skb->dev shares skb->rbnode area,
-            * we need to restore its value.
-            */
-            skb->dev = qdisc_dev(sch);
-
-            if (q->qdisc) {
-                unsigned int pkt_len = qdisc_pkt_len(skb);
-                struct sk_buff *to_free = NULL;
-                int err;
-
-                err = qdisc_enqueue(skb, q->qdisc, &to_free);
-                kfree_skb_list(to_free);
-                if (err != NET_XMIT_SUCCESS) {
-                    if (net_xmit_drop_count(err))
-                        qdisc_qstats_drop(sch);
-                    sch->qstats.backlog -= pkt_len;
-                    sch->q.qlen--;
-                    qdisc_tree_reduce_backlog(sch, 1, pkt_len);
-                }
-                goto tfifo_dequeue;
-            }
-            sch->q.qlen--;
-            goto deliver;
+        u64 time_to_send = dlc_skb_cb(skb)->time_to_send;
+
+        if (q->slot_config.period) {
+            /* packets are delivered on the first slot boundary after their time,
+             * the watchdog fires only on boundaries */
+            if (q->slot.packets_left <= 0 || q->slot.bytes_left <= 0)
+                time_to_send = slot_start + q->slot_config.period;
+            else if (time_to_send > slot_start)
+                time_to_send = dlc_slot_roundup(time_to_send, q->slot_config.period);
+            else
+                time_to_send = slot_start;
+        }
+        if (time_to_send > now) {
+            next = time_to_send;
+            break;
         }
 
+        if (q->slot_config.period) {
+            q->slot.packets_left--;
+            q->slot.bytes_left -= qdisc_pkt_len(skb);
+        }
+        dlc_lateness_record(q, now - time_to_send);
+        dlc_erase_head(q, skb);
+        q->t_len--;
+        skb->next = NULL;
+        skb->prev = NULL;
+        /* skb->dev shares skb->rbnode area,
+        * we need to restore its value.
+        */
+        skb->dev = qdisc_dev(sch);
+
         if (q->qdisc) {
-            skb = q->qdisc->ops->dequeue(q->qdisc);
-            if (skb) {
-                sch->q.qlen--;
-                goto deliver;
+            unsigned int pkt_len = qdisc_pkt_len(skb);
+            struct sk_buff *to_free = NULL;
+            int err;
+
+            err = qdisc_enqueue(skb, q->qdisc, &to_free);
+            kfree_skb_list(to_free);
+            if (err != NET_XMIT_SUCCESS) {
+                if (net_xmit_drop_count(err))
+                    qdisc_qstats_drop(sch);
+                dropped++;
+                dropped_len += pkt_len;
             }
+            continue;
         }
 
-        qdisc_watchdog_schedule_ns(&q->watchdog,time_to_send);
+        if (sch->q.tail)
+            sch->q.tail->next = skb;
+        else
+            sch->q.head = skb;
+        sch->q.tail = skb;
+    }
+
+    if (dropped) {
+        sch->qstats.backlog -= dropped_len;
+        sch->q.qlen -= dropped;
+        qdisc_tree_reduce_backlog(sch, dropped, dropped_len);
+    }
+    return next;
+}
+
+static struct sk_buff *dlc_dequeue(struct Qdisc *sch)
+{
+    struct dlc_sched_data *q = qdisc_priv(sch);
+    bool fired, released = false;
+    struct sk_buff *skb;
+    u64 next = 0;
+
+    if (q->bypass_q.head) {
+        skb = __qdisc_dequeue_head(&q->bypass_q);
+        sch->q.qlen--;
+        goto deliver;
+    }
+
+    skb = __qdisc_dequeue_head(&sch->q);
+    if (skb)
+        goto deliver;
+
+    /* staging queue is empty, refill it with everything due by now */
+    fired = dlc_watchdog_fired(q);
+    if (q->t_len) {
+        u32 t_len = q->t_len;
+
+        next = dlc_release_due(sch, ktime_get_ns());
+        released = q->t_len != t_len;
+    }
+    /* first refill after an expiry: was the wakeup useful? */
+    if (fired) {
+        q->wd_fires++;
+        if (!released)
+            q->wd_empty++;
+    }
+    if (released) {
+        skb = __qdisc_dequeue_head(&sch->q);
+        if (skb)
+            goto deliver;
     }
 
     if (q->qdisc) {
@@ -321,7 +809,15 @@ deliver:
             goto deliver;
         }
     }
+
+    if (next)
+        dlc_watchdog_schedule(q, next);
     return NULL;
+
+deliver:
+    qdisc_qstats_backlog_dec(sch, skb);
+    qdisc_bstats_update(sch, skb);
+    return skb;
 }
 
 static void dlc_reset(struct Qdisc *sch)
@@ -330,13 +826,11 @@ static void dlc_reset(struct Qdisc *sch)
 
     qdisc_reset_queue(sch);
     tfifo_reset(sch);
+    rtnl_kfree_skbs(q->bypass_q.head, q->bypass_q.tail);
+    memset(&q->bypass_q, 0, sizeof(q->bypass_q));
     if (q->qdisc)
         qdisc_reset(q->qdisc);
-    if (q->delay_dist){
-        dist_free(q->delay_dist);
-        q->delay_dist = NULL;
-    }
-    qdisc_watchdog_cancel(&q->watchdog);
+    dlc_watchdog_cancel(q);
 }
 
 
@@ -344,7 +838,7 @@ static void dlc_reset(struct Qdisc *sch)
 * Distribution data is a variable size payload containing
 * signed 16 bit values.
 */
-static int get_dist_table(struct disttable **tbl, const struct nlattr *attr)
+static int get_dist_table(struct disttable **tbl, const struct nlattr *attr, int node)
 {
     size_t n = nla_len(attr)/sizeof(__s16);
     const __s16 *data = nla_data(attr);
@@ -354,7 +848,7 @@ static int get_dist_table(struct disttable **tbl, const struct nlattr *attr)
     if (!n || n > DLC_DIST_MAX)
         return -EINVAL;
 
-    d = kvmalloc(sizeof(struct disttable) + n * sizeof(s16), GFP_KERNEL);
+    d = kvmalloc_node(sizeof(struct disttable) + n * sizeof(s16), GFP_KERNEL, node);
     if (!d)
         return -ENOMEM;
 
@@ -366,6 +860,72 @@ static int get_dist_table(struct disttable **tbl, const struct nlattr *attr)
     return 0;
 }
 
+/* Copy of the current table on another node */
+static int move_dist_table(struct disttable **tbl, const struct disttable *src, int node)
+{
+    size_t bytes = sizeof(*src) + src->size * sizeof(s16);
+
+    *tbl = kvmalloc_node(bytes, GFP_KERNEL, node);
+    if (!*tbl)
+        return -ENOMEM;
+    memcpy(*tbl, src, bytes);
+    return 0;
+}
+
+/*
+* Rate trace is an array of tc_dlc_rate_step, empty turns it off (*tr = NULL).
+* A step with capacity must carry at least one bit and a period at least one
+* mtu, so dlc_rate_trace_end() always makes progress and stays short.
+*/
+static int get_rate_trace(struct dlc_rate_trace **tr, const struct nlattr *attr, int node,
+            unsigned int mtu)
+{
+    const struct tc_dlc_rate_step *steps = nla_data(attr);
+    size_t n = nla_len(attr) / sizeof(*steps);
+    struct dlc_rate_trace *t;
+    u64 period = 0, period_bits = 0;
+    size_t i;
+
+    *tr = NULL;
+    if (nla_len(attr) % sizeof(*steps))
+        return -EINVAL;
+    if (!n)
+        return 0;
+    for (i = 0; i < n; i++) {
+        /* kbit/s * us / 1000, rounded down as in dlc_rate_trace_end() */
+        u64 bits = div_u64((u64)steps[i].duration * steps[i].rate, 1000);
+
+        if (steps[i].rate && !bits)
+            return -EINVAL;
+        period += (u64)steps[i].duration * NSEC_PER_USEC;
+        if (check_add_overflow(period_bits, bits, &period_bits))
+            period_bits = U64_MAX;
+    }
+    if (period_bits < (u64)mtu * 8)
+        return -EINVAL;
+
+    t = kvmalloc_node(struct_size(t, steps, n), GFP_KERNEL, node);
+    if (!t)
+        return -ENOMEM;
+    t->len = n;
+    t->period = period;
+    t->period_bits = period_bits;
+    memcpy(t->steps, steps, n * sizeof(*steps));
+    *tr = t;
+    return 0;
+}
+
+static int move_rate_trace(struct dlc_rate_trace **tr, const struct dlc_rate_trace *src, int node)
+{
+    size_t bytes = struct_size(src, steps, src->len);
+
+    *tr = kvmalloc_node(bytes, GFP_KERNEL, node);
+    if (!*tr)
+        return -ENOMEM;
+    memcpy(*tr, src, bytes);
+    return 0;
+}
+
 
 // static int parse_attr(struct nlattr *tb[], int maxtype, struct nlattr *nla,
 //             const struct nla_policy *policy, int len)
@@ -394,39 +954,291 @@ static int get_dist_table(struct disttable **tbl, const struct nlattr *attr)
 // };
 
 
+static u32 dlc_queue_states(const struct dlc_mod_data *model)
+{
+    return model->main_chain.states[DLC_IDX_QUEUE].queue.mm1k_chain.num_states;
+}
+
+static void dlc_checkpoint_get(const struct dlc_sched_data *q, struct tc_dlc_checkpoint *cp)
+{
+    const struct dlc_mod_runtime *rt = q->dlc_rt;
+
+    memset(cp, 0, sizeof(*cp));
+    cp->version = TC_DLC_CHECKPOINT_VERSION;
+    cp->main_states = q->dlc_model->main_chain.num_states;
+    cp->queue_states = dlc_queue_states(q->dlc_model);
+    cp->main_state = rt->main_state;
+    cp->queue_state = rt->queue_state;
+    cp->rnd[0] = rt->rnd.s1;
+    cp->rnd[1] = rt->rnd.s2;
+    cp->rnd[2] = rt->rnd.s3;
+    cp->rnd[3] = rt->rnd.s4;
+    /* monotonic clock differs between hosts, keep only the phase of tick */
+    cp->tick_age = rt->last_time ? ktime_get_ns() - rt->last_time : ~0ULL;
+}
+
+/* Checkpoint must be taken from the model it is restored on */
+static int dlc_checkpoint_check(const struct nlattr *attr, const struct dlc_mod_data *model)
+{
+    const struct tc_dlc_checkpoint *cp = nla_data(attr);
+
+    if (nla_len(attr) < sizeof(*cp) || cp->version != TC_DLC_CHECKPOINT_VERSION)
+        return -EINVAL;
+    if (cp->main_states != model->main_chain.num_states ||
+        cp->queue_states != dlc_queue_states(model) ||
+        cp->main_state >= cp->main_states || cp->queue_state >= cp->queue_states)
+        return -EINVAL;
+    /* taus88 degenerates below these, prandom_seed_state() never produces them */
+    if (cp->rnd[0] < 2 || cp->rnd[1] < 8 || cp->rnd[2] < 16 || cp->rnd[3] < 128)
+        return -EINVAL;
+    return 0;
+}
+
+static void dlc_checkpoint_restore(struct dlc_sched_data *q, const struct tc_dlc_checkpoint *cp)
+{
+    struct dlc_mod_runtime *rt = q->dlc_rt;
+    u64 now = ktime_get_ns();
+
+    rt->main_state = cp->main_state;
+    rt->queue_state = cp->queue_state;
+    rt->rnd.s1 = cp->rnd[0];
+    rt->rnd.s2 = cp->rnd[1];
+    rt->rnd.s3 = cp->rnd[2];
+    rt->rnd.s4 = cp->rnd[3];
+    rt->last_time = cp->tick_age == ~0ULL ? 0 : now - min(cp->tick_age, now - 1);
+}
+
+/*
+ * Change of options, validated and built outside of the tree lock and applied
+ * under it by dlc_config_commit(). Everything that can fail or sleep happens
+ * in dlc_config_prepare(), so a prepared change always applies.
+ */
+struct dlc_config {
+    struct tc_dlc_qopt qopt;
+    s64 latency;
+    s64 jitter;
+    u64 rate;
+    u64 tick;
+    struct disttable *delay_dist;       /* new table, NULL = keep; old one after commit */
+    struct dlc_rate_trace *rate_trace;  /* with has_rate_trace, NULL = off */
+    struct dlc_mod_data *model;         /* new model; old one after commit */
+    struct dlc_mod_runtime *rt;         /* new runtime; old one after commit */
+    int node;
+    u32 gen;                            /* of the qdisc the config was built against */
+
+    bool has_gso;
+    bool has_limits;
+    bool has_noreorder;
+    bool has_slot;
+    bool has_checkpoint;
+    bool has_bypass;
+    bool has_rate_trace;
+    bool rate_trace_restart;
+    bool stats_reset;
+    bool noreorder;
+    struct tc_dlc_gso gso;
+    struct tc_dlc_limits limits;
+    struct tc_dlc_slot slot;
+    struct tc_dlc_bypass bypass;
+    struct tc_dlc_checkpoint checkpoint;
+};
+
+void dlc_config_free(struct dlc_config *cfg)
+{
+    if (!cfg)
+        return;
+    dlc_template_put(cfg->model);
+    dist_free(cfg->delay_dist);
+    kvfree(cfg->rate_trace);
+    kfree(cfg->rt);
+    kfree(cfg);
+}
+
 /* Parse netlink message to set options */
-static int dlc_change(struct Qdisc *sch, struct nlattr *opt,
-            struct netlink_ext_ack *extack)
+struct dlc_config *dlc_config_prepare(struct Qdisc *sch, const struct nlattr *opt,
+                                      struct netlink_ext_ack *extack)
 {
     struct dlc_sched_data *q = qdisc_priv(sch);
     struct nlattr *tb[TCA_DLC_MAX + 1];
-    struct disttable *delay_dist = NULL;
+    struct dlc_mod_params params;
     struct tc_dlc_qopt *qopt;
+    struct dlc_config *cfg;
     int ret = 0;
 
-    printk(KERN_INFO "Dlc: parsing params from netlink message\n");
     if (!opt)
-        return -EINVAL;
+        return ERR_PTR(-EINVAL);
     if (nla_len(opt) < sizeof(*qopt))
-        return -EINVAL;
+        return ERR_PTR(-EINVAL);
     qopt = nla_data(opt);
     nla_parse(tb, TCA_DLC_MAX, nla_data(opt) + NLA_ALIGN(sizeof(*qopt)), nla_len(opt) - NLA_ALIGN(sizeof(*qopt)), NULL, NULL);
 
+    cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+    if (!cfg)
+        return ERR_PTR(-ENOMEM);
+    cfg->qopt = *qopt;
+    cfg->gen = q->gen;
+
+    /* per-packet state goes next to the device; a moved qdisc is re-homed here */
+    cfg->node = dlc_numa_node(sch);
+    cfg->rt = kzalloc_node(sizeof(*cfg->rt), GFP_KERNEL, cfg->node);
+    if (!cfg->rt) {
+        ret = -ENOMEM;
+        goto cfg_free;
+    }
+
     if (tb[TCA_DLC_DELAY_DIST]) {
-        ret = get_dist_table(&delay_dist, tb[TCA_DLC_DELAY_DIST]);
+        ret = get_dist_table(&cfg->delay_dist, tb[TCA_DLC_DELAY_DIST], cfg->node);
         if (ret)
-            goto table_free;
+            goto cfg_free;
         printk(KERN_DEBUG "Dlc: parsed delay_dist\n");
+    } else if (q->delay_dist && q->node != cfg->node) {
+        ret = move_dist_table(&cfg->delay_dist, q->delay_dist, cfg->node);
+        if (ret)
+            goto cfg_free;
+        printk(KERN_DEBUG "Dlc: moving to node %d\n", cfg->node);
+    }
+
+    if (tb[TCA_DLC_RATE_TRACE]) {
+        ret = get_rate_trace(&cfg->rate_trace, tb[TCA_DLC_RATE_TRACE], cfg->node,
+                             psched_mtu(qdisc_dev(sch)));
+        if (ret)
+            goto cfg_free;
+        cfg->has_rate_trace = true;
+        cfg->rate_trace_restart = true;
+    } else if (q->rate_trace && q->node != cfg->node) {
+        ret = move_rate_trace(&cfg->rate_trace, q->rate_trace, cfg->node);
+        if (ret)
+            goto cfg_free;
+        cfg->has_rate_trace = true;
+    }
+
+    cfg->latency = PSCHED_TICKS2NS(qopt->latency);
+    cfg->jitter = PSCHED_TICKS2NS(qopt->jitter);
+    cfg->rate = qopt->rate;
+
+    if (tb[TCA_DLC_LATENCY64])
+        cfg->latency = nla_get_s64(tb[TCA_DLC_LATENCY64]);
+    if (tb[TCA_DLC_JITTER64])
+        cfg->jitter = nla_get_s64(tb[TCA_DLC_JITTER64]);
+    if (tb[TCA_DLC_RATE64])
+        cfg->rate = nla_get_u64(tb[TCA_DLC_RATE64]);
+    cfg->tick = q->tick;
+    if (tb[TCA_DLC_TICK]) {
+        if (nla_len(tb[TCA_DLC_TICK]) < sizeof(u64)) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        cfg->tick = nla_get_u64(tb[TCA_DLC_TICK]);
+    }
+    if (tb[TCA_DLC_SLOT]) {
+        if (nla_len(tb[TCA_DLC_SLOT]) < sizeof(cfg->slot)) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        memcpy(&cfg->slot, nla_data(tb[TCA_DLC_SLOT]), sizeof(cfg->slot));
+        cfg->has_slot = true;
+    }
+    if (tb[TCA_DLC_GSO]) {
+        const struct tc_dlc_gso *gso = nla_data(tb[TCA_DLC_GSO]);
+
+        if (nla_len(tb[TCA_DLC_GSO]) < sizeof(*gso) || gso->mode > TC_DLC_GSO_ARITH) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        cfg->gso = *gso;
+        cfg->has_gso = true;
+    }
+    if (tb[TCA_DLC_LIMITS]) {
+        const struct tc_dlc_limits *limits = nla_data(tb[TCA_DLC_LIMITS]);
+
+        if (nla_len(tb[TCA_DLC_LIMITS]) < sizeof(*limits) ||
+            limits->overflow > TC_DLC_OVERFLOW_HEAD) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        cfg->limits = *limits;
+        cfg->has_limits = true;
+    }
+    if (tb[TCA_DLC_NOREORDER]) {
+        if (nla_len(tb[TCA_DLC_NOREORDER]) < sizeof(u32)) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        cfg->noreorder = !!nla_get_u32(tb[TCA_DLC_NOREORDER]);
+        cfg->has_noreorder = true;
+    }
+    if (tb[TCA_DLC_BYPASS]) {
+        const struct tc_dlc_bypass *bypass = nla_data(tb[TCA_DLC_BYPASS]);
+
+        if (nla_len(tb[TCA_DLC_BYPASS]) < sizeof(*bypass) ||
+            (bypass->mark & ~bypass->mark_mask) ||
+            (bypass->prio_map >> (TC_PRIO_MAX + 1))) {
+            ret = -EINVAL;
+            goto cfg_free;
+        }
+        cfg->bypass = *bypass;
+        cfg->has_bypass = true;
+    }
+    cfg->stats_reset = !!tb[TCA_DLC_STATS_RESET];
+
+    /* capping jitter to the range acceptable by tabledist() */
+    cfg->jitter = min_t(s64, abs(cfg->jitter), INT_MAX);
+
+    printk(KERN_DEBUG "Dlc: Got params: limit=%u, latency=%lld, jitter=%lld, jitter_steps=%u, loss=%u, mu=%u\n",
+        qopt->limit, cfg->latency, cfg->jitter, qopt->jitter_steps, qopt->loss, qopt->mu);
+
+    /* model is built (or found shared) here, outside of tree lock, then swapped in */
+    memset(&params, 0, sizeof(params));
+    params.delay = cfg->latency;
+    params.jitter = cfg->jitter;
+    params.mm1_rho = (s64) qopt->mm1_rho;
+    params.jitter_steps = qopt->jitter_steps;
+    params.p_loss = qopt->loss;
+    params.mu = qopt->mu;
+    params.mean_burst_len = qopt->mean_burst_len;
+    params.mean_good_burst_len = qopt->mean_good_burst_len;
+    params.tick = cfg->tick;
+    params.node = cfg->node;
+    cfg->model = dlc_template_get(&params, cfg->delay_dist ? cfg->delay_dist : q->delay_dist);
+    if (IS_ERR(cfg->model)) {
+        ret = PTR_ERR(cfg->model);
+        cfg->model = NULL;
+        goto cfg_free;
+    }
+    if (tb[TCA_DLC_CHECKPOINT]) {
+        ret = dlc_checkpoint_check(tb[TCA_DLC_CHECKPOINT], cfg->model);
+        if (ret)
+            goto cfg_free;
+        memcpy(&cfg->checkpoint, nla_data(tb[TCA_DLC_CHECKPOINT]), sizeof(cfg->checkpoint));
+        cfg->has_checkpoint = true;
     }
+    return cfg;
+
+cfg_free:
+    dlc_config_free(cfg);
+    return ERR_PTR(ret);
+}
+
+/* Swaps the prepared change in, cfg keeps what it replaced until freed */
+void dlc_config_commit(struct Qdisc *sch, struct dlc_config *cfg)
+{
+    struct dlc_sched_data *q = qdisc_priv(sch);
+    const struct tc_dlc_qopt *qopt = &cfg->qopt;
 
     sch_tree_lock(sch);
 
-    if (delay_dist)
-        swap(q->delay_dist, delay_dist); // important
+    if (cfg->delay_dist)
+        swap(q->delay_dist, cfg->delay_dist); // important
+    if (cfg->has_rate_trace)
+        swap(q->rate_trace, cfg->rate_trace);
+    if (cfg->rate_trace_restart) {
+        q->rt_idx = 0;
+        q->rt_start = ktime_get_ns();
+    }
     sch->limit = qopt->limit;
 
-    q->latency = PSCHED_TICKS2NS(qopt->latency);
-    q->jitter = PSCHED_TICKS2NS(qopt->jitter);
+    q->latency = cfg->latency;
+    q->jitter = cfg->jitter;
     q->mm1_rho = (s64) qopt->mm1_rho;
     q->jitter_steps = qopt->jitter_steps;
     q->loss = qopt->loss;
@@ -435,31 +1247,61 @@ static int dlc_change(struct Qdisc *sch, struct nlattr *opt,
     q->mean_good_burst_len = qopt->mean_good_burst_len;
 
     q->limit = qopt->limit;
-    q->rate  = qopt->rate;
+    q->rate  = cfg->rate;
+    q->tick  = cfg->tick;
+
+    if (cfg->has_gso)
+        q->gso = cfg->gso;
+    if (cfg->has_limits)
+        q->limits = cfg->limits;
+    if (cfg->has_noreorder)
+        q->noreorder = cfg->noreorder;
+    /* packets already in the bypass FIFO still leave first */
+    if (cfg->has_bypass)
+        q->bypass = cfg->bypass;
+
+    if (cfg->has_slot) {
+        q->slot_config = cfg->slot;
+        /* force budget refill on the next dequeue */
+        q->slot.slot_start = U64_MAX;
+    }
 
-    if (tb[TCA_DLC_LATENCY64])
-		q->latency = nla_get_s64(tb[TCA_DLC_LATENCY64]);
-    if (tb[TCA_DLC_JITTER64])
-        q->jitter = nla_get_s64(tb[TCA_DLC_JITTER64]);
-    if (tb[TCA_DLC_RATE64])
-        q->rate = nla_get_u64(tb[TCA_DLC_RATE64]);
+    swap(q->dlc_model, cfg->model);
+    swap(q->dlc_rt, cfg->rt);
+    q->node = cfg->node;
+    dlc_mod_runtime_init(q->dlc_rt, q->dlc_model);
+    if (cfg->has_checkpoint)
+        dlc_checkpoint_restore(q, &cfg->checkpoint);
+    if (cfg->stats_reset)
+        dlc_stats_reset(q);
+    q->gen++;
 
-    /* capping jitter to the range acceptable by tabledist() */
-    q->jitter = min_t(s64, abs(q->jitter), INT_MAX);
+    sch_tree_unlock(sch);
+}
 
-    printk(KERN_DEBUG "Dlc: Got params: limit=%u, latency=%lld, jitter=%lld, jitter_steps=%u, loss=%u, mu=%u\n",
-        q->limit, q->latency, q->jitter, q->jitter_steps, q->loss, q->mu);
+/*
+ * A config keeps the current table, tick and node where options leave them
+ * out, so one prepared before another commit may no longer fit (RTNL held).
+ */
+bool dlc_config_stale(struct Qdisc *sch, const struct dlc_config *cfg)
+{
+    const struct dlc_sched_data *q = qdisc_priv(sch);
 
-    dlc_mod_init(&(q->dlc_model),
-                 q->latency, q->jitter, q->mm1_rho, q->jitter_steps,
-                 q->loss, q->mu, q->mean_burst_len, q->mean_good_burst_len,
-                 q->delay_dist);
+    return cfg->gen != q->gen;
+}
 
-    sch_tree_unlock(sch);
+static int dlc_change(struct Qdisc *sch, struct nlattr *opt,
+            struct netlink_ext_ack *extack)
+{
+    struct dlc_config *cfg;
 
-table_free:
-    dist_free(delay_dist);
-    return ret;
+    printk(KERN_INFO "Dlc: parsing params from netlink message\n");
+    cfg = dlc_config_prepare(sch, opt, extack);
+    if (IS_ERR(cfg))
+        return PTR_ERR(cfg);
+    dlc_config_commit(sch, cfg);
+    dlc_config_free(cfg);
+    return 0;
 }
 
 static int dlc_init(struct Qdisc *sch, struct nlattr *opt,
@@ -471,6 +1313,9 @@ static int dlc_init(struct Qdisc *sch, struct nlattr *opt,
     printk(KERN_DEBUG "Dlc init\n");
 
     qdisc_watchdog_init(&q->watchdog, sch);
+    q->watchdog.timer.function = dlc_watchdog_fire;
+    dlc_timer_init(&q->timer, sch);
+    dlc_genl_register(&q->genl, sch);
 
     if (!opt)
         return -EINVAL;
@@ -485,18 +1330,24 @@ static void dlc_destroy(struct Qdisc *sch)
 {
     struct dlc_sched_data *q = qdisc_priv(sch);
 
-    qdisc_watchdog_cancel(&q->watchdog);
+    dlc_watchdog_cancel(q);
+    dlc_genl_unregister(&q->genl);
     if (q->qdisc)
         qdisc_put(q->qdisc);
     dist_free(q->delay_dist);
     q->delay_dist = NULL;
-    dlc_mod_destroy(&(q->dlc_model));
+    kvfree(q->rate_trace);
+    q->rate_trace = NULL;
+    dlc_template_put(q->dlc_model);
+    q->dlc_model = NULL;
+    kfree(q->dlc_rt);
+    q->dlc_rt = NULL;
 }
 
 static int dump_markov_chain(const struct dlc_sched_data *q, struct sk_buff *skb)
 {
     struct nlattr *nest;
-    const struct dlc_mod_data* model = &(q->dlc_model);
+    const struct dlc_mod_data* model = q->dlc_model;
     struct tc_dlc_simple_state simple_state;
     struct tc_dlc_queue_state queue_state;
     struct tc_dlc_loss_state loss_state;
@@ -554,9 +1405,9 @@ static int dump_dlc_model(const struct dlc_sched_data *q,
             struct sk_buff *skb)
 {
     struct tc_dlc_model model = {
-        .mc_num_states  = q->dlc_model.main_chain.num_states,
-        .mc_curr_state  = q->dlc_model.main_chain.curr_state,
-        .delaydist_size = sizeof(q->dlc_model.delay_dist)
+        .mc_num_states  = q->dlc_model->main_chain.num_states,
+        .mc_curr_state  = q->dlc_rt->main_state,
+        .delaydist_size = sizeof(q->dlc_model->delay_dist)
     };
 
     if (nla_put(skb, TCA_DLC_MODEL, sizeof(model), &model))
@@ -571,21 +1422,24 @@ nla_put_failure:
     return -1;
 }
 
-static int dlc_dump(struct Qdisc *sch, struct sk_buff *skb)
+static void dlc_fill_qopt(const struct dlc_sched_data *q, struct tc_dlc_qopt *qopt)
 {
-    const struct dlc_sched_data *q = qdisc_priv(sch);
-    struct nlattr *nla = (struct nlattr *) skb_tail_pointer(skb);
-    struct tc_dlc_qopt qopt;
+    memset(qopt, 0, sizeof(*qopt));
+    qopt->latency = min_t(psched_time_t, PSCHED_NS2TICKS(q->latency), UINT_MAX);
+    qopt->jitter = min_t(psched_time_t, PSCHED_NS2TICKS(q->jitter), UINT_MAX);
+    qopt->mm1_rho = q->mm1_rho;
+    qopt->jitter_steps = q->jitter_steps;
+    qopt->mu = q->mu;
+    qopt->mean_burst_len = q->mean_burst_len;
+    qopt->mean_good_burst_len = q-> mean_good_burst_len;
+    qopt->loss = q->loss;
+    qopt->limit = q->limit;
+}
 
-    qopt.latency = min_t(psched_time_t, PSCHED_NS2TICKS(q->latency), UINT_MAX);
-    qopt.jitter = min_t(psched_time_t, PSCHED_NS2TICKS(q->jitter), UINT_MAX);
-    qopt.mm1_rho = q->mm1_rho;
-    qopt.jitter_steps = q->jitter_steps;
-    qopt.mu = q->mu;
-    qopt.mean_burst_len = q->mean_burst_len;
-    qopt.mean_good_burst_len = q-> mean_good_burst_len;
-    qopt.loss = q->loss;
-    qopt.limit = q->limit;
+/* TCA_DLC_* attributes of the current options */
+static int dlc_dump_attrs(const struct dlc_sched_data *q, struct sk_buff *skb)
+{
+    struct tc_dlc_checkpoint cp;
 
     if (nla_put(skb, TCA_DLC_LATENCY64, sizeof(q->latency), &q->latency))
         goto nla_put_failure;
@@ -594,6 +1448,68 @@ static int dlc_dump(struct Qdisc *sch, struct sk_buff *skb)
     if (nla_put_u64_64bit(skb, TCA_DLC_RATE64, q->rate, TCA_DLC_PAD))
         goto nla_put_failure;
 
+    dlc_checkpoint_get(q, &cp);
+    if (nla_put(skb, TCA_DLC_CHECKPOINT, sizeof(cp), &cp))
+        goto nla_put_failure;
+
+    if (q->tick &&
+        nla_put_u64_64bit(skb, TCA_DLC_TICK, q->tick, TCA_DLC_PAD))
+        goto nla_put_failure;
+
+    if (q->gso.mode != TC_DLC_GSO_OFF &&
+        nla_put(skb, TCA_DLC_GSO, sizeof(q->gso), &q->gso))
+        goto nla_put_failure;
+
+    if ((q->limits.bytes || q->limits.mem || q->limits.overflow) &&
+        nla_put(skb, TCA_DLC_LIMITS, sizeof(q->limits), &q->limits))
+        goto nla_put_failure;
+
+    if (q->noreorder && nla_put_u32(skb, TCA_DLC_NOREORDER, 1))
+        goto nla_put_failure;
+
+    if (q->slot_config.period &&
+        nla_put(skb, TCA_DLC_SLOT, sizeof(q->slot_config), &q->slot_config))
+        goto nla_put_failure;
+
+    if (dlc_bypass_on(&q->bypass) &&
+        nla_put(skb, TCA_DLC_BYPASS, sizeof(q->bypass), &q->bypass))
+        goto nla_put_failure;
+    return 0;
+
+nla_put_failure:
+    return -1;
+}
+
+/* Options in the layout dlc_config_prepare() takes: qopt, then TCA_DLC_* */
+int dlc_config_dump(struct Qdisc *sch, struct sk_buff *skb, int attrtype)
+{
+    const struct dlc_sched_data *q = qdisc_priv(sch);
+    struct tc_dlc_qopt qopt;
+    struct nlattr *nest;
+
+    dlc_fill_qopt(q, &qopt);
+    nest = nla_nest_start_noflag(skb, attrtype);
+    if (!nest)
+        return -EMSGSIZE;
+    if (nla_put_nohdr(skb, sizeof(qopt), &qopt) || dlc_dump_attrs(q, skb)) {
+        nla_nest_cancel(skb, nest);
+        return -EMSGSIZE;
+    }
+    nla_nest_end(skb, nest);
+    return 0;
+}
+
+static int dlc_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+    const struct dlc_sched_data *q = qdisc_priv(sch);
+    struct nlattr *nla = (struct nlattr *) skb_tail_pointer(skb);
+    struct tc_dlc_qopt qopt;
+
+    dlc_fill_qopt(q, &qopt);
+
+    if (dlc_dump_attrs(q, skb))
+        goto nla_put_failure;
+
     if (nla_put(skb, TCA_OPTIONS, sizeof(qopt), &qopt))
         goto nla_put_failure;
 
@@ -607,6 +1523,58 @@ nla_put_failure:
     return -1;
 }
 
+/* first bucket holding the given share (per mille) of samples */
+static u64 dlc_lat_quantile(const struct tc_dlc_xstats *st, u64 permille)
+{
+    u64 rank = div64_u64(st->released * permille + 999, 1000);
+    u64 seen = 0;
+    unsigned int b;
+
+    if (!st->released)
+        return 0;
+    for (b = 0; b < TC_DLC_LAT_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen >= rank)
+            break;
+    }
+    return min(dlc_lat_bucket_end(b), st->late_max);
+}
+
+/*
+ * Before 5.16 tc_fill_qdisc() holds the root lock around dump_stats, since
+ * then dump runs under RTNL only and the snapshot takes the lock itself.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+#define dlc_dump_lock(sch)      sch_tree_lock(sch)
+#define dlc_dump_unlock(sch)    sch_tree_unlock(sch)
+#else
+#define dlc_dump_lock(sch)      do { } while (0)
+#define dlc_dump_unlock(sch)    do { } while (0)
+#endif
+
+static int dlc_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+    const struct dlc_sched_data *q = qdisc_priv(sch);
+    struct tc_dlc_xstats st;
+
+    memset(&st, 0, sizeof(st));
+    dlc_dump_lock(sch);
+    st.released = q->lateness.count;
+    st.late_sum = q->lateness.sum;
+    st.late_max = q->lateness.max;
+    memcpy(st.hist, q->lateness.hist, sizeof(st.hist));
+    st.wd_fires = q->wd_fires;
+    st.wd_empty = q->wd_empty;
+    st.bypassed = q->bypassed;
+    dlc_dump_unlock(sch);
+
+    st.late_p50 = dlc_lat_quantile(&st, 500);
+    st.late_p99 = dlc_lat_quantile(&st, 990);
+    st.late_p999 = dlc_lat_quantile(&st, 999);
+
+    return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
 static int dlc_dump_class(struct Qdisc *sch, unsigned long cl,
             struct sk_buff *skb, struct tcmsg *tcm)
 {
@@ -674,19 +1642,39 @@ static struct Qdisc_ops dlc_qdisc_ops __read_mostly = {
     .destroy  =  dlc_destroy,
     .change    =  dlc_change,
     .dump    =  dlc_dump,
+    .dump_stats  =  dlc_dump_stats,
     .owner    =  THIS_MODULE,
 };
 
 
 static int __init dlc_module_init(void)
 {
+    int ret;
+
     pr_info("dlc_model register \n");
-    return register_qdisc(&dlc_qdisc_ops);
+    ret = dlc_timer_service_init();
+    if (ret)
+        return ret;
+    ret = dlc_genl_init();
+    if (ret)
+        goto timer_exit;
+    ret = register_qdisc(&dlc_qdisc_ops);
+    if (ret)
+        goto genl_exit;
+    return 0;
+
+genl_exit:
+    dlc_genl_exit();
+timer_exit:
+    dlc_timer_service_exit();
+    return ret;
 }
 static void __exit dlc_module_exit(void)
 {
     pr_info("dlc_model unregister \n");
     unregister_qdisc(&dlc_qdisc_ops);
+    dlc_genl_exit();
+    dlc_timer_service_exit();
 }
 module_init(dlc_module_init)
 module_exit(dlc_module_exit)
@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bpf_raw.h"
+
+int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+int bpf_raw_map_create(uint32_t type, uint32_t key_size, uint32_t value_size, uint32_t max_entries)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+int bpf_raw_map_update(int fd, const void *key, const void *value)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uintptr_t)key;
+    attr.value = (uintptr_t)value;
+    attr.flags = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+int bpf_raw_map_lookup(int fd, const void *key, void *value)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uintptr_t)key;
+    attr.value = (uintptr_t)value;
+    return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+int bpf_raw_prog_load(uint32_t type, uint32_t attach_type,
+                      const struct bpf_insn *insns, uint32_t cnt)
+{
+    static char log[1 << 16];
+    union bpf_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = type;
+    attr.expected_attach_type = attach_type;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = cnt;
+    attr.license = (uintptr_t)"GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    log[0] = 0;
+    fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0 && log[0])
+        fprintf(stderr, "bpf: verifier: %s\n", log);
+    return fd;
+}
+
+int bpf_raw_link_create(int prog_fd, int target_ifindex, uint32_t attach_type, uint32_t flags)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.target_ifindex = target_ifindex;
+    attr.link_create.attach_type = attach_type;
+    attr.link_create.flags = flags;
+    return sys_bpf(BPF_LINK_CREATE, &attr);
+}
+
+int bpf_raw_num_cpus(void)
+{
+    unsigned int first, last;
+    FILE *f;
+    int n;
+
+    /* "0-7", the possible mask has no holes */
+    f = fopen("/sys/devices/system/cpu/possible", "r");
+    if (!f)
+        return -errno;
+    n = fscanf(f, "%u-%u", &first, &last);
+    fclose(f);
+    if (n < 1)
+        return -EINVAL;
+    if (n == 1)
+        last = first;
+    return last + 1;
+}
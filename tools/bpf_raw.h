@@ -0,0 +1,61 @@
+#ifndef _DLC_BPF_RAW_H
+#define _DLC_BPF_RAW_H
+
+#include <stdint.h>
+
+#include <linux/bpf.h>
+
+/*
+ * bpf() on top of the kernel uapi only (no libbpf): programs are assembled
+ * in place from the instruction macros below (as in samples/bpf/bpf_insn.h),
+ * so the tools build without clang or a BPF toolchain.
+ */
+
+#define BPF_ALU64_REG(OP, DST, SRC) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_OP(OP) | BPF_X, .dst_reg = DST, .src_reg = SRC })
+#define BPF_ALU64_IMM(OP, DST, IMM) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_OP(OP) | BPF_K, .dst_reg = DST, .imm = IMM })
+#define BPF_MOV64_REG(DST, SRC)     BPF_ALU64_REG(BPF_MOV, DST, SRC)
+#define BPF_MOV64_IMM(DST, IMM)     BPF_ALU64_IMM(BPF_MOV, DST, IMM)
+
+/* *(size *)(SRC + OFF) */
+#define BPF_LDX_MEM(SIZE, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_LDX | BPF_SIZE(SIZE) | BPF_MEM, .dst_reg = DST, .src_reg = SRC, .off = OFF })
+#define BPF_STX_MEM(SIZE, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_STX | BPF_SIZE(SIZE) | BPF_MEM, .dst_reg = DST, .src_reg = SRC, .off = OFF })
+#define BPF_ST_MEM(SIZE, DST, OFF, IMM) \
+    ((struct bpf_insn) { .code = BPF_ST | BPF_SIZE(SIZE) | BPF_MEM, .dst_reg = DST, .off = OFF, .imm = IMM })
+
+/* two instructions */
+#define BPF_LD_MAP_FD(DST, MAP_FD) \
+    ((struct bpf_insn) { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = DST, .src_reg = BPF_PSEUDO_MAP_FD, .imm = MAP_FD }), \
+    ((struct bpf_insn) { 0 })
+
+#define BPF_JMP_REG(OP, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_OP(OP) | BPF_X, .dst_reg = DST, .src_reg = SRC, .off = OFF })
+#define BPF_JMP_IMM(OP, DST, IMM, OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_OP(OP) | BPF_K, .dst_reg = DST, .off = OFF, .imm = IMM })
+#define BPF_JMP_A(OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_JA, .off = OFF })
+#define BPF_CALL_FUNC(FUNC) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_CALL, .imm = FUNC })
+#define BPF_EXIT_INSN() \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_EXIT })
+
+int sys_bpf(int cmd, union bpf_attr *attr);
+
+int bpf_raw_map_create(uint32_t type, uint32_t key_size, uint32_t value_size, uint32_t max_entries);
+int bpf_raw_map_update(int fd, const void *key, const void *value);
+int bpf_raw_map_lookup(int fd, const void *key, void *value);
+
+/* Verifier log goes to stderr when the load fails */
+int bpf_raw_prog_load(uint32_t type, uint32_t attach_type,
+                      const struct bpf_insn *insns, uint32_t cnt);
+
+/* bpf_link: the attachment goes away when the last fd is closed */
+int bpf_raw_link_create(int prog_fd, int target_ifindex, uint32_t attach_type, uint32_t flags);
+
+/* Number of possible CPUs, per-CPU map values come in this many 8-byte slots */
+int bpf_raw_num_cpus(void);
+
+#endif
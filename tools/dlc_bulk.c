@@ -0,0 +1,711 @@
+/*
+ * dlc_bulk - configure many dlc qdiscs at once over the "dlc" generic netlink
+ * family of the module.
+ *
+ * Every line of the input describes one existing dlc qdisc and its new options:
+ *   dev handle [model options] [-L limit] [-R rate_trace]
+ * e.g. "veth12 1: -d 20 -j 2 -l 0.5". Options not given take the defaults of
+ * the model options (see -h), exactly as a fresh tc qdisc change would.
+ * A rate trace is uploaded once per change and replaces the constant rate;
+ * "-R none" turns it off, no -R keeps the current one.
+ *
+ * Lines are staged with PREPARE messages of up to -m bytes each, then one
+ * COMMIT switches all of them; the module swaps every instance before it frees
+ * anything, so the links change within one short window. Any failure aborts
+ * the whole transaction and no link changes. With -1 everything goes in one
+ * SET message instead.
+ *
+ * -g dumps the options of every dlc qdisc of the netns.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+#include "model_util.h"
+#include "../dlc/dlc_tca_spec.h"
+
+#define DEFAULT_MSG_SIZE    (64 * 1024)
+#define DEFAULT_LIMIT       1000
+#define MAX_LINE_ARGS       64
+#define RECV_BUF            (64 * 1024)
+#define NLA_LEN_MAX         0xffff  /* nla_len is a u16, nests included */
+#define MAHIMAHI_MTU        1500
+
+#ifndef NETLINK_EXT_ACK
+#define NETLINK_EXT_ACK     11
+#endif
+
+struct nl {
+    int fd;
+    int family;
+    uint32_t seq;
+};
+
+/* one netlink message under construction */
+struct msg {
+    char *buf;
+    size_t cap;
+    size_t len;
+};
+
+static struct nlmsghdr *msg_hdr(struct msg *m)
+{
+    return (struct nlmsghdr *)m->buf;
+}
+
+static int msg_init(struct msg *m, size_t cap, int type, int cmd, int flags)
+{
+    struct genlmsghdr *g;
+
+    m->buf = calloc(1, cap);
+    if (!m->buf)
+        return -ENOMEM;
+    m->cap = cap;
+    m->len = NLMSG_HDRLEN + GENL_HDRLEN;
+    msg_hdr(m)->nlmsg_type = type;
+    msg_hdr(m)->nlmsg_flags = NLM_F_REQUEST | flags;
+    g = NLMSG_DATA(m->buf);
+    g->cmd = cmd;
+    g->version = DLC_GENL_VERSION;
+    return 0;
+}
+
+static void msg_reset(struct msg *m)
+{
+    m->len = NLMSG_HDRLEN + GENL_HDRLEN;
+}
+
+/* NULL when it does not fit */
+static struct nlattr *msg_put(struct msg *m, int type, const void *data, size_t len)
+{
+    struct nlattr *a;
+
+    if (m->len + NLA_HDRLEN + NLA_ALIGN(len) > m->cap)
+        return NULL;
+    a = (struct nlattr *)(m->buf + m->len);
+    a->nla_type = type;
+    a->nla_len = NLA_HDRLEN + len;
+    if (len)
+        memcpy((char *)a + NLA_HDRLEN, data, len);
+    memset((char *)a + NLA_HDRLEN + len, 0, NLA_ALIGN(len) - len);
+    m->len += NLA_HDRLEN + NLA_ALIGN(len);
+    return a;
+}
+
+static int msg_put_u32(struct msg *m, int type, uint32_t v)
+{
+    return msg_put(m, type, &v, sizeof(v)) ? 0 : -EMSGSIZE;
+}
+
+/* raw bytes inside an open nest, aligned like nla_put_nohdr() */
+static int msg_put_raw(struct msg *m, const void *data, size_t len)
+{
+    if (m->len + NLA_ALIGN(len) > m->cap)
+        return -EMSGSIZE;
+    memcpy(m->buf + m->len, data, len);
+    memset(m->buf + m->len + len, 0, NLA_ALIGN(len) - len);
+    m->len += NLA_ALIGN(len);
+    return 0;
+}
+
+/* -E2BIG when the nest outgrew nla_len, not -EMSGSIZE: a new message won't help */
+static int msg_nest_end(struct msg *m, struct nlattr *nest)
+{
+    size_t len = m->buf + m->len - (char *)nest;
+
+    if (len > NLA_LEN_MAX)
+        return -E2BIG;
+    nest->nla_len = len;
+    return 0;
+}
+
+static int nl_send(struct nl *nl, struct msg *m)
+{
+    msg_hdr(m)->nlmsg_len = m->len;
+    msg_hdr(m)->nlmsg_seq = ++nl->seq;
+    if (send(nl->fd, m->buf, m->len, 0) < 0)
+        return -errno;
+    return 0;
+}
+
+static const struct nlattr *attr_find(const void *data, int len, int type)
+{
+    const struct nlattr *a;
+
+    for (a = data; len >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= len;
+         len -= NLA_ALIGN(a->nla_len), a = (const void *)((const char *)a + NLA_ALIGN(a->nla_len)))
+        if ((a->nla_type & NLA_TYPE_MASK) == type)
+            return a;
+    return NULL;
+}
+
+static const void *attr_data(const struct nlattr *a)
+{
+    return (const char *)a + NLA_HDRLEN;
+}
+
+/* error of the ack, with the extended ack message if the kernel sent one */
+static int ack_error(const struct nlmsghdr *h)
+{
+    const struct nlmsgerr *err = NLMSG_DATA(h);
+    const struct nlattr *msg;
+    int off, len;
+
+    if (!err->error)
+        return 0;
+    fprintf(stderr, "dlc_bulk: %s", strerror(-err->error));
+    if (h->nlmsg_flags & NLM_F_ACK_TLVS) {
+        off = sizeof(*err);
+        if (!(h->nlmsg_flags & NLM_F_CAPPED))
+            off += err->msg.nlmsg_len - NLMSG_HDRLEN;
+        len = h->nlmsg_len - NLMSG_HDRLEN - off;
+        msg = attr_find((const char *)err + off, len, NLMSGERR_ATTR_MSG);
+        if (msg)
+            fprintf(stderr, ": %s", (const char *)attr_data(msg));
+    }
+    fprintf(stderr, "\n");
+    return err->error;
+}
+
+/*
+ * Reads replies to the last request until its ack or NLMSG_DONE; cb gets
+ * every data message (attributes after the genl header).
+ */
+static int nl_recv(struct nl *nl, int (*cb)(const void *attrs, int len, void *arg), void *arg)
+{
+    static char buf[RECV_BUF];
+    const struct nlmsghdr *h;
+    int n, ret;
+
+    for (;;) {
+        n = recv(nl->fd, buf, sizeof(buf), 0);
+        if (n < 0)
+            return -errno;
+        for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned int)n); h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_seq != nl->seq)
+                continue;
+            if (h->nlmsg_type == NLMSG_DONE)
+                return 0;
+            if (h->nlmsg_type == NLMSG_ERROR)
+                return ack_error(h);
+            if (cb) {
+                ret = cb((const char *)NLMSG_DATA(h) + GENL_HDRLEN,
+                         h->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN, arg);
+                if (ret)
+                    return ret;
+            }
+        }
+    }
+}
+
+static int family_cb(const void *attrs, int len, void *arg)
+{
+    const struct nlattr *id = attr_find(attrs, len, CTRL_ATTR_FAMILY_ID);
+
+    if (id)
+        *(int *)arg = *(const uint16_t *)attr_data(id);
+    return 0;
+}
+
+static int nl_open(struct nl *nl)
+{
+    int one = 1, sndbuf = 4 << 20;
+    struct msg m;
+    int ret;
+
+    nl->family = 0;
+    nl->seq = time(NULL);
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (nl->fd < 0)
+        return -errno;
+    setsockopt(nl->fd, SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+    setsockopt(nl->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    if (msg_init(&m, 256, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, NLM_F_ACK))
+        return -ENOMEM;
+    ((struct genlmsghdr *)NLMSG_DATA(m.buf))->version = 1;
+    msg_put(&m, CTRL_ATTR_FAMILY_NAME, DLC_GENL_NAME, sizeof(DLC_GENL_NAME));
+    ret = nl_send(nl, &m);
+    if (!ret)
+        ret = nl_recv(nl, family_cb, &nl->family);
+    free(m.buf);
+    if (!ret && !nl->family)
+        ret = -ENOENT;
+    return ret;
+}
+
+/* rate trace of -R; the last one is kept, lines usually share a file */
+static struct {
+    char path[256];
+    struct tc_dlc_rate_step *steps;
+    size_t len;
+} trace;
+
+static int trace_add(struct tc_dlc_rate_step **steps, size_t *len, size_t *cap,
+                     unsigned long duration, unsigned long rate)
+{
+    /* Mahimahi steps of equal rate are merged */
+    if (*len && (*steps)[*len - 1].rate == rate &&
+        (*steps)[*len - 1].duration + duration <= UINT32_MAX) {
+        (*steps)[*len - 1].duration += duration;
+        return 0;
+    }
+    if (*len == *cap) {
+        struct tc_dlc_rate_step *s = realloc(*steps, (*cap ? *cap * 2 : 256) * sizeof(*s));
+
+        if (!s)
+            return -ENOMEM;
+        *steps = s;
+        *cap = *cap ? *cap * 2 : 256;
+    }
+    (*steps)[*len].duration = duration;
+    (*steps)[*len].rate = rate;
+    (*len)++;
+    return 0;
+}
+
+/*
+ * Rate trace file, either "duration_us rate_kbit" per line, or a Mahimahi
+ * trace: one ms timestamp per line, each a delivery opportunity of
+ * MAHIMAHI_MTU bytes, repeating after the last timestamp. The latter becomes
+ * 1 ms steps.
+ */
+static int load_trace(const char *path, const char *where)
+{
+    struct tc_dlc_rate_step *steps = NULL;
+    unsigned long a, b, *ts = NULL, last = 0;
+    size_t len = 0, cap = 0, nts = 0, i, j;
+    int pairs = -1, ret = -EINVAL;
+    char line[256];
+    FILE *f;
+
+    if (!strcmp(path, trace.path))
+        return 0;
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s: %s\n", where, path, strerror(errno));
+        return -errno;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        int n = sscanf(line, "%lu %lu", &a, &b);
+
+        if (n <= 0)
+            continue;
+        if (pairs < 0)
+            pairs = n == 2;
+        if (pairs && n == 2) {
+            if (a > UINT32_MAX || b > UINT32_MAX || trace_add(&steps, &len, &cap, a, b))
+                goto bad;
+            continue;
+        }
+        if (pairs || a < last)
+            goto bad;
+        if (nts % 4096 == 0) {
+            unsigned long *t = realloc(ts, (nts + 4096) * sizeof(*t));
+
+            if (!t)
+                goto bad;
+            ts = t;
+        }
+        ts[nts++] = last = a;
+    }
+
+    /* ms (t - 1, t] gets the opportunities stamped t */
+    for (i = 0, j = 0; !pairs && last && i < last; i++) {
+        unsigned long n = 0;
+
+        while (j < nts && (ts[j] ? ts[j] - 1 : 0) == i)
+            j++, n++;
+        if (trace_add(&steps, &len, &cap, 1000, n * MAHIMAHI_MTU * 8))
+            goto bad;
+    }
+    /* the rest of the options shrinks the room further, see put_instance() */
+    if (!len || len > (NLA_LEN_MAX - NLA_HDRLEN) / sizeof(*steps)) {
+        fprintf(stderr, "%s: %s: %zu steps, 1..%zu supported\n", where, path, len,
+                (NLA_LEN_MAX - NLA_HDRLEN) / sizeof(*steps));
+        goto out;
+    }
+    free(trace.steps);
+    trace.steps = steps;
+    trace.len = len;
+    snprintf(trace.path, sizeof(trace.path), "%s", path);
+    steps = NULL;
+    ret = 0;
+    goto out;
+
+bad:
+    fprintf(stderr, "%s: %s: bad rate trace\n", where, path);
+out:
+    fclose(f);
+    free(steps);
+    free(ts);
+    return ret;
+}
+
+/* tc handle syntax: "1:", "1:0", "ffff:" (hex) */
+static int parse_handle(const char *s, uint32_t *handle)
+{
+    unsigned long maj, min = 0;
+    char *end;
+
+    maj = strtoul(s, &end, 16);
+    if (*end != ':' || maj > 0xffff)
+        return -1;
+    if (end[1]) {
+        min = strtoul(end + 1, &end, 16);
+        if (*end || min > 0xffff)
+            return -1;
+    }
+    *handle = (maj << 16) | min;
+    return 0;
+}
+
+/* INSTANCE of one input line, -EMSGSIZE leaves m as it was */
+static int put_instance(struct msg *m, char *line, const char *where)
+{
+    char *argv[MAX_LINE_ARGS + 1], *tok;
+    struct model_params mp;
+    struct tc_dlc_qopt qopt;
+    struct nlattr *inst, *opts;
+    s64 latency, jitter;
+    size_t start = m->len;
+    uint32_t ifindex, handle, limit = DEFAULT_LIMIT;
+    const char *rate_trace = NULL;
+    size_t trace_bytes = 0;
+    int argc = 0, opt, ret = -EINVAL;
+
+    argv[argc++] = "dlc_bulk";
+    for (tok = strtok(line, " \t\n"); tok && argc < MAX_LINE_ARGS; tok = strtok(NULL, " \t\n"))
+        argv[argc++] = tok;
+    argv[argc] = NULL;
+    if (argc < 3) {
+        fprintf(stderr, "%s: expected \"dev handle [options]\"\n", where);
+        return -EINVAL;
+    }
+    ifindex = if_nametoindex(argv[1]);
+    if (!ifindex) {
+        fprintf(stderr, "%s: %s: %s\n", where, argv[1], strerror(errno));
+        return -ENODEV;
+    }
+    if (parse_handle(argv[2], &handle)) {
+        fprintf(stderr, "%s: bad handle %s\n", where, argv[2]);
+        return -EINVAL;
+    }
+
+    /* options after the handle, getopt restarted for every line */
+    argv[2] = argv[0];
+    model_params_init(&mp);
+    optind = 0;
+    while ((opt = getopt(argc - 2, argv + 2, MODEL_OPTSTRING "L:R:")) != -1) {
+        ret = model_params_opt(&mp, opt, optarg);
+        if (ret == MODEL_OPT_ERROR)
+            goto out;
+        if (ret != MODEL_OPT_NONE)
+            continue;
+        switch (opt) {
+        case 'L':
+            limit = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            rate_trace = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s: unknown option\n", where);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "%s: unexpected %s\n", where, argv[optind + 2]);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (rate_trace && strcmp(rate_trace, "none")) {
+        ret = load_trace(rate_trace, where);
+        if (ret)
+            goto out;
+        trace_bytes = trace.len * sizeof(trace.steps[0]);
+    }
+
+    model_qopt(&mp, &qopt, &latency, &jitter);
+    qopt.limit = limit;
+
+    ret = -EMSGSIZE;
+    inst = msg_put(m, DLC_A_INSTANCE | NLA_F_NESTED, NULL, 0);
+    if (!inst || msg_put_u32(m, DLC_A_IFINDEX, ifindex) || msg_put_u32(m, DLC_A_HANDLE, handle))
+        goto rollback;
+    opts = msg_put(m, DLC_A_OPTIONS, NULL, 0);
+    if (!opts || msg_put_raw(m, &qopt, sizeof(qopt)) ||
+        !msg_put(m, TCA_DLC_LATENCY64, &latency, sizeof(latency)) ||
+        !msg_put(m, TCA_DLC_JITTER64, &jitter, sizeof(jitter)))
+        goto rollback;
+    if (mp.dist && !msg_put(m, TCA_DLC_DELAY_DIST, mp.dist->table,
+                            mp.dist->size * sizeof(mp.dist->table[0])))
+        goto rollback;
+    if (rate_trace) {
+        /* whatever the nests still have room for after the other options */
+        size_t used = m->len - ((char *)inst - m->buf) + NLA_HDRLEN;
+
+        if (used + trace_bytes > NLA_LEN_MAX) {
+            fprintf(stderr, "%s: %s: %zu steps, %zu fit beside the other options\n",
+                    where, rate_trace, trace.len,
+                    used < NLA_LEN_MAX ? (NLA_LEN_MAX - used) / sizeof(trace.steps[0]) : 0);
+            ret = -E2BIG;
+            goto rollback;
+        }
+        if (!msg_put(m, TCA_DLC_RATE_TRACE, trace.steps, trace_bytes))
+            goto rollback;
+    }
+    if (msg_nest_end(m, opts) || msg_nest_end(m, inst)) {
+        fprintf(stderr, "%s: options exceed %u bytes of a netlink attribute\n",
+                where, NLA_LEN_MAX);
+        ret = -E2BIG;
+        goto rollback;
+    }
+    ret = 0;
+    goto out;
+
+rollback:
+    m->len = start;
+out:
+    free(mp.dist);
+    return ret;
+}
+
+static int send_txn(struct nl *nl, uint32_t txn, int cmd)
+{
+    struct msg m;
+    int ret;
+
+    if (msg_init(&m, 64, nl->family, cmd, NLM_F_ACK))
+        return -ENOMEM;
+    msg_put_u32(&m, DLC_A_TXN, txn);
+    ret = nl_send(nl, &m);
+    if (!ret)
+        ret = nl_recv(nl, NULL, NULL);
+    free(m.buf);
+    return ret;
+}
+
+static int flush(struct nl *nl, struct msg *m, size_t *count)
+{
+    int ret;
+
+    if (!*count)
+        return 0;
+    ret = nl_send(nl, m);
+    if (!ret)
+        ret = nl_recv(nl, NULL, NULL);
+    msg_reset(m);
+    *count = 0;
+    return ret;
+}
+
+static int configure(struct nl *nl, FILE *in, const char *name, size_t msg_size, int single)
+{
+    uint32_t txn = (getpid() << 8 | (time(NULL) & 0xff)) | 1;
+    size_t count = 0, total = 0, lineno = 0;
+    char line[4096], where[256];
+    struct timespec t0, t1;
+    struct msg m;
+    int ret = 0;
+
+    if (msg_init(&m, single ? 1 << 20 : msg_size, nl->family,
+                 single ? DLC_CMD_SET : DLC_CMD_PREPARE, NLM_F_ACK))
+        return -ENOMEM;
+    if (!single)
+        msg_put_u32(&m, DLC_A_TXN, txn);
+
+    while (fgets(line, sizeof(line), in)) {
+        char *p = line + strspn(line, " \t");
+
+        lineno++;
+        if (*p == '#' || *p == '\n' || !*p)
+            continue;
+        snprintf(where, sizeof(where), "%s:%zu", name, lineno);
+        for (;;) {
+            char copy[sizeof(line)];
+
+            strcpy(copy, p);
+            ret = put_instance(&m, copy, where);
+            if (ret != -EMSGSIZE)
+                break;
+            if (single) {
+                /* one message: grow it */
+                char *buf = realloc(m.buf, m.cap * 2);
+
+                if (!buf) {
+                    ret = -ENOMEM;
+                    break;
+                }
+                m.buf = buf;
+                m.cap *= 2;
+                continue;
+            }
+            if (!count) {
+                fprintf(stderr, "%s: options do not fit in %zu bytes\n", where, msg_size);
+                break;
+            }
+            ret = flush(nl, &m, &count);
+            if (ret)
+                break;
+            msg_put_u32(&m, DLC_A_TXN, txn);
+        }
+        if (ret)
+            goto abort;
+        count++;
+        total++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = flush(nl, &m, &count);
+    if (!ret && !single && total)
+        ret = send_txn(nl, txn, DLC_CMD_COMMIT);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (!ret)
+        fprintf(stderr, "dlc_bulk: %zu instances, %s %.3f ms\n", total,
+                single ? "set" : "last prepare + commit",
+                (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    free(m.buf);
+    return ret;
+
+abort:
+    /* the module already dropped the transaction if it reported the error */
+    if (!single)
+        send_txn(nl, txn, DLC_CMD_ABORT);
+    free(m.buf);
+    return ret;
+}
+
+static int get_cb(const void *attrs, int len, void *arg)
+{
+    const struct nlattr *ifindex = attr_find(attrs, len, DLC_A_IFINDEX);
+    const struct nlattr *handle = attr_find(attrs, len, DLC_A_HANDLE);
+    const struct nlattr *opts = attr_find(attrs, len, DLC_A_OPTIONS);
+    const struct nlattr *pending = attr_find(attrs, len, DLC_A_PENDING_TXN);
+    const struct nlattr *a;
+    const struct tc_dlc_qopt *qopt;
+    char ifname[IF_NAMESIZE] = "?";
+    uint32_t h;
+    int olen;
+
+    (void)arg;
+    if (!ifindex || !handle || !opts || opts->nla_len < NLA_HDRLEN + sizeof(*qopt))
+        return 0;
+    qopt = attr_data(opts);
+    olen = opts->nla_len - NLA_HDRLEN - NLA_ALIGN(sizeof(*qopt));
+    h = *(const uint32_t *)attr_data(handle);
+    if_indextoname(*(const uint32_t *)attr_data(ifindex), ifname);
+
+    printf("%s %x:", ifname, h >> 16);
+    a = attr_find((const char *)qopt + NLA_ALIGN(sizeof(*qopt)), olen, TCA_DLC_LATENCY64);
+    if (a)
+        printf(" -d %g", *(const int64_t *)attr_data(a) / 1e6);
+    a = attr_find((const char *)qopt + NLA_ALIGN(sizeof(*qopt)), olen, TCA_DLC_JITTER64);
+    if (a)
+        printf(" -j %g", *(const int64_t *)attr_data(a) / 1e6);
+    printf(" -n %u -r %g -l %g -u %g -b %u -g %u -L %u",
+           qopt->jitter_steps, qopt->mm1_rho * 100.0 / DLC_PROB_SCALE,
+           qopt->loss * 100.0 / DLC_PROB_SCALE, qopt->mu * 100.0 / DLC_PROB_SCALE,
+           qopt->mean_burst_len, qopt->mean_good_burst_len, qopt->limit);
+    if (pending)
+        printf("  # staged by transaction %u", *(const uint32_t *)attr_data(pending));
+    printf("\n");
+    return 0;
+}
+
+static int dump(struct nl *nl)
+{
+    struct msg m;
+    int ret;
+
+    if (msg_init(&m, 64, nl->family, DLC_CMD_GET, NLM_F_DUMP))
+        return -ENOMEM;
+    ret = nl_send(nl, &m);
+    if (!ret)
+        ret = nl_recv(nl, get_cb, NULL);
+    free(m.buf);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-1] [-m bytes] [file | -]\n"
+        "       %s -g\n"
+        "Input lines: dev handle " MODEL_USAGE_SHORT " [-L limit] [-R rate_trace]\n"
+        MODEL_USAGE
+        "  -L limit      packet limit of the qdisc (default %u)\n"
+        "  -R file       capacity trace: \"duration_us rate_kbit\" lines or Mahimahi\n"
+        "                ms timestamps; \"none\" turns it off\n"
+        "options of %s:\n"
+        "  -1            one SET message instead of PREPARE batches and COMMIT\n"
+        "  -m bytes      PREPARE message size (default %u)\n"
+        "  -g            print options of every dlc qdisc, in input format\n",
+        prog, prog, DEFAULT_LIMIT, prog, DEFAULT_MSG_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    size_t msg_size = DEFAULT_MSG_SIZE;
+    int opt, ret, single = 0, get = 0;
+    const char *name = "-";
+    struct nl nl;
+    FILE *in = stdin;
+
+    while ((opt = getopt(argc, argv, "1m:gh")) != -1) {
+        switch (opt) {
+        case '1':
+            single = 1;
+            break;
+        case 'm':
+            msg_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            get = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind > 1 || msg_size < 256 || msg_size > (1 << 30)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ret = nl_open(&nl);
+    if (ret) {
+        fprintf(stderr, "dlc_bulk: generic netlink family \"%s\": %s (module loaded?)\n",
+                DLC_GENL_NAME, strerror(-ret));
+        return 1;
+    }
+    if (get) {
+        ret = dump(&nl);
+    } else {
+        if (optind < argc && strcmp(argv[optind], "-")) {
+            name = argv[optind];
+            in = fopen(name, "r");
+            if (!in) {
+                perror(name);
+                return 1;
+            }
+        }
+        ret = configure(&nl, in, name, msg_size, single);
+        if (in != stdin)
+            fclose(in);
+    }
+    close(nl.fd);
+    return ret ? 1 : 0;
+}
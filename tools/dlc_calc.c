@@ -0,0 +1,610 @@
+/*
+ * dlc_calc - closed-form statistics of a dlc model, and the inverse.
+ *
+ * The model is built by the module's own code (../dlc, linked with the
+ * userspace shim in include/), so transition matrices carry exactly the
+ * integer scaling and truncation of the kernel. Effective probabilities are
+ * read back from the thresholds the per-packet step compares against (fast
+ * path or generic), and the stationary distributions are taken from powers
+ * of the lazy chain, which also covers reducible configurations.
+ *
+ * Output keys and units (seconds) are the ones of dlc_trace, so a measured
+ * trace and a prediction can be compared line by line.
+ *
+ * With -I the tool searches for parameters that hit target statistics
+ * (Nelder-Mead over the parameters not fixed on the command line).
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../dlc/dlc_mod.h"
+#include "model_util.h"
+
+#define NSEC_PER_SEC        1000000000.0
+#define TWO_32              4294967296.0
+#define MAX_SQUARINGS       64
+#define CONVERGED_EPS       1e-14
+
+#define NM_RESTARTS         6
+#define NM_MAX_EVALS        3000
+#define NM_TOL              1e-12
+
+struct calc_params {
+    struct model_params model;
+    double max_delay;       /* s, delay accounted for lost packets, < 0 = model's */
+};
+
+struct calc_stats {
+    double pi[DLC_NUM_STATES];
+    double queue_level;     /* mean M/M/1/K state while in queue state */
+    double loss;
+    double delay;           /* delivered packets, s */
+    double delay_std;
+    double jitter;          /* max deviation from mean delay, as dlc_trace */
+    double mean_burst;
+    double mean_good_burst;
+    double corr;            /* pearson of delay (max_delay if lost) and loss */
+};
+
+enum {
+    T_LOSS,
+    T_DELAY,
+    T_DELAY_STD,
+    T_JITTER,
+    T_MEAN_BURST,
+    T_MEAN_GOOD_BURST,
+    T_CORR,
+    NUM_TARGETS,
+};
+
+static const char *const target_names[NUM_TARGETS] = {
+    "loss", "delay", "delay_std", "jitter", "mean_burst", "mean_good_burst", "corr",
+};
+
+struct calc_targets {
+    double value[NUM_TARGETS];
+    int set[NUM_TARGETS];
+};
+
+static double target_value(const struct calc_stats *st, int t)
+{
+    switch (t) {
+    case T_LOSS:            return st->loss;
+    case T_DELAY:           return st->delay;
+    case T_DELAY_STD:       return st->delay_std;
+    case T_JITTER:          return st->jitter;
+    case T_MEAN_BURST:      return st->mean_burst;
+    case T_MEAN_GOOD_BURST: return st->mean_good_burst;
+    default:                return st->corr;
+    }
+}
+
+/* Transition matrix as sampled by calc_next_state_idx() */
+static void thresh_probs(u32 n, const u32 thresh[][MC_MAX_STATES], const u32 row_last[],
+                         double p[][MC_MAX_STATES])
+{
+    u32 i, j;
+
+    for (i = 0; i < n; i++) {
+        double prev = 0;
+
+        for (j = 0; j < n; j++)
+            p[i][j] = 0;
+        for (j = 0; j < row_last[i]; j++) {
+            p[i][j] = (thresh[i][j] - prev) / TWO_32;
+            prev = thresh[i][j];
+        }
+        p[i][row_last[i]] = (TWO_32 - prev) / TWO_32;
+    }
+}
+
+/* Same, as sampled by dlc_fast_step() */
+static void fast_probs(const struct dlc_fast_model *f, u32 queue_states,
+                       double main[][MC_MAX_STATES], double queue[][MC_MAX_STATES])
+{
+    u32 i;
+
+    memset(main, 0, sizeof(double[MC_MAX_STATES]) * DLC_NUM_STATES);
+    for (i = 0; i < DLC_NUM_STATES; i++) {
+        main[i][f->base[i]] += f->lo[i] / TWO_32;
+        if (f->base[i] + 1 < DLC_NUM_STATES)
+            main[i][f->base[i] + 1] += (f->hi[i] - f->lo[i]) / TWO_32;
+        if (f->base[i] + 2 < DLC_NUM_STATES)
+            main[i][f->base[i] + 2] += (TWO_32 - f->hi[i]) / TWO_32;
+    }
+
+    memset(queue, 0, sizeof(double[MC_MAX_STATES]) * queue_states);
+    for (i = 0; i < queue_states; i++) {
+        double down = f->queue_down / TWO_32;
+
+        queue[i][i ? i - 1 : 0] += down;
+        queue[i][i < f->queue_top ? i + 1 : i] += 1 - down;
+    }
+}
+
+/*
+ * Long-run distribution from the initial one: rows of (I + P)^(2^k) / 2^k
+ * weighted by init (2^32-scaled, as in the chain).
+ * The lazy chain is aperiodic, and squaring reaches 2^64 steps at most,
+ * so slowly mixing chains converge too.
+ */
+static void stationary(u32 n, double p[][MC_MAX_STATES], const u32 *init, double *pi)
+{
+    static double a[MC_MAX_STATES][MC_MAX_STATES], b[MC_MAX_STATES][MC_MAX_STATES];
+    double total = 0;
+    u32 i, j, k, s;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < n; j++)
+            a[i][j] = (p[i][j] + (i == j)) / 2;
+
+    for (s = 0; s < MAX_SQUARINGS; s++) {
+        double diff = 0;
+
+        for (i = 0; i < n; i++) {
+            double sum = 0;
+
+            for (j = 0; j < n; j++) {
+                double v = 0;
+
+                for (k = 0; k < n; k++)
+                    v += a[i][k] * a[k][j];
+                b[i][j] = v;
+                sum += v;
+            }
+            /* rounding error would grow with every squaring otherwise */
+            for (j = 0; j < n; j++) {
+                b[i][j] /= sum;
+                diff = fmax(diff, fabs(b[i][j] - a[i][j]));
+            }
+        }
+        memcpy(a, b, sizeof(a));
+        if (diff < CONVERGED_EPS)
+            break;
+    }
+    /* reducible chains: averaged over the initial state distribution */
+    for (i = 0; i < n; i++)
+        total += init[i];
+    for (j = 0; j < n; j++) {
+        pi[j] = 0;
+        for (i = 0; i < n; i++)
+            pi[j] += init[i] / total * a[i][j];
+    }
+}
+
+/* delivered-packet delay moments in a simple state, ns */
+static void simple_moments(const struct dlc_simple_state *s, double *mean, double *sq,
+                           double *lo, double *hi)
+{
+    u32 i, n;
+
+    if (s->delay_table) {
+        n = s->delay_table_size;
+        *mean = *sq = 0;
+        *lo = *hi = s->delay_table[0];
+        for (i = 0; i < n; i++) {
+            double d = s->delay_table[i];
+
+            *mean += d / n;
+            *sq += d * d / n;
+            *lo = fmin(*lo, d);
+            *hi = fmax(*hi, d);
+        }
+        return;
+    }
+    if (!s->jitter) {
+        *mean = *lo = *hi = s->delay_mean;
+        *sq = *mean * *mean;
+        return;
+    }
+    /* tabledist() without table: mu - sigma + [0, 2 sigma) integer uniform */
+    *lo = s->delay_mean - s->jitter;
+    *hi = s->delay_mean + s->jitter - 1;
+    *mean = s->delay_mean - 0.5;
+    *sq = *mean * *mean + (4.0 * s->jitter * s->jitter - 1) / 12;
+}
+
+static int calc_stats(const struct calc_params *cp, struct calc_stats *st)
+{
+    static double pm[MC_MAX_STATES][MC_MAX_STATES], pq[MC_MAX_STATES][MC_MAX_STATES];
+    double piq[MC_MAX_STATES];
+    const struct markov_chain_const *mm1k;
+    struct dlc_mod_data m;
+    double s_mean, s_sq, q_mean = 0, q_sq = 0, lo, hi, q_lo = INFINITY, q_hi = -INFINITY;
+    double delivered, mean, sq, md, ex, exx, cov, vx, vy, stay;
+    u32 i, nq;
+    int ret;
+
+    memset(&m, 0, sizeof(m));
+    ret = model_build(&m, &cp->model);
+    if (ret)
+        return ret;
+
+    mm1k = &m.main_chain.states[DLC_IDX_QUEUE].queue.mm1k_chain;
+    nq = mm1k->num_states;
+    if (m.use_fast) {
+        fast_probs(&m.fast, nq, pm, pq);
+    } else {
+        thresh_probs(m.main_chain.num_states, m.main_chain.transition_thresh,
+                     m.main_chain.row_last, pm);
+        thresh_probs(nq, mm1k->transition_thresh, mm1k->row_last, pq);
+    }
+    stationary(DLC_NUM_STATES, pm, m.main_chain.init_distribution, st->pi);
+    /* M/M/1/K chain steps once per packet in queue state */
+    stationary(nq, pq, mm1k->init_distribution, piq);
+
+    st->queue_level = 0;
+    for (i = 0; i < nq; i++) {
+        double d = mm1k->states[i].delay;
+
+        st->queue_level += i * piq[i];
+        q_mean += d * piq[i];
+        q_sq += d * d * piq[i];
+        if (piq[i] > CONVERGED_EPS) {
+            q_lo = fmin(q_lo, d);
+            q_hi = fmax(q_hi, d);
+        }
+    }
+    simple_moments(&m.main_chain.states[DLC_IDX_SIMPLE].simple, &s_mean, &s_sq, &lo, &hi);
+
+    st->loss = st->pi[DLC_IDX_LOSS];
+    delivered = st->pi[DLC_IDX_SIMPLE] + st->pi[DLC_IDX_QUEUE];
+    mean = sq = 0;
+    if (delivered > 0) {
+        mean = (st->pi[DLC_IDX_SIMPLE] * s_mean + st->pi[DLC_IDX_QUEUE] * q_mean) / delivered;
+        sq = (st->pi[DLC_IDX_SIMPLE] * s_sq + st->pi[DLC_IDX_QUEUE] * q_sq) / delivered;
+    }
+    if (st->pi[DLC_IDX_SIMPLE] <= CONVERGED_EPS) {
+        lo = q_lo;
+        hi = q_hi;
+    } else if (st->pi[DLC_IDX_QUEUE] > CONVERGED_EPS) {
+        lo = fmin(lo, q_lo);
+        hi = fmax(hi, q_hi);
+    }
+    st->delay = mean / NSEC_PER_SEC;
+    st->delay_std = sqrt(fmax(sq - mean * mean, 0)) / NSEC_PER_SEC;
+    st->jitter = delivered > 0 ? fmax(hi - mean, mean - lo) / NSEC_PER_SEC : 0;
+
+    /* loss runs are sojourns in loss state */
+    stay = pm[DLC_IDX_LOSS][DLC_IDX_LOSS];
+    st->mean_burst = stay < 1 ? 1 / (1 - stay) : INFINITY;
+    st->mean_good_burst = st->loss > 0 && stay < 1 ?
+                          (1 - st->loss) / (st->loss * (1 - stay)) : INFINITY;
+
+    md = cp->max_delay >= 0 ? cp->max_delay : m.main_chain.states[DLC_IDX_LOSS].loss.max_delay / NSEC_PER_SEC;
+    ex = (1 - st->loss) * st->delay + st->loss * md;
+    exx = (1 - st->loss) * sq / NSEC_PER_SEC / NSEC_PER_SEC + st->loss * md * md;
+    cov = st->loss * md - ex * st->loss;
+    vx = exx - ex * ex;
+    vy = st->loss * (1 - st->loss);
+    st->corr = vx > 0 && vy > 0 ? cov / sqrt(vx * vy) : 0;
+
+    dlc_mod_destroy(&m);
+    return 0;
+}
+
+static void print_stats(const struct calc_stats *st)
+{
+    printf("loss %.9f\n", st->loss);
+    printf("delay %.9f\n", st->delay);
+    printf("delay_std %.9f\n", st->delay_std);
+    printf("jitter %.9f\n", st->jitter);
+    printf("mean_burst %.6f\n", st->mean_burst);
+    printf("mean_good_burst %.6f\n", st->mean_good_burst);
+    printf("corr %.6f\n", st->corr);
+    printf("stationary %.9f %.9f %.9f\n", st->pi[DLC_IDX_SIMPLE], st->pi[DLC_IDX_QUEUE], st->pi[DLC_IDX_LOSS]);
+    printf("queue_level %.6f\n", st->queue_level);
+}
+
+static void print_params(const struct calc_params *cp)
+{
+    printf("params -d %.6f -j %.6f -n %u -r %.5f -l %.5f -u %.5f -b %.0f -g %.0f\n",
+           cp->model.p[P_DELAY], cp->model.p[P_JITTER], cp->model.jitter_steps, cp->model.p[P_RHO],
+           cp->model.p[P_LOSS], cp->model.p[P_MU], round(cp->model.p[P_BURST]), round(cp->model.p[P_GOOD_BURST]));
+}
+
+/*
+ * Inverse. Free parameters are mapped to an unconstrained space, so the
+ * simplex never leaves the valid range: percentages go through a logistic,
+ * positive values through exp.
+ */
+struct solver {
+    struct calc_params base;
+    const struct calc_targets *targets;
+    int free_idx[NUM_PARAMS];
+    int nfree;
+    int evals;
+};
+
+static double logistic(double x)
+{
+    return 1 / (1 + exp(-x));
+}
+
+static double logit(double p)
+{
+    p = fmin(fmax(p, 1e-9), 1 - 1e-9);
+    return log(p / (1 - p));
+}
+
+static double to_param(int idx, double x)
+{
+    switch (idx) {
+    case P_LOSS:
+    case P_MU:
+        return 100 * logistic(x);
+    case P_BURST:
+    case P_GOOD_BURST:
+        return 1 + exp(x);
+    default:
+        return exp(x);
+    }
+}
+
+static double from_param(int idx, double v)
+{
+    switch (idx) {
+    case P_LOSS:
+    case P_MU:
+        return logit(v / 100);
+    case P_BURST:
+    case P_GOOD_BURST:
+        return log(fmax(v - 1, 1e-3));
+    default:
+        return log(fmax(v, 1e-6));
+    }
+}
+
+static void solver_params(const struct solver *s, const double *x, struct calc_params *cp)
+{
+    int i;
+
+    *cp = s->base;
+    for (i = 0; i < s->nfree; i++)
+        cp->model.p[s->free_idx[i]] = to_param(s->free_idx[i], x[i]);
+}
+
+/* relative squared error, corr is already normalized */
+static double solver_cost(struct solver *s, const double *x)
+{
+    struct calc_params cp;
+    struct calc_stats st;
+    double cost = 0;
+    int t;
+
+    s->evals++;
+    solver_params(s, x, &cp);
+    if (calc_stats(&cp, &st))
+        return HUGE_VAL;
+    for (t = 0; t < NUM_TARGETS; t++) {
+        double v, scale;
+
+        if (!s->targets->set[t])
+            continue;
+        v = target_value(&st, t);
+        if (!isfinite(v))
+            return HUGE_VAL;
+        scale = t == T_CORR || s->targets->value[t] == 0 ? 1 : s->targets->value[t];
+        cost += (v - s->targets->value[t]) * (v - s->targets->value[t]) / (scale * scale);
+    }
+    return cost;
+}
+
+static double nelder_mead(struct solver *s, double *x0)
+{
+    double x[NUM_PARAMS + 1][NUM_PARAMS], f[NUM_PARAMS + 1];
+    double c[NUM_PARAMS], xr[NUM_PARAMS], xe[NUM_PARAMS];
+    int n = s->nfree, i, j, best, worst, second, evals = 0;
+
+    for (i = 0; i <= n; i++) {
+        memcpy(x[i], x0, sizeof(double) * n);
+        if (i)
+            x[i][i - 1] += 0.5;
+        f[i] = solver_cost(s, x[i]);
+    }
+
+    while (evals++ < NM_MAX_EVALS) {
+        double fr;
+
+        best = worst = 0;
+        for (i = 1; i <= n; i++) {
+            if (f[i] < f[best])
+                best = i;
+            if (f[i] > f[worst])
+                worst = i;
+        }
+        second = best;
+        for (i = 0; i <= n; i++)
+            if (i != worst && f[i] > f[second])
+                second = i;
+        if (f[worst] - f[best] < NM_TOL * (fabs(f[best]) + NM_TOL))
+            break;
+
+        for (j = 0; j < n; j++) {
+            c[j] = 0;
+            for (i = 0; i <= n; i++)
+                if (i != worst)
+                    c[j] += x[i][j] / n;
+        }
+        for (j = 0; j < n; j++)
+            xr[j] = c[j] + (c[j] - x[worst][j]);
+        fr = solver_cost(s, xr);
+
+        if (fr < f[best]) {
+            double fe;
+
+            for (j = 0; j < n; j++)
+                xe[j] = c[j] + 2 * (c[j] - x[worst][j]);
+            fe = solver_cost(s, xe);
+            if (fe < fr) {
+                memcpy(x[worst], xe, sizeof(double) * n);
+                f[worst] = fe;
+            } else {
+                memcpy(x[worst], xr, sizeof(double) * n);
+                f[worst] = fr;
+            }
+        } else if (fr < f[second]) {
+            memcpy(x[worst], xr, sizeof(double) * n);
+            f[worst] = fr;
+        } else {
+            double fc;
+
+            for (j = 0; j < n; j++)
+                xr[j] = c[j] + 0.5 * (x[worst][j] - c[j]);
+            fc = solver_cost(s, xr);
+            if (fc < f[worst]) {
+                memcpy(x[worst], xr, sizeof(double) * n);
+                f[worst] = fc;
+            } else {
+                /* shrink towards best */
+                for (i = 0; i <= n; i++) {
+                    if (i == best)
+                        continue;
+                    for (j = 0; j < n; j++)
+                        x[i][j] = x[best][j] + 0.5 * (x[i][j] - x[best][j]);
+                    f[i] = solver_cost(s, x[i]);
+                }
+            }
+        }
+    }
+
+    best = 0;
+    for (i = 1; i <= n; i++)
+        if (f[i] < f[best])
+            best = i;
+    memcpy(x0, x[best], sizeof(double) * n);
+    return f[best];
+}
+
+static int solve(struct calc_params *cp, const int *fixed, const struct calc_targets *targets)
+{
+    struct solver s = { .base = *cp, .targets = targets };
+    double x[NUM_PARAMS], cost = HUGE_VAL;
+    int i, r;
+
+    for (i = 0; i < NUM_PARAMS; i++)
+        if (!fixed[i])
+            s.free_idx[s.nfree++] = i;
+    if (!s.nfree) {
+        fprintf(stderr, "dlc_calc: all parameters are fixed, nothing to solve\n");
+        return -1;
+    }
+    for (i = 0; i < s.nfree; i++)
+        x[i] = from_param(s.free_idx[i], cp->model.p[s.free_idx[i]]);
+
+    /* restarts rebuild the simplex around the best point found so far */
+    for (r = 0; r < NM_RESTARTS; r++) {
+        double c = nelder_mead(&s, x);
+
+        if (c >= cost * (1 - 1e-9))
+            break;
+        cost = c;
+    }
+    solver_params(&s, x, cp);
+    /* integer parameters as the kernel will see them */
+    cp->model.p[P_BURST] = round(cp->model.p[P_BURST]);
+    cp->model.p[P_GOOD_BURST] = round(cp->model.p[P_GOOD_BURST]);
+    printf("cost %.9g\n", solver_cost(&s, x));
+    printf("evals %d\n", s.evals);
+    return 0;
+}
+
+static int parse_targets(char *arg, struct calc_targets *targets)
+{
+    char *tok, *save = NULL;
+    int t;
+
+    for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+
+        if (!eq)
+            return -1;
+        *eq = '\0';
+        for (t = 0; t < NUM_TARGETS; t++)
+            if (!strcmp(tok, target_names[t]))
+                break;
+        if (t == NUM_TARGETS)
+            return -1;
+        targets->value[t] = atof(eq + 1);
+        targets->set[t] = 1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    int t;
+
+    fprintf(stderr,
+        "Usage: %s " MODEL_USAGE_SHORT " [-m max_delay]\n"
+        "          [-I target=value,...] [-v]\n"
+        MODEL_USAGE
+        "  -m max_delay  delay in seconds accounted for lost packets in corr\n"
+        "                (default: delay of the loss state)\n"
+        "  -I targets    find parameters hitting the targets; parameters given with\n"
+        "                options stay fixed. Targets:",
+        prog);
+    for (t = 0; t < NUM_TARGETS; t++)
+        fprintf(stderr, " %s", target_names[t]);
+    fprintf(stderr, "\n  -v            model init messages to stderr\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct calc_params cp = {
+        .max_delay = -1,
+    };
+    struct calc_targets targets = { 0 };
+    int fixed[NUM_PARAMS] = { 0 };
+    int opt, inverse = 0, ret;
+    struct calc_stats st;
+
+    model_params_init(&cp.model);
+    while ((opt = getopt(argc, argv, MODEL_OPTSTRING "m:I:vh")) != -1) {
+        ret = model_params_opt(&cp.model, opt, optarg);
+        if (ret == MODEL_OPT_ERROR)
+            return 1;
+        if (ret < NUM_PARAMS)
+            fixed[ret] = 1;
+        if (ret != MODEL_OPT_NONE)
+            continue;
+        switch (opt) {
+        case 'm':
+            cp.max_delay = atof(optarg);
+            break;
+        case 'I':
+            if (parse_targets(optarg, &targets)) {
+                usage(argv[0]);
+                return 2;
+            }
+            inverse = 1;
+            break;
+        case 'v':
+            dlc_tools_verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (inverse && solve(&cp, fixed, &targets))
+        return 1;
+    ret = calc_stats(&cp, &st);
+    if (ret) {
+        fprintf(stderr, "dlc_calc: invalid model parameters (%d)\n", ret);
+        return 1;
+    }
+    print_params(&cp);
+    print_stats(&st);
+    free(cp.model.dist);
+    return 0;
+}
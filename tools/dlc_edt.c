@@ -0,0 +1,508 @@
+/*
+ * dlc_edt - dlc model as a tc BPF program, paced by fq (earliest departure time).
+ *
+ * No qdisc of ours on the way: a program on the tcx (clsact) hook of the
+ * device runs the fast step of the model per packet and either drops the
+ * packet or stamps skb->tstamp with its departure time; an fq root qdisc then
+ * holds the packet until that time. Nothing is locked, chain state lives in a
+ * per-CPU map, so every CPU runs its own chain, like one dlc instance per
+ * queue under mq.
+ *
+ * The model is built in userspace by the module's own code (../dlc) from the
+ * same parameters tc passes in tc_dlc_qopt, and the fused thresholds of
+ * struct dlc_fast_model are copied into a map:
+ *   model  - array[1] of struct edt_model (thresholds, queue walk, jitter)
+ *   state  - per-CPU array[1] of struct edt_state (chain states, counters)
+ *   delays - array of s64 ns: M/M/1/K state delays, then the simple state
+ *            delay table (if the model has one)
+ * Randomness is bpf_get_prandom_u32(), so runs are not reproducible.
+ *
+ * The program is assembled in place (bpf_raw.h), no BPF toolchain is needed.
+ * On ingress nothing paces the packet, so the program only drops there.
+ *
+ * Kernel >= 6.6 (tcx links).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bpf_raw.h"
+#include "model_util.h"
+
+/* tcx uapi, missing from older headers */
+#define EDT_TCX_INGRESS     46      /* BPF_TCX_INGRESS */
+#define EDT_TCX_EGRESS      47      /* BPF_TCX_EGRESS */
+#define EDT_TCX_NEXT        (-1)    /* TCX_NEXT */
+#define EDT_TCX_DROP        2       /* TCX_DROP */
+
+#define MAX_INSNS           128
+#define NSEC_PER_SEC        1000000000ULL
+
+/* one row of the fused main chain, see struct dlc_fast_model */
+struct edt_row {
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t base;
+    uint32_t pad;
+};
+
+struct edt_model {
+    struct edt_row rows[DLC_NUM_STATES];
+    uint64_t queue_down;
+    uint32_t queue_top;
+    uint32_t has_table;         /* simple state delays from the table */
+    uint32_t simple_size;
+    uint32_t simple_span;       /* uniform jitter: 2 * jitter, 0 = none */
+    int64_t simple_base;        /* uniform jitter: delay - jitter */
+};
+
+struct edt_state {
+    uint32_t main_state;
+    uint32_t queue_state;
+    uint64_t packets;
+    uint64_t lost;
+};
+
+struct edt {
+    int ifindex;
+    int ingress;
+    int ncpus;
+    int model_fd;
+    int state_fd;
+    int delays_fd;
+    int prog_fd;
+    int link_fd;
+    struct dlc_mod_data model;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* model maps from the fast path parameters of the built model */
+static int edt_fill_maps(struct edt *e)
+{
+    const struct dlc_fast_model *f = &e->model.fast;
+    struct dlc_mod_runtime rt;
+    struct edt_model em;
+    struct edt_state *st;
+    uint32_t key, ndelays, i;
+    int ret = 0;
+
+    memset(&em, 0, sizeof(em));
+    for (i = 0; i < DLC_NUM_STATES; i++) {
+        em.rows[i].lo = f->lo[i];
+        em.rows[i].hi = f->hi[i];
+        em.rows[i].base = f->base[i];
+    }
+    em.queue_down = f->queue_down;
+    em.queue_top = f->queue_top;
+    if (f->simple_table) {
+        em.has_table = 1;
+        em.simple_size = f->simple_size;
+    } else if ((int32_t)f->simple_jitter) {
+        /* tabledist() without a table */
+        em.simple_span = 2 * (uint32_t)(int32_t)f->simple_jitter;
+        em.simple_base = f->simple_delay - (int32_t)f->simple_jitter;
+    } else {
+        em.simple_base = f->simple_delay;
+    }
+
+    ndelays = f->queue_top + 1 + (f->simple_table ? f->simple_size : 0);
+    e->model_fd = bpf_raw_map_create(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(em), 1);
+    e->state_fd = bpf_raw_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(key), sizeof(*st), 1);
+    e->delays_fd = bpf_raw_map_create(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(int64_t), ndelays);
+    if (e->model_fd < 0 || e->state_fd < 0 || e->delays_fd < 0)
+        return -errno;
+
+    key = 0;
+    if (bpf_raw_map_update(e->model_fd, &key, &em))
+        return -errno;
+    for (key = 0; key <= f->queue_top; key++)
+        if (bpf_raw_map_update(e->delays_fd, &key, &f->queue_states[key].delay))
+            return -errno;
+    if (f->simple_table)
+        for (i = 0; i < f->simple_size; i++, key++)
+            if (bpf_raw_map_update(e->delays_fd, &key, &f->simple_table[i]))
+                return -errno;
+
+    /* every CPU starts from the initial states of the model */
+    dlc_mod_runtime_init(&rt, &e->model);
+    st = calloc(e->ncpus, sizeof(*st));
+    if (!st)
+        return -ENOMEM;
+    for (i = 0; i < (uint32_t)e->ncpus; i++) {
+        st[i].main_state = rt.main_state;
+        st[i].queue_state = rt.queue_state;
+    }
+    key = 0;
+    if (bpf_raw_map_update(e->state_fd, &key, st))
+        ret = -errno;
+    free(st);
+    return ret;
+}
+
+
+enum {
+    L_PASS,
+    L_QUEUE,
+    L_QUEUE_UP,
+    L_QUEUE_STORE,
+    L_SIMPLE,
+    L_UNIFORM,
+    L_LOOKUP,
+    L_DELAY,
+    L_TSTAMP_SET,
+    NUM_LABELS,
+};
+
+/* instructions with jumps to labels, offsets resolved by asm_finish() */
+struct edt_asm {
+    struct bpf_insn insns[MAX_INSNS];
+    int n;
+    int label[NUM_LABELS];
+    int fixup_at[MAX_INSNS];
+    int fixup_label[MAX_INSNS];
+    int nfixup;
+};
+
+static void emit(struct edt_asm *a, struct bpf_insn insn)
+{
+    a->insns[a->n++] = insn;
+}
+
+static void emit_jmp(struct edt_asm *a, struct bpf_insn insn, int label)
+{
+    a->fixup_at[a->nfixup] = a->n;
+    a->fixup_label[a->nfixup] = label;
+    a->nfixup++;
+    emit(a, insn);
+}
+
+static void set_label(struct edt_asm *a, int label)
+{
+    a->label[label] = a->n;
+}
+
+static void asm_finish(struct edt_asm *a)
+{
+    int i;
+
+    for (i = 0; i < a->nfixup; i++)
+        a->insns[a->fixup_at[i]].off = a->label[a->fixup_label[i]] - a->fixup_at[i] - 1;
+}
+
+/* r0 = lookup(map, u32 key at fp + key_off), to `fail` if there is none */
+static void emit_lookup(struct edt_asm *a, int map_fd, int key_off, int fail)
+{
+    struct bpf_insn ld_map[] = { BPF_LD_MAP_FD(BPF_REG_1, map_fd) };
+
+    emit(a, BPF_MOV64_REG(BPF_REG_2, BPF_REG_10));
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, key_off));
+    emit(a, ld_map[0]);
+    emit(a, ld_map[1]);
+    emit(a, BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem));
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 0), fail);
+}
+
+/* *(u64 *)(r8 + off) += 1, per-CPU value */
+static void emit_count(struct edt_asm *a, int off)
+{
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_8, off));
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, 1));
+    emit(a, BPF_STX_MEM(BPF_DW, BPF_REG_8, BPF_REG_1, off));
+}
+
+/*
+ * dlc_fast_step() per packet. Registers kept across helper calls:
+ *   r6 skb, r7 model, r8 per-CPU state, r9 random of the main chain, then delay
+ */
+static void edt_assemble(struct edt_asm *a, const struct edt *e)
+{
+    emit(a, BPF_MOV64_REG(BPF_REG_6, BPF_REG_1));
+    emit(a, BPF_ST_MEM(BPF_W, BPF_REG_10, -4, 0));
+    emit_lookup(a, e->model_fd, -4, L_PASS);
+    emit(a, BPF_MOV64_REG(BPF_REG_7, BPF_REG_0));
+    emit_lookup(a, e->state_fd, -4, L_PASS);
+    emit(a, BPF_MOV64_REG(BPF_REG_8, BPF_REG_0));
+    emit_count(a, offsetof(struct edt_state, packets));
+
+    /* curr = base[curr] + (rnd >= lo[curr]) + (rnd >= hi[curr]) */
+    emit(a, BPF_CALL_FUNC(BPF_FUNC_get_prandom_u32));
+    emit(a, BPF_MOV64_REG(BPF_REG_9, BPF_REG_0));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_8, offsetof(struct edt_state, main_state)));
+    emit(a, BPF_JMP_IMM(BPF_JLT, BPF_REG_1, DLC_NUM_STATES, 1));
+    emit(a, BPF_MOV64_IMM(BPF_REG_1, 0));
+    emit(a, BPF_ALU64_IMM(BPF_MUL, BPF_REG_1, sizeof(struct edt_row)));
+    emit(a, BPF_MOV64_REG(BPF_REG_2, BPF_REG_7));
+    emit(a, BPF_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_1));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_2, offsetof(struct edt_row, base)));
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_4, BPF_REG_2, offsetof(struct edt_row, lo)));
+    emit(a, BPF_JMP_REG(BPF_JLT, BPF_REG_9, BPF_REG_4, 1));
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, 1));
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_4, BPF_REG_2, offsetof(struct edt_row, hi)));
+    emit(a, BPF_JMP_REG(BPF_JLT, BPF_REG_9, BPF_REG_4, 1));
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, 1));
+    emit(a, BPF_STX_MEM(BPF_W, BPF_REG_8, BPF_REG_3, offsetof(struct edt_state, main_state)));
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_3, DLC_IDX_QUEUE, 0), L_QUEUE);
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_3, DLC_IDX_SIMPLE, 0), L_SIMPLE);
+
+    /* LOSS */
+    emit_count(a, offsetof(struct edt_state, lost));
+    emit(a, BPF_MOV64_IMM(BPF_REG_0, EDT_TCX_DROP));
+    emit(a, BPF_EXIT_INSN());
+
+    /* QUEUE: birth-death walk of the M/M/1/K chain, delay of its state */
+    set_label(a, L_QUEUE);
+    emit(a, BPF_CALL_FUNC(BPF_FUNC_get_prandom_u32));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_8, offsetof(struct edt_state, queue_state)));
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_2, BPF_REG_7, offsetof(struct edt_model, queue_down)));
+    emit_jmp(a, BPF_JMP_REG(BPF_JGE, BPF_REG_0, BPF_REG_2, 0), L_QUEUE_UP);
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_1, 0, 0), L_QUEUE_STORE);
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, -1));
+    emit_jmp(a, BPF_JMP_A(0), L_QUEUE_STORE);
+    set_label(a, L_QUEUE_UP);
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7, offsetof(struct edt_model, queue_top)));
+    emit_jmp(a, BPF_JMP_REG(BPF_JGE, BPF_REG_1, BPF_REG_2, 0), L_QUEUE_STORE);
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, 1));
+    set_label(a, L_QUEUE_STORE);
+    emit(a, BPF_STX_MEM(BPF_W, BPF_REG_8, BPF_REG_1, offsetof(struct edt_state, queue_state)));
+    emit(a, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_1, -8));
+    emit_jmp(a, BPF_JMP_A(0), L_LOOKUP);
+
+    /* SIMPLE: delay table entry, or tabledist() uniform jitter */
+    set_label(a, L_SIMPLE);
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct edt_model, has_table)));
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_1, 0, 0), L_UNIFORM);
+    emit(a, BPF_CALL_FUNC(BPF_FUNC_get_prandom_u32));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct edt_model, simple_size)));
+    emit(a, BPF_ALU64_REG(BPF_MUL, BPF_REG_0, BPF_REG_1));
+    emit(a, BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct edt_model, queue_top)));
+    emit(a, BPF_ALU64_REG(BPF_ADD, BPF_REG_0, BPF_REG_1));
+    emit(a, BPF_ALU64_IMM(BPF_ADD, BPF_REG_0, 1));
+    emit(a, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_0, -8));
+    emit_jmp(a, BPF_JMP_A(0), L_LOOKUP);
+
+    /* base + reciprocal_scale(rnd, span) */
+    set_label(a, L_UNIFORM);
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_9, BPF_REG_7, offsetof(struct edt_model, simple_base)));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct edt_model, simple_span)));
+    emit_jmp(a, BPF_JMP_IMM(BPF_JEQ, BPF_REG_1, 0, 0), L_DELAY);
+    emit(a, BPF_CALL_FUNC(BPF_FUNC_get_prandom_u32));
+    emit(a, BPF_LDX_MEM(BPF_W, BPF_REG_1, BPF_REG_7, offsetof(struct edt_model, simple_span)));
+    emit(a, BPF_ALU64_REG(BPF_MUL, BPF_REG_0, BPF_REG_1));
+    emit(a, BPF_ALU64_IMM(BPF_RSH, BPF_REG_0, 32));
+    emit(a, BPF_ALU64_REG(BPF_ADD, BPF_REG_9, BPF_REG_0));
+    emit_jmp(a, BPF_JMP_A(0), L_DELAY);
+
+    set_label(a, L_LOOKUP);
+    emit_lookup(a, e->delays_fd, -8, L_PASS);
+    emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_9, BPF_REG_0, 0));
+
+    /*
+     * Departure time: delay on top of an earlier EDT of the packet (TCP
+     * pacing), or on top of now. Ingress has nothing to pace with.
+     */
+    set_label(a, L_DELAY);
+    if (!e->ingress) {
+        emit(a, BPF_JMP_IMM(BPF_JSGE, BPF_REG_9, 0, 1));
+        emit(a, BPF_MOV64_IMM(BPF_REG_9, 0));
+        emit(a, BPF_CALL_FUNC(BPF_FUNC_ktime_get_ns));
+        emit(a, BPF_LDX_MEM(BPF_B, BPF_REG_1, BPF_REG_6, offsetof(struct __sk_buff, tstamp_type)));
+        emit_jmp(a, BPF_JMP_IMM(BPF_JNE, BPF_REG_1, BPF_SKB_TSTAMP_DELIVERY_MONO, 0), L_TSTAMP_SET);
+        emit(a, BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_6, offsetof(struct __sk_buff, tstamp)));
+        emit_jmp(a, BPF_JMP_REG(BPF_JLE, BPF_REG_1, BPF_REG_0, 0), L_TSTAMP_SET);
+        emit(a, BPF_MOV64_REG(BPF_REG_0, BPF_REG_1));
+        set_label(a, L_TSTAMP_SET);
+        emit(a, BPF_MOV64_REG(BPF_REG_2, BPF_REG_0));
+        emit(a, BPF_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_9));
+        emit(a, BPF_MOV64_REG(BPF_REG_1, BPF_REG_6));
+        emit(a, BPF_MOV64_IMM(BPF_REG_3, BPF_SKB_TSTAMP_DELIVERY_MONO));
+        emit(a, BPF_CALL_FUNC(BPF_FUNC_skb_set_tstamp));
+    }
+
+    set_label(a, L_PASS);
+    emit(a, BPF_MOV64_IMM(BPF_REG_0, EDT_TCX_NEXT));
+    emit(a, BPF_EXIT_INSN());
+
+    asm_finish(a);
+}
+
+static int edt_init(struct edt *e, const struct model_params *mp, const char *ifname)
+{
+    struct edt_asm *a;
+    int ret;
+
+    e->ifindex = if_nametoindex(ifname);
+    if (!e->ifindex) {
+        fprintf(stderr, "dlc_edt: %s: %s\n", ifname, strerror(errno));
+        return -errno;
+    }
+    e->ncpus = bpf_raw_num_cpus();
+    if (e->ncpus < 0)
+        return e->ncpus;
+
+    ret = model_build(&e->model, mp);
+    if (ret) {
+        fprintf(stderr, "dlc_edt: invalid model parameters (%d)\n", ret);
+        return ret;
+    }
+    if (!e->model.use_fast) {
+        fprintf(stderr, "dlc_edt: model has no fast path, not supported in BPF\n");
+        return -EOPNOTSUPP;
+    }
+    ret = edt_fill_maps(e);
+    if (ret) {
+        fprintf(stderr, "dlc_edt: maps: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    a = calloc(1, sizeof(*a));
+    if (!a)
+        return -ENOMEM;
+    edt_assemble(a, e);
+    e->prog_fd = bpf_raw_prog_load(BPF_PROG_TYPE_SCHED_CLS, 0, a->insns, a->n);
+    ret = e->prog_fd < 0 ? -errno : 0;
+    free(a);
+    if (ret) {
+        fprintf(stderr, "dlc_edt: program load: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    e->link_fd = bpf_raw_link_create(e->prog_fd, e->ifindex,
+                                     e->ingress ? EDT_TCX_INGRESS : EDT_TCX_EGRESS, 0);
+    if (e->link_fd < 0) {
+        ret = -errno;
+        fprintf(stderr, "dlc_edt: tcx attach on %s: %s\n", ifname, strerror(-ret));
+        return ret;
+    }
+    fprintf(stderr, "dlc_edt: %s %s, %d CPUs%s\n", ifname, e->ingress ? "ingress" : "egress",
+            e->ncpus, e->ingress ? ", loss only" : ", pace with an fq root qdisc");
+    return 0;
+}
+
+static void edt_destroy(struct edt *e)
+{
+    int *fds[] = { &e->link_fd, &e->prog_fd, &e->delays_fd, &e->state_fd, &e->model_fd };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+    dlc_mod_destroy(&e->model);
+}
+
+/* counters summed over CPUs */
+static int edt_read_stats(const struct edt *e, uint64_t *packets, uint64_t *lost)
+{
+    struct edt_state *st = calloc(e->ncpus, sizeof(*st));
+    uint32_t key = 0;
+    int i, ret = 0;
+
+    if (!st)
+        return -ENOMEM;
+    *packets = *lost = 0;
+    if (bpf_raw_map_lookup(e->state_fd, &key, st)) {
+        ret = -errno;
+    } else {
+        for (i = 0; i < e->ncpus; i++) {
+            *packets += st[i].packets;
+            *lost += st[i].lost;
+        }
+    }
+    free(st);
+    return ret;
+}
+
+static void run(const struct edt *e, int rates)
+{
+    uint64_t packets, lost, prev_packets = 0, prev_lost = 0;
+
+    while (!stop) {
+        sleep(1);
+        if (!rates || stop || edt_read_stats(e, &packets, &lost))
+            continue;
+        fprintf(stderr, "%" PRIu64 " pps, lost %" PRIu64 " pps\n", packets - prev_packets, lost - prev_lost);
+        prev_packets = packets;
+        prev_lost = lost;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s " MODEL_USAGE_SHORT "\n"
+        "          [-i] [-s] [-v] dev\n"
+        MODEL_USAGE
+        "  -i            ingress instead of egress (loss only)\n"
+        "  -s            per second rates to stderr\n"
+        "  -v            model init messages to stderr\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct edt e = {
+        .model_fd = -1, .state_fd = -1, .delays_fd = -1, .prog_fd = -1, .link_fd = -1,
+    };
+    struct model_params mp;
+    uint64_t packets, lost;
+    int opt, ret, rates = 0;
+
+    model_params_init(&mp);
+    while ((opt = getopt(argc, argv, MODEL_OPTSTRING "isvh")) != -1) {
+        ret = model_params_opt(&mp, opt, optarg);
+        if (ret == MODEL_OPT_ERROR)
+            return 1;
+        if (ret != MODEL_OPT_NONE)
+            continue;
+        switch (opt) {
+        case 'i':
+            e.ingress = 1;
+            break;
+        case 's':
+            rates = 1;
+            break;
+        case 'v':
+            dlc_tools_verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ret = edt_init(&e, &mp, argv[optind]);
+    if (!ret) {
+        run(&e, rates);
+        if (!edt_read_stats(&e, &packets, &lost))
+            printf("packets %" PRIu64 " lost %" PRIu64 "\n", packets, lost);
+    }
+    edt_destroy(&e);
+    free(mp.dist);
+    return ret ? 1 : 0;
+}
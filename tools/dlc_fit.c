@@ -0,0 +1,776 @@
+/*
+ * dlc_fit - fit dlc model parameters to a measured per-packet delay/loss trace.
+ *
+ * The trace is a text file with one packet per line in sender order, holding
+ * the delay in seconds, or "-" (or any negative value) for a lost packet;
+ * dlc_trace -o writes it.
+ *
+ * The model is fitted as a hidden Markov model with Baum-Welch (EM). The hidden
+ * state is the main chain state (SIMPLE, QUEUE, LOSS) together with the M/M/1/K
+ * level, because the level is kept while the main chain is elsewhere:
+ *   - LOSS emits a loss;
+ *   - SIMPLE emits delay uniform in [delay - step, delay + step), step = jitter / n;
+ *   - QUEUE level i emits delay + i * step.
+ * Measured delays are never exact, so both delivering states are smoothed
+ * by a gaussian noise whose width is fitted too.
+ *
+ * Memory stays bounded for any trace length: the file is split into one chunk
+ * per thread, and every chunk is smoothed in windows of FIT_WINDOW packets,
+ * with FIT_LOOKAHEAD more packets used only for the backward pass. A chunk
+ * starts from the filtered distribution its predecessor ended with in the
+ * previous iteration, so the split costs little accuracy.
+ *
+ * Without -n, jitter_steps is chosen by likelihood after a few iterations on
+ * a prefix of the trace.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <float.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIT_WINDOW          4096
+#define FIT_LOOKAHEAD       256
+#define FIT_MAX_LEVELS      32          /* MC_MAX_STATES of the module */
+#define FIT_STATES          (3 * FIT_MAX_LEVELS)
+#define AUTO_MAX_STEPS      8
+#define SELECT_ITERS        5
+#define DEFAULT_SAMPLE      2000000
+#define DEFAULT_ITERS       100
+#define DEFAULT_TOL         1e-7
+#define PROB_FLOOR          1e-9
+#define DENSITY_FLOOR       1e-250
+#define STATIONARY_STEPS    20000
+#define MSEC_PER_SEC        1000.0
+
+enum { S_SIMPLE, S_QUEUE, S_LOSS, NUM_MAIN };
+
+struct fit_params {
+    unsigned int n;             /* jitter_steps, n + 1 queue levels */
+    double p[NUM_MAIN][NUM_MAIN];
+    double up;                  /* M/M/1/K step up */
+    double delay;               /* s */
+    double step;                /* s, jitter / n */
+    double sigma;               /* s, measurement noise */
+};
+
+/* expected sufficient statistics of one E-step */
+struct fit_stats {
+    double trans[NUM_MAIN][NUM_MAIN];
+    double up, down;
+    /* queue emissions, weights w at level q */
+    double wq, wq_q, wq_qq, wq_x, wq_qx, wq_xx;
+    /* simple emissions */
+    double ws, ws_x, ws_xx;
+    double loglik;
+    unsigned long packets;
+    unsigned long lost;
+};
+
+struct fit_ctx;
+
+struct fit_worker {
+    pthread_t thread;
+    const struct fit_ctx *ctx;
+    off_t start, end;           /* byte range, lines starting inside belong here */
+    double init[FIT_STATES];    /* distribution before the first packet */
+    double last[FIT_STATES];    /* after the last one, next chunk's init */
+    double *x;                  /* window: delay, < 0 lost */
+    double *emit;               /* window: simple, then queue levels */
+    double *alpha;              /* window: filtered distributions */
+    struct fit_stats st;
+    int threaded;
+    int err;
+};
+
+struct fit_ctx {
+    const char *path;
+    struct fit_params par;
+    struct fit_worker *workers;
+    int nworkers;
+};
+
+/* first pass statistics, also the initial guess */
+struct trace_summary {
+    unsigned long packets;
+    unsigned long lost;
+    unsigned long bursts;
+    double sum, sq, min, max;
+};
+
+static unsigned int levels(const struct fit_params *par)
+{
+    return par->n + 1;
+}
+
+/* delay of one line, < 0 for lost, NAN for blank or comment lines */
+static double parse_line(const char *line)
+{
+    char *end;
+    double v;
+
+    while (*line == ' ' || *line == '\t')
+        line++;
+    if (*line == '#' || *line == '\n' || !*line)
+        return NAN;
+    if (*line == '-' && (line[1] < '0' || line[1] > '9') && line[1] != '.')
+        return -1;
+    v = strtod(line, &end);
+    if (end == line)
+        return NAN;
+    return isnan(v) ? -1 : v;
+}
+
+/*
+ * Reads lines of [start, end) in order; the line across start belongs to the
+ * previous range.
+ */
+struct chunk_reader {
+    FILE *f;
+    off_t pos, end;
+    char *line;
+    size_t cap;
+};
+
+static int chunk_open(struct chunk_reader *r, const char *path, off_t start, off_t end)
+{
+    static const size_t bufsize = 1 << 20;
+    ssize_t len;
+
+    memset(r, 0, sizeof(*r));
+    r->f = fopen(path, "r");
+    if (!r->f)
+        return -errno;
+    setvbuf(r->f, NULL, _IOFBF, bufsize);
+    r->end = end;
+    r->pos = start;
+    if (start > 0) {
+        if (fseeko(r->f, start - 1, SEEK_SET))
+            return -errno;
+        len = getline(&r->line, &r->cap, r->f);
+        r->pos = start - 1 + (len > 0 ? len : 0);
+    }
+    return 0;
+}
+
+/* 1 with *x set, 0 at the end of the range */
+static int chunk_next(struct chunk_reader *r, double *x)
+{
+    ssize_t len;
+
+    while (r->pos < r->end && (len = getline(&r->line, &r->cap, r->f)) > 0) {
+        r->pos += len;
+        *x = parse_line(r->line);
+        if (!isnan(*x))
+            return 1;
+    }
+    return 0;
+}
+
+static void chunk_close(struct chunk_reader *r)
+{
+    free(r->line);
+    if (r->f)
+        fclose(r->f);
+}
+
+/* gaussian cdf difference, smoothed uniform of simple state */
+static double simple_density(const struct fit_params *par, double x)
+{
+    double a = par->delay - par->step, b = par->delay + par->step;
+    double k = 1 / (par->sigma * M_SQRT2);
+    double mass = 0.5 * (erfc((a - x) * k) - erfc((b - x) * k));
+
+    return fmax(mass / (b - a), DENSITY_FLOOR);
+}
+
+static void emissions(const struct fit_params *par, double x, double *e)
+{
+    double norm = 1 / (par->sigma * sqrt(2 * M_PI));
+    unsigned int q, k = levels(par);
+
+    if (x < 0)
+        return;
+    e[0] = simple_density(par, x);
+    for (q = 0; q < k; q++) {
+        double z = (x - par->delay - q * par->step) / par->sigma;
+
+        e[1 + q] = fmax(norm * exp(-0.5 * z * z), DENSITY_FLOOR);
+    }
+}
+
+/* mass entering queue state at each level, before the M/M/1/K step */
+static void queue_entry(const struct fit_params *par, const double *a, double *pre)
+{
+    unsigned int q, k = levels(par);
+
+    for (q = 0; q < k; q++)
+        pre[q] = a[S_SIMPLE * k + q] * par->p[S_SIMPLE][S_QUEUE] +
+                 a[S_QUEUE * k + q] * par->p[S_QUEUE][S_QUEUE] +
+                 a[S_LOSS * k + q] * par->p[S_LOSS][S_QUEUE];
+}
+
+/* a = distribution after the previous packet, out = unnormalized next one */
+static void predict(const struct fit_params *par, const double *a, double *out)
+{
+    double pre[FIT_MAX_LEVELS];
+    unsigned int q, k = levels(par), top = k - 1;
+    double up = par->up, down = 1 - par->up;
+
+    queue_entry(par, a, pre);
+    for (q = 0; q < k; q++) {
+        out[S_SIMPLE * k + q] = a[S_SIMPLE * k + q] * par->p[S_SIMPLE][S_SIMPLE] +
+                                a[S_QUEUE * k + q] * par->p[S_QUEUE][S_SIMPLE];
+        out[S_LOSS * k + q] = a[S_QUEUE * k + q] * par->p[S_QUEUE][S_LOSS] +
+                              a[S_LOSS * k + q] * par->p[S_LOSS][S_LOSS];
+        out[S_QUEUE * k + q] = 0;
+    }
+    for (q = 0; q < k; q++) {
+        out[S_QUEUE * k + (q ? q - 1 : 0)] += pre[q] * down;
+        out[S_QUEUE * k + (q < top ? q + 1 : top)] += pre[q] * up;
+    }
+}
+
+/* forward step, returns the scale factor c_t */
+static double forward(const struct fit_params *par, const double *a, double x,
+                      const double *e, double *out)
+{
+    unsigned int i, q, k = levels(par);
+    double c = 0;
+
+    predict(par, a, out);
+    for (q = 0; q < k; q++) {
+        if (x < 0) {
+            out[S_SIMPLE * k + q] = 0;
+            out[S_QUEUE * k + q] = 0;
+        } else {
+            out[S_SIMPLE * k + q] *= e[0];
+            out[S_QUEUE * k + q] *= e[1 + q];
+            out[S_LOSS * k + q] = 0;
+        }
+    }
+    for (i = 0; i < NUM_MAIN * k; i++)
+        c += out[i];
+    if (!(c > 0) || !isfinite(c)) {
+        /* observation impossible under the current parameters: restart from it */
+        for (i = 0; i < NUM_MAIN * k; i++)
+            out[i] = (x < 0) == (i / k == S_LOSS) ? 1.0 / k : 0;
+        return DBL_MIN;
+    }
+    for (i = 0; i < NUM_MAIN * k; i++)
+        out[i] /= c;
+    return c;
+}
+
+/*
+ * Backward step at packet t: b holds beta_t and becomes beta_{t-1}.
+ * Expected transitions into t and the emission weights of t are added to st.
+ */
+static void backward(const struct fit_params *par, const double *a, const double *alpha_t,
+                     double x, const double *e, double c, double *b, struct fit_stats *st)
+{
+    double g[FIT_STATES], v[FIT_MAX_LEVELS], pre[FIT_MAX_LEVELS];
+    unsigned int q, k = levels(par), top = k - 1;
+    double up = par->up, down = 1 - par->up;
+    const double (*p)[NUM_MAIN] = par->p;
+
+    for (q = 0; q < k; q++) {
+        double w;
+
+        /* emission weights, gamma_t = alpha_t * beta_t */
+        if (x >= 0) {
+            w = alpha_t[S_SIMPLE * k + q] * b[S_SIMPLE * k + q];
+            st->ws += w;
+            st->ws_x += w * x;
+            st->ws_xx += w * x * x;
+            w = alpha_t[S_QUEUE * k + q] * b[S_QUEUE * k + q];
+            st->wq += w;
+            st->wq_q += w * q;
+            st->wq_qq += w * q * q;
+            st->wq_x += w * x;
+            st->wq_qx += w * q * x;
+            st->wq_xx += w * x * x;
+        }
+        g[S_SIMPLE * k + q] = x < 0 ? 0 : e[0] * b[S_SIMPLE * k + q] / c;
+        g[S_QUEUE * k + q] = x < 0 ? 0 : e[1 + q] * b[S_QUEUE * k + q] / c;
+        g[S_LOSS * k + q] = x < 0 ? b[S_LOSS * k + q] / c : 0;
+    }
+    queue_entry(par, a, pre);
+    for (q = 0; q < k; q++) {
+        double gd = g[S_QUEUE * k + (q ? q - 1 : 0)] * down;
+        double gu = g[S_QUEUE * k + (q < top ? q + 1 : top)] * up;
+
+        v[q] = gd + gu;
+        st->down += pre[q] * gd;
+        st->up += pre[q] * gu;
+    }
+    for (q = 0; q < k; q++) {
+        const double *as = &a[q], *aq = &a[k + q], *al = &a[2 * k + q];
+        double gs = g[S_SIMPLE * k + q], gl = g[S_LOSS * k + q];
+
+        st->trans[S_SIMPLE][S_SIMPLE] += *as * p[S_SIMPLE][S_SIMPLE] * gs;
+        st->trans[S_SIMPLE][S_QUEUE] += *as * p[S_SIMPLE][S_QUEUE] * v[q];
+        st->trans[S_QUEUE][S_SIMPLE] += *aq * p[S_QUEUE][S_SIMPLE] * gs;
+        st->trans[S_QUEUE][S_QUEUE] += *aq * p[S_QUEUE][S_QUEUE] * v[q];
+        st->trans[S_QUEUE][S_LOSS] += *aq * p[S_QUEUE][S_LOSS] * gl;
+        st->trans[S_LOSS][S_QUEUE] += *al * p[S_LOSS][S_QUEUE] * v[q];
+        st->trans[S_LOSS][S_LOSS] += *al * p[S_LOSS][S_LOSS] * gl;
+
+        b[S_SIMPLE * k + q] = p[S_SIMPLE][S_SIMPLE] * gs + p[S_SIMPLE][S_QUEUE] * v[q];
+        b[S_QUEUE * k + q] = p[S_QUEUE][S_SIMPLE] * gs + p[S_QUEUE][S_QUEUE] * v[q] +
+                             p[S_QUEUE][S_LOSS] * gl;
+        b[S_LOSS * k + q] = p[S_LOSS][S_QUEUE] * v[q] + p[S_LOSS][S_LOSS] * gl;
+    }
+}
+
+/* smooths x[0..n), statistics of the first cnt packets; prev becomes alpha_{cnt-1} */
+static void smooth_window(struct fit_worker *w, unsigned int n, unsigned int cnt, double *prev)
+{
+    const struct fit_params *par = &w->ctx->par;
+    unsigned int t, i, k = levels(par), ns = NUM_MAIN * k;
+    double c[FIT_WINDOW + FIT_LOOKAHEAD];
+    double b[FIT_STATES];
+
+    for (t = 0; t < n; t++) {
+        emissions(par, w->x[t], &w->emit[t * (k + 1)]);
+        c[t] = forward(par, t ? &w->alpha[(t - 1) * ns] : prev, w->x[t],
+                       &w->emit[t * (k + 1)], &w->alpha[t * ns]);
+    }
+    for (i = 0; i < ns; i++)
+        b[i] = 1;
+    for (t = n; t-- > 0;) {
+        struct fit_stats tmp, *st = &w->st;
+
+        /* lookahead packets only carry beta back */
+        if (t >= cnt) {
+            memset(&tmp, 0, sizeof(tmp));
+            st = &tmp;
+        }
+        backward(par, t ? &w->alpha[(t - 1) * ns] : prev, &w->alpha[t * ns], w->x[t],
+                 &w->emit[t * (k + 1)], c[t], b, st);
+    }
+    for (t = 0; t < cnt; t++) {
+        w->st.loglik += log(c[t]);
+        w->st.packets++;
+        w->st.lost += w->x[t] < 0;
+    }
+    memcpy(prev, &w->alpha[(cnt - 1) * ns], sizeof(double) * ns);
+}
+
+static void *worker_run(void *arg)
+{
+    struct fit_worker *w = arg;
+    unsigned int n = 0, cnt, size = FIT_WINDOW + FIT_LOOKAHEAD;
+    struct chunk_reader r;
+    double prev[FIT_STATES];
+    int more = 1;
+
+    memset(&w->st, 0, sizeof(w->st));
+    memcpy(prev, w->init, sizeof(prev));
+    w->err = chunk_open(&r, w->ctx->path, w->start, w->end);
+    if (w->err)
+        goto out;
+    while (more || n) {
+        while (n < size && (more = chunk_next(&r, &w->x[n])))
+            n++;
+        if (!n)
+            break;
+        cnt = more ? FIT_WINDOW : n;
+        smooth_window(w, n, cnt, prev);
+        memmove(w->x, w->x + cnt, sizeof(double) * (n - cnt));
+        n -= cnt;
+    }
+out:
+    memcpy(w->last, prev, sizeof(prev));
+    chunk_close(&r);
+    return NULL;
+}
+
+/* long-run distribution of the hidden chain, the start of a trace */
+static void stationary(const struct fit_params *par, double *pi)
+{
+    double a[FIT_STATES], b[FIT_STATES];
+    unsigned int s, i, k = levels(par);
+
+    memset(a, 0, sizeof(a));
+    a[S_SIMPLE * k] = 1;
+    for (s = 0; s < STATIONARY_STEPS; s++) {
+        predict(par, a, b);
+        /* lazy chain: aperiodic */
+        for (i = 0; i < NUM_MAIN * k; i++)
+            a[i] = (a[i] + b[i]) / 2;
+    }
+    memcpy(pi, a, sizeof(a));
+}
+
+/* splits [0, size) into one range per worker, each starting from pi */
+static void split(struct fit_ctx *ctx, off_t size)
+{
+    double pi[FIT_STATES];
+    int i;
+
+    stationary(&ctx->par, pi);
+    for (i = 0; i < ctx->nworkers; i++) {
+        ctx->workers[i].start = size * i / ctx->nworkers;
+        ctx->workers[i].end = size * (i + 1) / ctx->nworkers;
+        memcpy(ctx->workers[i].init, pi, sizeof(pi));
+    }
+}
+
+static int e_step(struct fit_ctx *ctx, struct fit_stats *st)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < ctx->nworkers; i++) {
+        struct fit_worker *w = &ctx->workers[i];
+
+        w->ctx = ctx;
+        w->threaded = !pthread_create(&w->thread, NULL, worker_run, w);
+        if (!w->threaded)
+            worker_run(w);
+    }
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < ctx->nworkers; i++) {
+        struct fit_worker *w = &ctx->workers[i];
+        double *dst = (double *)st;
+        const double *src = (const double *)&w->st;
+        size_t j;
+
+        if (w->threaded)
+            pthread_join(w->thread, NULL);
+        if (w->err)
+            ret = w->err;
+        for (j = 0; j < offsetof(struct fit_stats, packets) / sizeof(double); j++)
+            dst[j] += src[j];
+        st->packets += w->st.packets;
+        st->lost += w->st.lost;
+    }
+    /* next iteration: every chunk starts where its predecessor ended */
+    for (i = ctx->nworkers - 1; i > 0; i--)
+        memcpy(ctx->workers[i].init, ctx->workers[i - 1].last, sizeof(ctx->workers[i].init));
+    return ret;
+}
+
+static double clamp_prob(double p)
+{
+    return fmin(fmax(p, PROB_FLOOR), 1 - PROB_FLOOR);
+}
+
+static double ratio(double a, double b, double fallback)
+{
+    return b > 0 ? a / b : fallback;
+}
+
+static void m_step(struct fit_params *par, const struct fit_stats *st, double sigma_min)
+{
+    const double (*t)[NUM_MAIN] = st->trans;
+    double p12, p21, p23, p32, det, var;
+
+    p12 = clamp_prob(ratio(t[S_SIMPLE][S_QUEUE], t[S_SIMPLE][S_SIMPLE] + t[S_SIMPLE][S_QUEUE],
+                           par->p[S_SIMPLE][S_QUEUE]));
+    p21 = ratio(t[S_QUEUE][S_SIMPLE], t[S_QUEUE][S_SIMPLE] + t[S_QUEUE][S_QUEUE] + t[S_QUEUE][S_LOSS],
+                par->p[S_QUEUE][S_SIMPLE]);
+    p23 = ratio(t[S_QUEUE][S_LOSS], t[S_QUEUE][S_SIMPLE] + t[S_QUEUE][S_QUEUE] + t[S_QUEUE][S_LOSS],
+                par->p[S_QUEUE][S_LOSS]);
+    p32 = clamp_prob(ratio(t[S_LOSS][S_QUEUE], t[S_LOSS][S_QUEUE] + t[S_LOSS][S_LOSS],
+                           par->p[S_LOSS][S_QUEUE]));
+    p21 = clamp_prob(p21);
+    p23 = clamp_prob(fmin(p23, 1 - p21 - PROB_FLOOR));
+
+    par->p[S_SIMPLE][S_SIMPLE] = 1 - p12;
+    par->p[S_SIMPLE][S_QUEUE] = p12;
+    par->p[S_QUEUE][S_SIMPLE] = p21;
+    par->p[S_QUEUE][S_QUEUE] = 1 - p21 - p23;
+    par->p[S_QUEUE][S_LOSS] = p23;
+    par->p[S_LOSS][S_QUEUE] = p32;
+    par->p[S_LOSS][S_LOSS] = 1 - p32;
+    par->up = clamp_prob(ratio(st->up, st->up + st->down, par->up));
+
+    /*
+     * Level i of queue state sits at delay + i * step: weighted least squares.
+     * Simple state is centered on delay and adds to the intercept only.
+     */
+    det = (st->wq + st->ws) * st->wq_qq - st->wq_q * st->wq_q;
+    if (st->wq_qq > 1e-9 * (st->wq + st->ws) && det > 0) {
+        par->delay = ((st->wq_x + st->ws_x) * st->wq_qq - st->wq_q * st->wq_qx) / det;
+        par->step = ((st->wq + st->ws) * st->wq_qx - st->wq_q * (st->wq_x + st->ws_x)) / det;
+    } else if (st->ws > 0) {
+        /* no queue mass: uniform of simple state, variance step^2 / 3 */
+        par->delay = st->ws_x / st->ws;
+        var = st->ws_xx / st->ws - par->delay * par->delay;
+        par->step = sqrt(fmax(3 * (var - par->sigma * par->sigma), 0));
+    }
+    par->step = fmax(par->step, sigma_min);
+
+    if (st->wq > 0) {
+        double d = par->delay, s = par->step;
+
+        var = st->wq_xx - 2 * d * st->wq_x - 2 * s * st->wq_qx + d * d * st->wq +
+              2 * d * s * st->wq_q + s * s * st->wq_qq;
+        par->sigma = sqrt(fmax(var / st->wq, 0));
+    }
+    par->sigma = fmax(par->sigma, sigma_min);
+}
+
+/* the kernel's _set_dlc_transition_probs(), in doubles */
+static void init_params(struct fit_params *par, unsigned int n, const struct trace_summary *sum,
+                        double sigma_min)
+{
+    double loss = clamp_prob(sum->packets ? (double)sum->lost / sum->packets : 0);
+    double burst = fmax(sum->bursts ? (double)sum->lost / sum->bursts : 1, 1);
+    double mu = 0.5, good = 10, x = loss / (1 - loss);
+    double delivered = sum->packets - sum->lost;
+    double mean = delivered ? sum->sum / delivered : 0;
+    double std = delivered ? sqrt(fmax(sum->sq / delivered - mean * mean, 0)) : 0;
+    double lo = fmax(sum->min, mean - 2.5 * std), hi = fmin(sum->max, mean + 2.5 * std);
+    double p12, p21, p23, p32;
+
+    p32 = 1 / burst;
+    p23 = clamp_prob(x / (mu * burst));
+    p21 = clamp_prob(fmax(1 / good - p23, 0));
+    p12 = clamp_prob(mu / ((1 - mu) * good) - x / ((1 - mu) * burst));
+
+    memset(par, 0, sizeof(*par));
+    par->n = n;
+    par->p[S_SIMPLE][S_SIMPLE] = 1 - p12;
+    par->p[S_SIMPLE][S_QUEUE] = p12;
+    par->p[S_QUEUE][S_SIMPLE] = p21;
+    par->p[S_QUEUE][S_QUEUE] = 1 - p21 - p23;
+    par->p[S_QUEUE][S_LOSS] = p23;
+    par->p[S_LOSS][S_QUEUE] = clamp_prob(p32);
+    par->p[S_LOSS][S_LOSS] = 1 - par->p[S_LOSS][S_QUEUE];
+    par->up = 1.0 / 3;          /* rho 50% */
+
+    /* levels and the simple state together cover [lo, hi] */
+    par->step = fmax((hi - lo) / (n + 1), sigma_min);
+    par->delay = lo + par->step;
+    par->sigma = fmax(par->step / 4, sigma_min);
+}
+
+static int summarize(struct fit_ctx *ctx, off_t size, struct trace_summary *sum)
+{
+    struct chunk_reader r;
+    int prev_lost = 0;
+    double x;
+    int ret;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->min = INFINITY;
+    sum->max = -INFINITY;
+    ret = chunk_open(&r, ctx->path, 0, size);
+    if (ret)
+        goto out;
+    while (chunk_next(&r, &x)) {
+        sum->packets++;
+        if (x < 0) {
+            sum->lost++;
+            sum->bursts += !prev_lost;
+            prev_lost = 1;
+            continue;
+        }
+        prev_lost = 0;
+        sum->sum += x;
+        sum->sq += x * x;
+        sum->min = fmin(sum->min, x);
+        sum->max = fmax(sum->max, x);
+    }
+    if (sum->packets == sum->lost)
+        ret = -ENODATA;
+out:
+    chunk_close(&r);
+    return ret;
+}
+
+/* EM until the log-likelihood per packet settles; returns the last one */
+static double fit(struct fit_ctx *ctx, off_t size, int max_iters, double tol, double sigma_min,
+                  int verbose)
+{
+    struct fit_stats st;
+    double ll = -INFINITY, prev = -INFINITY;
+    int it, ret;
+
+    split(ctx, size);
+    for (it = 0; it < max_iters; it++) {
+        ret = e_step(ctx, &st);
+        if (ret) {
+            fprintf(stderr, "dlc_fit: %s: %s\n", ctx->path, strerror(-ret));
+            return NAN;
+        }
+        ll = st.loglik / st.packets;
+        m_step(&ctx->par, &st, sigma_min);
+        if (verbose)
+            fprintf(stderr, "n %u iter %d loglik %.9f delay %.6f step %.6f sigma %.6f\n",
+                    ctx->par.n, it + 1, ll, ctx->par.delay * MSEC_PER_SEC,
+                    ctx->par.step * MSEC_PER_SEC, ctx->par.sigma * MSEC_PER_SEC);
+        if (fabs(ll - prev) < tol * fabs(ll))
+            break;
+        prev = ll;
+    }
+    return ll;
+}
+
+static void print_result(const struct fit_params *par, double ll, const char *dev)
+{
+    const double (*p)[NUM_MAIN] = par->p;
+    double p12 = p[S_SIMPLE][S_QUEUE], p21 = p[S_QUEUE][S_SIMPLE];
+    double p23 = p[S_QUEUE][S_LOSS], p32 = p[S_LOSS][S_QUEUE];
+    /* stationary main chain: pi ~ (p21 / p12, 1, p23 / p32) */
+    double ps = p21 / p12, pl = p23 / p32;
+    double loss = pl / (ps + 1 + pl) * 100;
+    double mu = 1 / (ps + 1) * 100;
+    double burst = fmax(round(1 / p32), 1), good = fmax(round(1 / (p21 + p23)), 1);
+    double rho = par->up / (1 - par->up) * 100;
+    double delay = par->delay * MSEC_PER_SEC, jitter = par->n * par->step * MSEC_PER_SEC;
+
+    printf("loglik %.9f\n", ll);
+    printf("noise %.6f\n", par->sigma * MSEC_PER_SEC);
+    printf("params -d %.6f -j %.6f -n %u -r %.5f -l %.5f -u %.5f -b %.0f -g %.0f\n",
+           delay, jitter, par->n, rho, loss, mu, burst, good);
+    printf("tc qdisc add dev %s root dlc delay %.6fms %.6fms loss %.5f%% mu %.5f%% "
+           "mean_burst_len %.0f mean_good_burst_len %.0f jitter_steps %u mm1_rho %.5f%%\n",
+           dev, delay, jitter, loss, mu, burst, good, par->n, rho);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-n jitter_steps] [-t threads] [-i iters] [-e tol] [-s sample]\n"
+        "          [-m min_noise] [-D dev] [-v] trace\n"
+        "  trace         one packet per line in sender order: delay in seconds,\n"
+        "                '-' or negative if lost (dlc_trace -o)\n"
+        "  -n            fixed jitter_steps (default: best of 1..%d on the sample)\n"
+        "  -t threads    E-step threads (default: online cpus)\n"
+        "  -i iters      max EM iterations (default %d)\n"
+        "  -e tol        relative log-likelihood change to stop at (default %g)\n"
+        "  -s sample     packets used to choose jitter_steps (default %d)\n"
+        "  -m min_noise  lower bound of delay noise and step, ms (default 0.001)\n"
+        "  -D dev        device in the printed tc command (default eth0)\n"
+        "  -v            progress to stderr\n",
+        prog, AUTO_MAX_STEPS, DEFAULT_ITERS, DEFAULT_TOL, DEFAULT_SAMPLE);
+}
+
+int main(int argc, char **argv)
+{
+    struct fit_ctx ctx = { 0 };
+    struct trace_summary sum;
+    struct fit_params best;
+    double tol = DEFAULT_TOL, sigma_min = 1e-6, ll, best_ll = -INFINITY;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long sample = DEFAULT_SAMPLE;
+    unsigned int n, steps = 0;
+    int opt, i, iters = DEFAULT_ITERS, verbose = 0, ret = 1;
+    const char *dev = "eth0";
+    off_t size, sample_size;
+    struct stat sb;
+
+    while ((opt = getopt(argc, argv, "n:t:i:e:s:m:D:vh")) != -1) {
+        switch (opt) {
+        case 'n':
+            steps = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            threads = strtol(optarg, NULL, 0);
+            break;
+        case 'i':
+            iters = atoi(optarg);
+            break;
+        case 'e':
+            tol = atof(optarg);
+            break;
+        case 's':
+            sample = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            sigma_min = atof(optarg) / MSEC_PER_SEC;
+            break;
+        case 'D':
+            dev = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 1 || steps >= FIT_MAX_LEVELS || threads < 1 || iters < 1 ||
+        !(sigma_min > 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+    ctx.path = argv[optind];
+    if (stat(ctx.path, &sb)) {
+        perror(ctx.path);
+        return 1;
+    }
+    size = sb.st_size;
+
+    ctx.nworkers = threads;
+    ctx.workers = calloc(threads, sizeof(*ctx.workers));
+    if (!ctx.workers)
+        goto out;
+    for (i = 0; i < threads; i++) {
+        struct fit_worker *w = &ctx.workers[i];
+        size_t window = FIT_WINDOW + FIT_LOOKAHEAD;
+
+        w->x = malloc(sizeof(double) * window);
+        w->emit = malloc(sizeof(double) * window * (FIT_MAX_LEVELS + 1));
+        w->alpha = malloc(sizeof(double) * window * FIT_STATES);
+        if (!w->x || !w->emit || !w->alpha) {
+            perror("malloc");
+            goto out;
+        }
+    }
+
+    ret = summarize(&ctx, size, &sum);
+    if (ret) {
+        fprintf(stderr, "dlc_fit: %s: %s\n", ctx.path,
+                ret == -ENODATA ? "no delivered packets" : strerror(-ret));
+        ret = 1;
+        goto out;
+    }
+    if (verbose)
+        fprintf(stderr, "packets %lu lost %lu\n", sum.packets, sum.lost);
+
+    if (!steps) {
+        /* candidates on a prefix of roughly `sample` packets */
+        sample_size = sum.packets > sample ? (off_t)((double)size * sample / sum.packets) : size;
+        for (n = 1; n <= AUTO_MAX_STEPS; n++) {
+            init_params(&ctx.par, n, &sum, sigma_min);
+            ll = fit(&ctx, sample_size, SELECT_ITERS, 0, sigma_min, verbose);
+            if (isnan(ll))
+                goto out;
+            if (ll > best_ll) {
+                best_ll = ll;
+                best = ctx.par;
+            }
+        }
+        ctx.par = best;
+    } else {
+        init_params(&ctx.par, steps, &sum, sigma_min);
+    }
+
+    ll = fit(&ctx, size, iters, tol, sigma_min, verbose);
+    if (isnan(ll))
+        goto out;
+    print_result(&ctx.par, ll, dev);
+    ret = 0;
+out:
+    for (i = 0; ctx.workers && i < ctx.nworkers; i++) {
+        free(ctx.workers[i].x);
+        free(ctx.workers[i].emit);
+        free(ctx.workers[i].alpha);
+    }
+    free(ctx.workers);
+    return ret;
+}
@@ -0,0 +1,317 @@
+/*
+ * dlc_replay - run a capture through the scheduling logic of the qdisc in
+ * virtual time.
+ *
+ * Every packet of the input enters at its capture timestamp and goes through
+ * what dlc_enqueue()/dlc_dequeue() do with it: the packet limit of the tfifo,
+ * one step of the model (the module's own ../dlc code), the constant rate of
+ * packet_time_ns() counted from the last queued packet, and release in
+ * time_to_send order, equal times in arrival order. The device is assumed to
+ * take a packet the moment it is due, so it leaves exactly at time_to_send and
+ * that is its timestamp in the output capture. Dropped packets (model loss or
+ * limit) go to the drop log.
+ *
+ * Nothing waits for the clock, so a capture replays as fast as it can be
+ * read. The input stays mmap'ed (pcap_io), queued packets are only pointers
+ * into it and at most limit of them exist, so memory does not grow with the
+ * capture.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "model_util.h"
+#include "pcap_io.h"
+
+#define DEFAULT_LIMIT       1000            /* as tc */
+#define NSEC_PER_SEC        1000000000ULL
+
+/* a packet in the tfifo */
+struct entry {
+    uint64_t time_to_send;
+    uint64_t seq;               /* arrival order, breaks ties */
+    struct pcap_pkt pkt;
+};
+
+/* tfifo: binary min-heap by (time_to_send, seq), at most limit entries */
+struct tfifo {
+    struct entry *e;
+    uint32_t len;
+    uint32_t limit;
+    uint64_t last;              /* largest time_to_send queued, valid if len */
+};
+
+struct replay {
+    struct dlc_mod_data model;
+    struct dlc_mod_runtime rt;
+    struct tfifo q;
+    uint64_t rate;              /* bytes/s, 0 = off */
+    uint64_t tick;              /* ns, 0 = off */
+
+    struct pcap_writer out;
+    FILE *drops;
+
+    uint64_t in, sent, lost, overlimit;
+    uint32_t linktype;          /* of the output, from the first packet */
+    int mixed;                  /* other link types seen, reported once */
+};
+
+static inline int entry_before(const struct entry *a, const struct entry *b)
+{
+    return a->time_to_send < b->time_to_send ||
+           (a->time_to_send == b->time_to_send && a->seq < b->seq);
+}
+
+static void tfifo_push(struct tfifo *q, const struct entry *n)
+{
+    uint32_t i = q->len++;
+
+    while (i) {
+        uint32_t parent = (i - 1) / 2;
+
+        if (!entry_before(n, &q->e[parent]))
+            break;
+        q->e[i] = q->e[parent];
+        i = parent;
+    }
+    q->e[i] = *n;
+    if (q->len == 1 || n->time_to_send > q->last)
+        q->last = n->time_to_send;
+}
+
+static void tfifo_pop(struct tfifo *q)
+{
+    struct entry *last = &q->e[--q->len];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+
+        if (c >= q->len)
+            break;
+        if (c + 1 < q->len && entry_before(&q->e[c + 1], &q->e[c]))
+            c++;
+        if (!entry_before(&q->e[c], last))
+            break;
+        q->e[i] = q->e[c];
+        i = c;
+    }
+    q->e[i] = *last;
+}
+
+/* dlc_release_due() with an ideal watchdog: everything due by now departs */
+static int release_due(struct replay *r, uint64_t now)
+{
+    while (r->q.len && r->q.e[0].time_to_send <= now) {
+        const struct entry *e = &r->q.e[0];
+
+        if (!r->sent) {
+            r->linktype = e->pkt.linktype;
+        } else if (e->pkt.linktype != r->linktype && !r->mixed) {
+            fprintf(stderr, "dlc_replay: link type %u written into a capture of %u\n",
+                    e->pkt.linktype, r->linktype);
+            r->mixed = 1;
+        }
+        if (pcap_write(&r->out, &e->pkt, e->time_to_send)) {
+            perror("dlc_replay: write");
+            return -1;
+        }
+        r->sent++;
+        tfifo_pop(&r->q);
+    }
+    return 0;
+}
+
+static void log_drop(struct replay *r, const struct pcap_pkt *pkt, const char *reason)
+{
+    uint64_t sec = pkt->ts_ns / NSEC_PER_SEC, nsec = pkt->ts_ns % NSEC_PER_SEC;
+
+    if (r->drops)
+        fprintf(r->drops, "%" PRIu64 " %" PRIu64 ".%09" PRIu64 " %u %s\n", r->in, sec, nsec, pkt->len, reason);
+}
+
+/* dlc_enqueue() of one packet arriving at now */
+static void enqueue(struct replay *r, const struct pcap_pkt *pkt, uint64_t now)
+{
+    struct dlc_packet_state ps;
+    struct entry n;
+    int64_t delay;
+
+    if (r->q.len >= r->q.limit) {
+        r->overlimit++;
+        log_drop(r, pkt, "limit");
+        return;
+    }
+    if (r->tick)
+        dlc_mod_advance_time(&r->rt, now);
+    ps = dlc_mod_handle_packet(&r->rt, NULL);
+    if (ps.loss) {
+        r->lost++;
+        log_drop(r, pkt, "loss");
+        return;
+    }
+
+    delay = ps.delay;
+    if (r->rate) {
+        /* last packet in queue is the reference point, as in dlc_enqueue_one() */
+        if (r->q.len) {
+            delay -= r->q.last - now;
+            if (delay < 0)
+                delay = 0;
+            now = r->q.last;
+        }
+        delay += (uint64_t)pkt->len * NSEC_PER_SEC / r->rate;
+    }
+
+    n.time_to_send = now + delay;
+    n.seq = r->in;
+    n.pkt = *pkt;
+    tfifo_push(&r->q, &n);
+}
+
+static int replay(struct replay *r, struct pcap_reader *in)
+{
+    struct pcap_pkt pkt;
+    uint64_t now = 0;
+    int ret;
+
+    while ((ret = pcap_next(in, &pkt)) > 0) {
+        r->in++;
+        /* virtual clock never goes back, pcapng interfaces may interleave */
+        if (pkt.ts_ns > now)
+            now = pkt.ts_ns;
+        if (release_due(r, now))
+            return -1;
+        enqueue(r, &pkt, now);
+    }
+    if (ret < 0)
+        fprintf(stderr, "dlc_replay: malformed capture after %" PRIu64 " packets\n", r->in);
+    if (release_due(r, UINT64_MAX))
+        return -1;
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s " MODEL_USAGE_SHORT "\n"
+        "          [-L limit] [-B rate] [-T tick] [-S seed] [-D drop_log] -o out.pcap in.pcap\n"
+        MODEL_USAGE
+        "  -L limit      packet limit of the tfifo (default %u)\n"
+        "  -B rate       link rate, Mbit/s (default 0, off)\n"
+        "  -T tick       time-driven model tick, us (default 0, off)\n"
+        "  -S seed       seed of the model PRNG (default random)\n"
+        "  -D file       drop log: index arrival len loss|limit, \"-\" for stdout\n"
+        "  -o file       output capture, departure timestamps, \"-\" for stdout\n"
+        "  -v            print model init messages\n",
+        prog, DEFAULT_LIMIT);
+}
+
+int main(int argc, char **argv)
+{
+    struct replay r = { .q.limit = DEFAULT_LIMIT };
+    const char *out = NULL, *drops = NULL;
+    unsigned long long seed = 0;
+    struct model_params mp;
+    struct pcap_reader in;
+    struct timespec t0, t1;
+    int opt, ret, seeded = 0;
+    double mbit = 0, secs;
+
+    model_params_init(&mp);
+    while ((opt = getopt(argc, argv, MODEL_OPTSTRING "L:B:T:S:D:o:vh")) != -1) {
+        ret = model_params_opt(&mp, opt, optarg);
+        if (ret == MODEL_OPT_ERROR)
+            return 2;
+        if (ret != MODEL_OPT_NONE)
+            continue;
+        switch (opt) {
+        case 'L':
+            r.q.limit = strtoul(optarg, NULL, 0);
+            break;
+        case 'B':
+            mbit = atof(optarg);
+            break;
+        case 'T':
+            r.tick = strtoull(optarg, NULL, 0) * 1000;
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            seeded = 1;
+            break;
+        case 'D':
+            drops = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 'v':
+            dlc_tools_verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 1 || !out || !r.q.limit || mbit < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    r.rate = mbit * 1e6 / 8;
+
+    srandom(time(NULL) ^ getpid());
+    ret = model_build(&r.model, &mp);
+    if (!ret && r.tick)
+        ret = dlc_mod_set_tick(&r.model, r.tick);
+    if (ret) {
+        fprintf(stderr, "dlc_replay: invalid model parameters (%d)\n", ret);
+        return 1;
+    }
+    if (seeded)
+        dlc_mod_runtime_init_seed(&r.rt, &r.model, seed);
+    else
+        dlc_mod_runtime_init(&r.rt, &r.model);
+
+    r.q.e = malloc((size_t)r.q.limit * sizeof(*r.q.e));
+    if (!r.q.e) {
+        perror("dlc_replay");
+        return 1;
+    }
+    if (pcap_open(&in, argv[optind]))
+        return 1;
+    if (pcap_writer_open(&r.out, out))
+        return 1;
+    if (drops) {
+        r.drops = strcmp(drops, "-") ? fopen(drops, "w") : stdout;
+        if (!r.drops) {
+            perror(drops);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = replay(&r, &in);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (pcap_writer_close(&r.out)) {
+        perror(out);
+        ret = -1;
+    }
+    if (r.drops && (r.drops != stdout ? fclose(r.drops) : fflush(r.drops))) {
+        perror(drops);
+        ret = -1;
+    }
+    pcap_close(&in);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "dlc_replay: %" PRIu64 " in, %" PRIu64 " sent, %" PRIu64 " lost, %" PRIu64 " over limit, %.3f s, %.2f Mpps\n",
+            r.in, r.sent, r.lost, r.overlimit, secs, secs > 0 ? r.in / secs / 1e6 : 0);
+    free(r.q.e);
+    dlc_mod_destroy(&r.model);
+    free(mp.dist);
+    return ret < 0 ? 1 : 0;
+}
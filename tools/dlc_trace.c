@@ -0,0 +1,424 @@
+/*
+ * dlc_trace - delay/loss statistics from sender and receiver captures.
+ *
+ * Packets are matched by iperf3 UDP sequence number in one linear pass over
+ * both files. Sender timestamps are kept in a ring of WINDOW sequence numbers,
+ * so memory is constant and receiver-side reordering up to WINDOW packets is
+ * tolerated. A packet is finalized (counted as delivered or lost) once it
+ * falls out of the window, which keeps the finalized stream in sender order,
+ * as burst statistics require.
+ *
+ * With -g a single receiver capture of pktgen traffic is analyzed instead:
+ * the send time comes from the pktgen header and gaps in its sequence
+ * numbers are losses.
+ *
+ * With -o the finalized stream is also written out, one packet per line:
+ * delay in seconds or "-" if lost, the input of dlc_fit.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcap_io.h"
+
+#define DEFAULT_WINDOW      (1u << 16)
+#define DEFAULT_PORT        5201
+#define PKTGEN_PORT         9
+#define PKTGEN_MAGIC        0xbe9be955
+#define BURST_HIST_MAX      64      /* last bucket collects longer bursts */
+
+struct tx_entry {
+    uint64_t seq;
+    uint64_t tx_ns;
+    int64_t delay_ns;       /* < 0 until received */
+    int valid;
+};
+
+struct trace_stats {
+    uint64_t sent;
+    uint64_t lost;
+    uint64_t received;
+    uint64_t duplicates;
+    uint64_t late;          /* received after leaving the window */
+
+    /* received packets only */
+    double delay_sum;
+    double delay_sq_sum;
+    double delay_min;
+    double delay_max;
+
+    /* loss bursts */
+    uint64_t burst_run;
+    uint64_t bursts;
+    uint64_t burst_hist[BURST_HIST_MAX + 1];
+
+    /* pearson sums, x = delay (max_delay for lost), y = loss */
+    double sx, sy, sxx, syy, sxy;
+};
+
+struct trace_ctx {
+    struct pcap_reader clt;
+    struct pcap_reader srv;
+    uint16_t port;
+    int counters_64bit;
+    int pktgen;
+    double max_delay;       /* seconds, delay recorded for lost packets */
+    FILE *out;              /* per-packet trace, NULL if not requested */
+
+    struct tx_entry *ring;
+    uint32_t mask;
+    uint64_t fin_seq;       /* next sequence number to finalize */
+    uint64_t tx_top;        /* highest sender sequence seen + 1 */
+    int tx_eof;
+
+    struct trace_stats st;
+};
+
+static int iperf_seq(const struct trace_ctx *c, const struct pcap_pkt *pkt, uint64_t *seq)
+{
+    const uint8_t *p;
+    uint16_t dport;
+    uint32_t len;
+
+    p = pcap_udp_payload(pkt, &dport, &len);
+    if (!p || dport != c->port)
+        return 0;
+    /* iperf3 udp header: sec, usec, packet count; network byte order */
+    if (c->counters_64bit) {
+        uint64_t v;
+
+        if (len < 16)
+            return 0;
+        memcpy(&v, p + 8, sizeof(v));
+        *seq = __builtin_bswap64(v);
+    } else {
+        uint32_t v;
+
+        if (len < 12)
+            return 0;
+        memcpy(&v, p + 8, sizeof(v));
+        *seq = __builtin_bswap32(v);
+    }
+    return 1;
+}
+
+static int pktgen_seq(const struct trace_ctx *c, const struct pcap_pkt *pkt,
+                      uint64_t *seq, uint64_t *tx_ns)
+{
+    const uint8_t *p;
+    uint16_t dport;
+    uint32_t len, v[4];
+
+    p = pcap_udp_payload(pkt, &dport, &len);
+    if (!p || dport != c->port || len < sizeof(v))
+        return 0;
+    /* pktgen header: magic, seq_num, tv_sec, tv_usec; network byte order */
+    memcpy(v, p, sizeof(v));
+    if (__builtin_bswap32(v[0]) != PKTGEN_MAGIC)
+        return 0;
+    *seq = __builtin_bswap32(v[1]);
+    *tx_ns = (uint64_t)__builtin_bswap32(v[2]) * 1000000000ULL +
+             (uint64_t)__builtin_bswap32(v[3]) * 1000;
+    return 1;
+}
+
+static void account(struct trace_stats *st, int lost, double delay)
+{
+    st->sent++;
+    if (lost) {
+        st->lost++;
+        st->burst_run++;
+    } else {
+        st->received++;
+        st->delay_sum += delay;
+        st->delay_sq_sum += delay * delay;
+        if (st->received == 1 || delay < st->delay_min)
+            st->delay_min = delay;
+        if (st->received == 1 || delay > st->delay_max)
+            st->delay_max = delay;
+        if (st->burst_run) {
+            st->burst_hist[st->burst_run < BURST_HIST_MAX ? st->burst_run : BURST_HIST_MAX]++;
+            st->bursts++;
+            st->burst_run = 0;
+        }
+    }
+    st->sx += delay;
+    st->sy += lost;
+    st->sxx += delay * delay;
+    st->syy += lost;
+    st->sxy += delay * lost;
+}
+
+static void finalize_entry(struct trace_ctx *c, struct tx_entry *e)
+{
+    if (!e->valid)
+        return;
+    if (e->delay_ns >= 0)
+        account(&c->st, 0, e->delay_ns / 1e9);
+    else
+        account(&c->st, 1, c->max_delay);
+    if (c->out) {
+        if (e->delay_ns >= 0)
+            fprintf(c->out, "%.9f\n", e->delay_ns / 1e9);
+        else
+            fputs("-\n", c->out);
+    }
+    e->valid = 0;
+}
+
+/* finalize everything with seq < upto */
+static void finalize_upto(struct trace_ctx *c, uint64_t upto)
+{
+    uint64_t end = upto;
+
+    /* a gap wider than the window: only one ring worth can hold entries */
+    if (upto - c->fin_seq > (uint64_t)c->mask + 1)
+        end = c->fin_seq + c->mask + 1;
+
+    for (; c->fin_seq < end; c->fin_seq++) {
+        struct tx_entry *e = &c->ring[c->fin_seq & c->mask];
+
+        if (e->valid && e->seq == c->fin_seq)
+            finalize_entry(c, e);
+    }
+    c->fin_seq = upto;
+}
+
+static void add_tx(struct trace_ctx *c, uint64_t tseq, uint64_t tx_ns)
+{
+    if (tseq > c->mask)
+        finalize_upto(c, tseq - c->mask);
+    c->ring[tseq & c->mask] = (struct tx_entry){
+        .seq = tseq,
+        .tx_ns = tx_ns,
+        .delay_ns = -1,
+        .valid = 1,
+    };
+    if (tseq >= c->tx_top)
+        c->tx_top = tseq + 1;
+}
+
+/* read sender packets until seq is inside the known range */
+static void advance_sender(struct trace_ctx *c, uint64_t seq)
+{
+    struct pcap_pkt pkt;
+    uint64_t tseq;
+    int ret;
+
+    while (!c->tx_eof && c->tx_top <= seq) {
+        ret = pcap_next(&c->clt, &pkt);
+        if (ret <= 0) {
+            if (ret < 0)
+                fprintf(stderr, "dlc_trace: truncated sender capture\n");
+            c->tx_eof = 1;
+            break;
+        }
+        if (!iperf_seq(c, &pkt, &tseq) || tseq < c->fin_seq)
+            continue;
+        add_tx(c, tseq, pkt.ts_ns);
+    }
+}
+
+static void finish(struct trace_ctx *c)
+{
+    finalize_upto(c, c->tx_top);
+    if (c->st.burst_run) {
+        uint64_t run = c->st.burst_run;
+
+        c->st.burst_hist[run < BURST_HIST_MAX ? run : BURST_HIST_MAX]++;
+        c->st.bursts++;
+    }
+}
+
+static int run(struct trace_ctx *c)
+{
+    struct pcap_pkt pkt;
+    uint64_t seq;
+    int ret;
+
+    while ((ret = pcap_next(&c->srv, &pkt)) > 0) {
+        struct tx_entry *e;
+
+        if (!iperf_seq(c, &pkt, &seq))
+            continue;
+        advance_sender(c, seq);
+        if (seq < c->fin_seq) {
+            c->st.late++;
+            continue;
+        }
+        e = &c->ring[seq & c->mask];
+        if (!e->valid || e->seq != seq)
+            continue;   /* not captured on sender side */
+        if (e->delay_ns >= 0) {
+            c->st.duplicates++;
+            continue;
+        }
+        e->delay_ns = pkt.ts_ns >= e->tx_ns ? (int64_t)(pkt.ts_ns - e->tx_ns) : 0;
+    }
+    if (ret < 0)
+        fprintf(stderr, "dlc_trace: truncated receiver capture\n");
+
+    /* whatever the sender still has was never received */
+    advance_sender(c, UINT64_MAX);
+    finish(c);
+    return 0;
+}
+
+static int run_pktgen(struct trace_ctx *c)
+{
+    struct pcap_pkt pkt;
+    uint64_t seq, tx_ns, t;
+    int ret;
+
+    while ((ret = pcap_next(&c->srv, &pkt)) > 0) {
+        struct tx_entry *e;
+
+        if (!pktgen_seq(c, &pkt, &seq, &tx_ns))
+            continue;
+        if (!c->tx_top)
+            c->fin_seq = c->tx_top = seq;   /* capture may start mid-run */
+        if (seq < c->fin_seq) {
+            c->st.late++;
+            continue;
+        }
+        /* every sequence number up to seq was sent */
+        for (t = c->tx_top; t <= seq; t++)
+            add_tx(c, t, 0);
+        e = &c->ring[seq & c->mask];
+        if (e->delay_ns >= 0) {
+            c->st.duplicates++;
+            continue;
+        }
+        e->tx_ns = tx_ns;
+        e->delay_ns = pkt.ts_ns >= tx_ns ? (int64_t)(pkt.ts_ns - tx_ns) : 0;
+    }
+    if (ret < 0)
+        fprintf(stderr, "dlc_trace: truncated capture\n");
+    finish(c);
+    return 0;
+}
+
+static void print_stats(const struct trace_stats *st)
+{
+    double n = st->sent;
+    double mean = st->received ? st->delay_sum / st->received : 0;
+    double var = st->received ? st->delay_sq_sum / st->received - mean * mean : 0;
+    double jitter = 0, corr = 0, cov, vx, vy;
+    int i;
+
+    if (st->received)
+        jitter = fmax(st->delay_max - mean, mean - st->delay_min);
+    if (n > 2) {
+        cov = st->sxy / n - (st->sx / n) * (st->sy / n);
+        vx = st->sxx / n - (st->sx / n) * (st->sx / n);
+        vy = st->syy / n - (st->sy / n) * (st->sy / n);
+        if (vx > 0 && vy > 0)
+            corr = cov / sqrt(vx * vy);
+    }
+
+    printf("packets %" PRIu64 "\n", st->sent);
+    printf("received %" PRIu64 "\n", st->received);
+    printf("duplicates %" PRIu64 "\n", st->duplicates);
+    printf("late %" PRIu64 "\n", st->late);
+    printf("loss %.9f\n", n ? st->lost / n : 0);
+    printf("delay %.9f\n", mean);
+    printf("delay_std %.9f\n", var > 0 ? sqrt(var) : 0);
+    printf("jitter %.9f\n", jitter);
+    printf("mean_burst %.6f\n", st->bursts ? (double)st->lost / st->bursts : 0);
+    printf("corr %.6f\n", corr);
+    printf("burst_hist");
+    for (i = 1; i <= BURST_HIST_MAX; i++)
+        if (st->burst_hist[i])
+            printf(" %d%s:%" PRIu64, i, i == BURST_HIST_MAX ? "+" : "", st->burst_hist[i]);
+    printf("\n");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-p port] [-w window] [-m max_delay] [-o trace] [-8] clt.pcap srv.pcap\n"
+        "       %s -g [-p port] [-w window] [-m max_delay] [-o trace] rcv.pcap\n"
+        "  -g            pktgen traffic, delay from the pktgen header timestamp\n"
+        "  -p port       udp destination port (default %d, %d with -g)\n"
+        "  -w window     reordering window in packets, power of two (default %u)\n"
+        "  -m max_delay  delay in seconds accounted for lost packets (default -1)\n"
+        "  -o trace      write per-packet delays (s, '-' if lost) in sender order\n"
+        "  -8            iperf3 runs with --udp-counters-64bit\n",
+        prog, prog, DEFAULT_PORT, PKTGEN_PORT, DEFAULT_WINDOW);
+}
+
+int main(int argc, char **argv)
+{
+    struct trace_ctx c = {
+        .max_delay = -1,
+    };
+    uint32_t window = DEFAULT_WINDOW;
+    int opt, ret, port = -1;
+
+    while ((opt = getopt(argc, argv, "gp:w:m:o:8h")) != -1) {
+        switch (opt) {
+        case 'g':
+            c.pktgen = 1;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'w':
+            window = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            c.max_delay = atof(optarg);
+            break;
+        case 'o':
+            c.out = fopen(optarg, "w");
+            if (!c.out) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case '8':
+            c.counters_64bit = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != (c.pktgen ? 1 : 2) || !window || (window & (window - 1))) {
+        usage(argv[0]);
+        return 2;
+    }
+    c.port = port >= 0 ? port : (c.pktgen ? PKTGEN_PORT : DEFAULT_PORT);
+
+    c.mask = window - 1;
+    c.ring = calloc(window, sizeof(*c.ring));
+    if (!c.ring) {
+        perror("calloc");
+        return 1;
+    }
+    if (c.pktgen) {
+        if (pcap_open(&c.srv, argv[optind]))
+            return 1;
+        ret = run_pktgen(&c);
+    } else {
+        if (pcap_open(&c.clt, argv[optind]))
+            return 1;
+        if (pcap_open(&c.srv, argv[optind + 1]))
+            return 1;
+        ret = run(&c);
+        pcap_close(&c.clt);
+    }
+    print_stats(&c.st);
+    if (c.out && fclose(c.out)) {
+        perror("dlc_trace: trace");
+        ret = 1;
+    }
+
+    pcap_close(&c.srv);
+    free(c.ring);
+    return ret;
+}
@@ -0,0 +1,511 @@
+/*
+ * dlc_xdp - dlc link emulation between two ports in userspace, over AF_XDP.
+ *
+ * Frames received on one port are transmitted on the other one after the
+ * model (the module's own ../dlc code, one runtime per direction) decided
+ * their delay or loss. Both sockets share one UMEM, so a frame is never
+ * copied: it waits in a per-direction timing wheel as a UMEM frame index and
+ * its address goes straight to the TX ring of the other port at departure
+ * time. Everything runs in one busy-polling thread, no syscalls on the fast
+ * path except the wakeups the kernel asks for.
+ *
+ * The wheel covers the largest delay the model can produce, so a slot never
+ * holds frames of different turns. Departure times are rounded up to the slot
+ * granularity (never early, at most one slot late), frames of one slot leave
+ * in arrival order.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "model_util.h"
+#include "xsk.h"
+
+#define DEFAULT_FRAMES      (1u << 16)
+#define DEFAULT_FRAME_SIZE  2048        /* XDP_UMEM_MIN_CHUNK_SIZE */
+#define DEFAULT_RING        2048
+#define DEFAULT_SLOT_SHIFT  12          /* 4.096 us wheel slots */
+#define BATCH               64
+#define NO_FRAME            UINT32_MAX
+#define NSEC_PER_SEC        1000000000ULL
+
+/* per UMEM frame, valid while the frame waits in a wheel */
+struct frame_meta {
+    uint64_t addr;          /* as received, with data offset */
+    uint32_t len;
+    uint32_t next;          /* next frame of the same slot */
+};
+
+struct wheel {
+    uint32_t *head;
+    uint32_t *tail;
+    uint32_t mask;
+    uint64_t clk;           /* first slot not released yet */
+    uint64_t queued;
+};
+
+struct dir_stats {
+    uint64_t rx;
+    uint64_t tx;
+    uint64_t lost;
+    uint64_t clamped;       /* delay beyond the wheel, sent at its end */
+};
+
+struct direction {
+    struct xsk_socket *in;
+    struct xsk_socket *out;
+    struct dlc_mod_runtime rt;
+    struct wheel wheel;
+    struct dir_stats st;
+};
+
+struct engine {
+    struct xsk_umem umem;
+    struct xsk_socket xs[2];
+    struct xsk_redirect redirect[2];
+    struct direction dir[2];
+    struct dlc_mod_data model;
+
+    unsigned int frame_shift;
+    unsigned int slot_shift;
+    struct frame_meta *meta;
+    uint32_t *free_frames;
+    uint32_t nfree;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static unsigned int ilog2_u32(uint32_t v)
+{
+    return 31 - __builtin_clz(v);
+}
+
+/* largest delay of a delivered packet, ns */
+static int64_t model_max_delay(const struct dlc_mod_data *m)
+{
+    const struct dlc_simple_state *s = &m->main_chain.states[DLC_IDX_SIMPLE].simple;
+    const struct markov_chain_const *q = &m->main_chain.states[DLC_IDX_QUEUE].queue.mm1k_chain;
+    int64_t max = s->delay_mean + s->jitter;
+    uint32_t i;
+
+    if (s->delay_table)
+        for (i = 0; i < s->delay_table_size; i++)
+            if (s->delay_table[i] > max)
+                max = s->delay_table[i];
+    for (i = 0; i < q->num_states; i++)
+        if (q->states[i].delay > max)
+            max = q->states[i].delay;
+    return max;
+}
+
+static int wheel_init(struct wheel *w, int64_t max_delay, unsigned int slot_shift)
+{
+    uint32_t slots = 2, i;
+
+    while (slots < (uint64_t)(max_delay >> slot_shift) + 2)
+        slots <<= 1;
+    w->head = malloc(slots * sizeof(*w->head));
+    w->tail = malloc(slots * sizeof(*w->tail));
+    if (!w->head || !w->tail)
+        return -1;
+    for (i = 0; i < slots; i++)
+        w->head[i] = NO_FRAME;
+    w->mask = slots - 1;
+    w->clk = 0;
+    w->queued = 0;
+    return 0;
+}
+
+static inline void wheel_add(struct engine *e, struct direction *d, uint32_t f, uint64_t tts)
+{
+    struct wheel *w = &d->wheel;
+    uint64_t slot = (tts + (1ULL << e->slot_shift) - 1) >> e->slot_shift;
+    uint32_t idx;
+
+    if (slot < w->clk)
+        slot = w->clk;
+    if (slot - w->clk > w->mask) {
+        slot = w->clk + w->mask;
+        d->st.clamped++;
+    }
+    idx = slot & w->mask;
+    e->meta[f].next = NO_FRAME;
+    if (w->head[idx] == NO_FRAME)
+        w->head[idx] = f;
+    else
+        e->meta[w->tail[idx]].next = f;
+    w->tail[idx] = f;
+    w->queued++;
+}
+
+static inline void frame_free(struct engine *e, uint32_t f)
+{
+    e->free_frames[e->nfree++] = f;
+}
+
+/* TX completions of the socket give frames back to the pool */
+static void socket_complete(struct engine *e, struct xsk_socket *xs)
+{
+    uint32_t idx, n, i;
+
+    n = xsk_cons_peek(&xs->comp, xs->comp.size, &idx);
+    if (!n)
+        return;
+    for (i = 0; i < n; i++)
+        frame_free(e, *xsk_addr(&xs->comp, idx + i) >> e->frame_shift);
+    xsk_cons_release(&xs->comp);
+}
+
+static void socket_refill(struct engine *e, struct xsk_socket *xs)
+{
+    uint32_t idx, n, i;
+
+    n = xsk_prod_reserve(&xs->fill, e->nfree < BATCH ? e->nfree : BATCH, &idx);
+    if (!n)
+        return;
+    for (i = 0; i < n; i++)
+        *xsk_addr(&xs->fill, idx + i) = (uint64_t)e->free_frames[--e->nfree] << e->frame_shift;
+    xsk_prod_submit(&xs->fill);
+    xsk_kick_fill(xs);
+}
+
+static void dir_receive(struct engine *e, struct direction *d, uint64_t now)
+{
+    struct xsk_ring *rx = &d->in->rx;
+    uint32_t idx, n, i;
+
+    n = xsk_cons_peek(rx, BATCH, &idx);
+    if (!n)
+        return;
+    for (i = 0; i < n; i++) {
+        const struct xdp_desc *desc = xsk_desc(rx, idx + i);
+        uint32_t f = desc->addr >> e->frame_shift;
+        struct dlc_packet_state ps = dlc_mod_handle_packet(&d->rt, NULL);
+
+        if (ps.loss) {
+            frame_free(e, f);
+            d->st.lost++;
+            continue;
+        }
+        e->meta[f].addr = desc->addr;
+        e->meta[f].len = desc->len;
+        wheel_add(e, d, f, ps.delay > 0 ? now + ps.delay : now);
+    }
+    xsk_cons_release(rx);
+    d->st.rx += n;
+}
+
+/* Move due slots to TX ring of the other port; a full ring is retried next pass */
+static void dir_release(struct engine *e, struct direction *d, uint64_t now)
+{
+    struct wheel *w = &d->wheel;
+    struct xsk_ring *tx = &d->out->tx;
+    uint64_t now_slot = now >> e->slot_shift;
+    uint32_t idx, f, sent = 0;
+
+    while (w->queued && w->clk <= now_slot) {
+        uint32_t *head = &w->head[w->clk & w->mask];
+
+        while ((f = *head) != NO_FRAME) {
+            struct xdp_desc *desc;
+
+            if (!xsk_prod_reserve(tx, 1, &idx))
+                goto out;
+            desc = xsk_desc(tx, idx);
+            desc->addr = e->meta[f].addr;
+            desc->len = e->meta[f].len;
+            desc->options = 0;
+            *head = e->meta[f].next;
+            w->queued--;
+            sent++;
+        }
+        w->clk++;
+    }
+    /* nothing pending: skip idle slots at once */
+    if (!w->queued && w->clk <= now_slot)
+        w->clk = now_slot + 1;
+out:
+    if (sent) {
+        xsk_prod_submit(tx);
+        d->st.tx += sent;
+    }
+    /* copy mode transmits in sendto(), zero-copy asks only when idle */
+    if (sent || w->queued)
+        xsk_kick_tx(d->out);
+}
+
+static void print_rates(const struct engine *e, struct dir_stats *prev, double secs)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        const struct dir_stats *st = &e->dir[i].st;
+
+        fprintf(stderr, "%s%d->%d rx %.3f Mpps tx %.3f Mpps lost %.3f Mpps queued %" PRIu64,
+                i ? "  " : "", i, !i,
+                (st->rx - prev[i].rx) / secs / 1e6, (st->tx - prev[i].tx) / secs / 1e6,
+                (st->lost - prev[i].lost) / secs / 1e6, e->dir[i].wheel.queued);
+        prev[i] = *st;
+    }
+    fprintf(stderr, "  free %u\n", e->nfree);
+}
+
+static void run(struct engine *e, int rates)
+{
+    struct dir_stats prev[2] = { 0 };
+    uint64_t now, last = now_ns();
+    unsigned long loops = 0;
+    int i;
+
+    while (!stop) {
+        now = now_ns();
+        for (i = 0; i < 2; i++) {
+            socket_complete(e, &e->xs[i]);
+            socket_refill(e, &e->xs[i]);
+        }
+        for (i = 0; i < 2; i++)
+            dir_receive(e, &e->dir[i], now);
+        for (i = 0; i < 2; i++)
+            dir_release(e, &e->dir[i], now);
+
+        if (rates && !(++loops & 0xfff) && now - last >= NSEC_PER_SEC) {
+            print_rates(e, prev, (double)(now - last) / NSEC_PER_SEC);
+            last = now;
+        }
+    }
+}
+
+static void print_stats(const struct engine *e)
+{
+    struct xdp_statistics xst;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        const struct dir_stats *st = &e->dir[i].st;
+
+        printf("dir%d rx %" PRIu64 " tx %" PRIu64 " lost %" PRIu64 " clamped %" PRIu64 " queued %" PRIu64 "\n",
+               i, st->rx, st->tx, st->lost, st->clamped, e->dir[i].wheel.queued);
+    }
+    for (i = 0; i < 2; i++) {
+        if (xsk_get_stats(&e->xs[i], &xst))
+            continue;
+        printf("port%d rx_dropped %llu rx_fill_empty %llu rx_ring_full %llu tx_invalid %llu\n",
+               i, xst.rx_dropped, xst.rx_fill_ring_empty_descs, xst.rx_ring_full,
+               xst.tx_invalid_descs);
+    }
+}
+
+static int engine_sockets(struct engine *e, char **ifname, uint32_t queue, uint32_t ring, int mode)
+{
+    int ret;
+
+    ret = xsk_socket_create(&e->xs[0], ifname[0], queue, &e->umem, NULL, ring, mode);
+    if (ret)
+        return ret;
+    ret = xsk_socket_create(&e->xs[1], ifname[1], queue, &e->umem, &e->xs[0], ring, mode);
+    if (ret)
+        xsk_socket_destroy(&e->xs[0]);
+    return ret;
+}
+
+static int engine_init(struct engine *e, const struct model_params *mp, char **ifname,
+                       uint32_t queue, uint32_t frames, uint32_t ring, int mode, int skb_mode)
+{
+    int64_t max_delay;
+    uint32_t i;
+    int ret;
+
+    ret = model_build(&e->model, mp);
+    if (ret) {
+        fprintf(stderr, "dlc_xdp: invalid model parameters (%d)\n", ret);
+        return ret;
+    }
+    max_delay = model_max_delay(&e->model);
+
+    e->frame_shift = ilog2_u32(DEFAULT_FRAME_SIZE);
+    e->meta = calloc(frames, sizeof(*e->meta));
+    e->free_frames = malloc(frames * sizeof(*e->free_frames));
+    if (!e->meta || !e->free_frames)
+        return -ENOMEM;
+    for (i = 0; i < frames; i++)
+        e->free_frames[i] = frames - 1 - i;
+    e->nfree = frames;
+
+    ret = xsk_umem_create(&e->umem, frames, DEFAULT_FRAME_SIZE);
+    if (ret) {
+        fprintf(stderr, "dlc_xdp: umem: %s\n", strerror(-ret));
+        return ret;
+    }
+    ret = engine_sockets(e, ifname, queue, ring, mode);
+    /* second port may lack zero-copy, the pair then falls back as a whole */
+    if (ret && mode == XSK_MODE_AUTO)
+        ret = engine_sockets(e, ifname, queue, ring, XSK_MODE_COPY);
+    if (ret) {
+        fprintf(stderr, "dlc_xdp: AF_XDP socket: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    for (i = 0; i < 2; i++) {
+        struct direction *d = &e->dir[i];
+
+        ret = xsk_redirect_attach(&e->redirect[i], &e->xs[i], skb_mode);
+        if (ret) {
+            fprintf(stderr, "dlc_xdp: XDP program on %s: %s\n", ifname[i], strerror(-ret));
+            return ret;
+        }
+        d->in = &e->xs[i];
+        d->out = &e->xs[!i];
+        dlc_mod_runtime_init(&d->rt, &e->model);
+        if (wheel_init(&d->wheel, max_delay, e->slot_shift))
+            return -ENOMEM;
+        d->wheel.clk = now_ns() >> e->slot_shift;
+    }
+    fprintf(stderr, "dlc_xdp: %s <-> %s queue %u, %s mode, %u frames, wheel %u x %u ns\n",
+            ifname[0], ifname[1], queue, e->xs[0].zerocopy ? "zero-copy" : "copy",
+            frames, e->dir[0].wheel.mask + 1, 1u << e->slot_shift);
+    return 0;
+}
+
+static void engine_destroy(struct engine *e)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        xsk_redirect_detach(&e->redirect[i]);
+        xsk_socket_destroy(&e->xs[i]);
+        free(e->dir[i].wheel.head);
+        free(e->dir[i].wheel.tail);
+    }
+    xsk_umem_destroy(&e->umem);
+    dlc_mod_destroy(&e->model);
+    free(e->meta);
+    free(e->free_frames);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s " MODEL_USAGE_SHORT "\n"
+        "          [-q queue] [-z | -c] [-G] [-F frames] [-R ring] [-t shift] [-C cpu] [-s] [-v]\n"
+        "          if0 if1\n"
+        MODEL_USAGE
+        "  -q queue      rx/tx queue served on both ports (default 0)\n"
+        "  -z, -c        force zero-copy or copy mode (default: zero-copy if supported)\n"
+        "  -G            generic (skb) XDP instead of driver mode\n"
+        "  -F frames     UMEM frames, power of two (default %u), bounds packets in flight\n"
+        "  -R ring       ring size, power of two (default %u)\n"
+        "  -t shift      wheel slot is 2^shift ns (default %u)\n"
+        "  -C cpu        pin the polling thread\n"
+        "  -s            per second rates to stderr\n"
+        "  -v            model init messages to stderr\n",
+        prog, DEFAULT_FRAMES, DEFAULT_RING, DEFAULT_SLOT_SHIFT);
+}
+
+static int is_pow2(uint32_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+int main(int argc, char **argv)
+{
+    struct engine e = { .slot_shift = DEFAULT_SLOT_SHIFT };
+    struct model_params mp;
+    uint32_t queue = 0, frames = DEFAULT_FRAMES, ring = DEFAULT_RING;
+    int opt, ret, mode = XSK_MODE_AUTO, skb_mode = 0, rates = 0, cpu = -1, i;
+
+    for (i = 0; i < 2; i++) {
+        e.xs[i].fd = -1;
+        e.redirect[i].map_fd = e.redirect[i].prog_fd = e.redirect[i].link_fd = -1;
+    }
+    model_params_init(&mp);
+    while ((opt = getopt(argc, argv, MODEL_OPTSTRING "q:zcGF:R:t:C:svh")) != -1) {
+        ret = model_params_opt(&mp, opt, optarg);
+        if (ret == MODEL_OPT_ERROR)
+            return 1;
+        if (ret != MODEL_OPT_NONE)
+            continue;
+        switch (opt) {
+        case 'q':
+            queue = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            mode = XSK_MODE_ZEROCOPY;
+            break;
+        case 'c':
+            mode = XSK_MODE_COPY;
+            break;
+        case 'G':
+            skb_mode = 1;
+            break;
+        case 'F':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'R':
+            ring = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            e.slot_shift = strtoul(optarg, NULL, 0);
+            break;
+        case 'C':
+            cpu = atoi(optarg);
+            break;
+        case 's':
+            rates = 1;
+            break;
+        case 'v':
+            dlc_tools_verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 2 || !strcmp(argv[optind], argv[optind + 1]) ||
+        !is_pow2(frames) || !is_pow2(ring) || e.slot_shift > 30) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set))
+            perror("sched_setaffinity");
+    }
+    srandom(now_ns() ^ getpid());
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ret = engine_init(&e, &mp, &argv[optind], queue, frames, ring, mode, skb_mode);
+    if (!ret) {
+        run(&e, rates);
+        print_stats(&e);
+    }
+    engine_destroy(&e);
+    free(mp.dist);
+    return ret ? 1 : 0;
+}
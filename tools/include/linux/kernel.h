@@ -0,0 +1,43 @@
+#ifndef _TOOLS_LINUX_KERNEL_H
+#define _TOOLS_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/types.h>
+
+#define U32_MAX     UINT32_MAX
+#define U64_MAX     UINT64_MAX
+
+#define KERN_ERR        ""
+#define KERN_WARNING    ""
+#define KERN_INFO       ""
+#define KERN_DEBUG      ""
+
+/* model code logs on every init, tools keep stdout for results */
+extern int dlc_tools_verbose;
+#define printk(fmt, ...)    do { if (dlc_tools_verbose) fprintf(stderr, fmt, ##__VA_ARGS__); } while (0)
+#define pr_info(fmt, ...)   printk(fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)    fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+#define min(a, b)       ((a) < (b) ? (a) : (b))
+#define max(a, b)       ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)  ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)  ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi)   min_t(t, max_t(t, v, lo), hi)
+
+#define swap(a, b) \
+    do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+static inline u32 reciprocal_scale(u32 val, u32 ep_ro)
+{
+    return (u32)(((u64)val * ep_ro) >> 32);
+}
+
+#endif
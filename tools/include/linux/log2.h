@@ -0,0 +1,16 @@
+#ifndef _TOOLS_LINUX_LOG2_H
+#define _TOOLS_LINUX_LOG2_H
+
+#include <linux/types.h>
+
+static inline int ilog2(u64 n)
+{
+    return 63 - __builtin_clzll(n);
+}
+
+static inline u64 roundup_pow_of_two(u64 n)
+{
+    return n <= 1 ? 1 : 1ULL << (64 - __builtin_clzll(n - 1));
+}
+
+#endif
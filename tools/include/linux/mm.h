@@ -0,0 +1,15 @@
+#ifndef _TOOLS_LINUX_MM_H
+#define _TOOLS_LINUX_MM_H
+
+#include <stdlib.h>
+
+#define GFP_KERNEL  0
+
+#define kvmalloc(size, flags)   malloc(size)
+#define kvzalloc(size, flags)   calloc(1, size)
+#define kvfree(p)               free(p)
+
+#define kvmalloc_node(size, flags, node)    kvmalloc(size, flags)
+#define kvzalloc_node(size, flags, node)    kvzalloc(size, flags)
+
+#endif
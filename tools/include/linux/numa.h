@@ -0,0 +1,6 @@
+#ifndef _TOOLS_LINUX_NUMA_H
+#define _TOOLS_LINUX_NUMA_H
+
+#define NUMA_NO_NODE    (-1)
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef _TOOLS_LINUX_SKBUFF_H
+#define _TOOLS_LINUX_SKBUFF_H
+
+/* model only passes skb pointers through */
+struct sk_buff;
+
+#endif
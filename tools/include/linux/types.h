@@ -0,0 +1,39 @@
+/*
+ * Minimal userspace stand-ins for the kernel headers used by the model code
+ * in ../dlc, so it can be linked into tools unchanged (same integer math).
+ * Only what the model needs is here; no locking, no skb.
+ */
+#ifndef _TOOLS_LINUX_TYPES_H
+#define _TOOLS_LINUX_TYPES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef s64 __s64;
+
+/* uapi headers the tools include next to the model (if_xdp.h, bpf.h) */
+typedef s8 __s8;
+typedef u16 __be16;
+typedef u32 __be32;
+typedef u64 __be64;
+typedef u16 __sum16;
+typedef u32 __wsum;
+#define __aligned_u64 __u64 __attribute__((aligned(8)))
+
+#endif
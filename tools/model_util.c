@@ -0,0 +1,123 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model_util.h"
+#include "../dlc/dlc_tca_spec.h"
+
+#define NSEC_PER_MSEC   1000000.0
+
+int dlc_tools_verbose;
+
+static const char *const param_opts = "djrlubg";
+
+void model_params_init(struct model_params *mp)
+{
+    memset(mp, 0, sizeof(*mp));
+    mp->p[P_DELAY] = 25;
+    mp->p[P_JITTER] = 2;
+    mp->p[P_RHO] = 50;
+    mp->p[P_LOSS] = 1;
+    mp->p[P_MU] = 50;
+    mp->p[P_BURST] = 3;
+    mp->p[P_GOOD_BURST] = 10;
+    mp->jitter_steps = 4;
+}
+
+int model_params_opt(struct model_params *mp, int opt, const char *arg)
+{
+    const char *pos = strchr(param_opts, opt);
+
+    if (opt && pos) {
+        mp->p[pos - param_opts] = atof(arg);
+        return pos - param_opts;
+    }
+    switch (opt) {
+    case 'n':
+        mp->jitter_steps = strtoul(arg, NULL, 0);
+        return MODEL_OPT_OTHER;
+    case 'f':
+        free(mp->dist);
+        mp->dist = dist_load(arg);
+        return mp->dist ? MODEL_OPT_OTHER : MODEL_OPT_ERROR;
+    default:
+        return MODEL_OPT_NONE;
+    }
+}
+
+static u32 pct_to_prob(double pct)
+{
+    return (u32)llround(pct / 100.0 * DLC_PROB_SCALE);
+}
+
+void model_qopt(const struct model_params *mp, struct tc_dlc_qopt *qopt, s64 *latency, s64 *jitter)
+{
+    memset(qopt, 0, sizeof(*qopt));
+    qopt->mm1_rho = (u32)llround(mp->p[P_RHO] / 100.0 * DLC_PROB_SCALE);
+    qopt->jitter_steps = mp->jitter_steps;
+    qopt->loss = pct_to_prob(mp->p[P_LOSS]);
+    qopt->mu = pct_to_prob(mp->p[P_MU]);
+    qopt->mean_burst_len = (u32)llround(mp->p[P_BURST]);
+    qopt->mean_good_burst_len = (u32)llround(mp->p[P_GOOD_BURST]);
+    *latency = (s64)llround(mp->p[P_DELAY] * NSEC_PER_MSEC);
+    *jitter = (s64)llround(mp->p[P_JITTER] * NSEC_PER_MSEC);
+}
+
+int model_build(struct dlc_mod_data *m, const struct model_params *mp)
+{
+    struct tc_dlc_qopt qopt;
+    s64 latency, jitter;
+
+    model_qopt(mp, &qopt, &latency, &jitter);
+    memset(m, 0, sizeof(*m));
+    return dlc_mod_init(m, latency, jitter, qopt.mm1_rho, qopt.jitter_steps,
+                        qopt.loss, qopt.mu, qopt.mean_burst_len, qopt.mean_good_burst_len,
+                        mp->dist, NUMA_NO_NODE);
+}
+
+/* netem/iproute2 .dist format: '#' comments, whitespace separated values */
+struct disttable *dist_load(const char *path)
+{
+    struct disttable *d;
+    size_t n = 0, cap = 1024;
+    char line[4096];
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    d = malloc(sizeof(*d) + cap * sizeof(s16));
+    while (d && fgets(line, sizeof(line), f)) {
+        char *p = line, *end;
+        long v;
+
+        if (line[0] == '#')
+            continue;
+        for (v = strtol(p, &end, 10); end != p; v = strtol(p, &end, 10)) {
+            if (n == cap) {
+                struct disttable *nd = realloc(d, sizeof(*d) + 2 * cap * sizeof(s16));
+
+                if (!nd) {
+                    free(d);
+                    d = NULL;
+                    break;
+                }
+                d = nd;
+                cap *= 2;
+            }
+            d->table[n++] = v;
+            p = end;
+        }
+    }
+    fclose(f);
+    if (!d || !n || n > DLC_DIST_MAX) {
+        fprintf(stderr, "bad distribution table %s\n", path);
+        free(d);
+        return NULL;
+    }
+    d->size = n;
+    return d;
+}
@@ -0,0 +1,60 @@
+#ifndef _DLC_MODEL_UTIL_H
+#define _DLC_MODEL_UTIL_H
+
+#include "../dlc/dlc_mod.h"
+
+/* Helpers shared by tools that link the model code of ../dlc */
+
+/* model init messages (printk in the shim) go to stderr when set */
+extern int dlc_tools_verbose;
+
+/* tc-facing parameters, in units of the command line */
+enum {
+    P_DELAY,        /* ms */
+    P_JITTER,       /* ms */
+    P_RHO,          /* % */
+    P_LOSS,         /* % */
+    P_MU,           /* % */
+    P_BURST,        /* mean_burst_len */
+    P_GOOD_BURST,   /* mean_good_burst_len */
+    NUM_PARAMS,
+};
+
+struct model_params {
+    double p[NUM_PARAMS];
+    unsigned int jitter_steps;
+    struct disttable *dist;         /* NULL = uniform jitter */
+};
+
+/* getopt string and help of the options model_params_opt() takes */
+#define MODEL_OPTSTRING     "d:j:n:r:l:u:b:g:f:"
+#define MODEL_USAGE_SHORT \
+    "[-d delay] [-j jitter] [-n jitter_steps] [-r rho] [-l loss] [-u mu]\n" \
+    "          [-b mean_burst_len] [-g mean_good_burst_len] [-f dist]"
+#define MODEL_USAGE \
+    "  -d, -j        delay and jitter, ms (default 25, 2)\n" \
+    "  -n            jitter steps, states of M/M/1/K chain - 1 (default 4)\n" \
+    "  -r, -l, -u    M/M/1/K rho, loss and queue state share, %% (default 50, 1, 50)\n" \
+    "  -b, -g        mean loss burst and mean good burst length (default 3, 10)\n" \
+    "  -f dist       netem distribution table for the simple state\n"
+
+/* model_params_opt() results besides the P_* index it has set */
+#define MODEL_OPT_OTHER     NUM_PARAMS      /* -n or -f */
+#define MODEL_OPT_NONE      (-1)            /* not a model option */
+#define MODEL_OPT_ERROR     (-2)            /* reported to stderr */
+
+void model_params_init(struct model_params *mp);
+int model_params_opt(struct model_params *mp, int opt, const char *arg);
+
+struct tc_dlc_qopt;
+
+/* tc_dlc_qopt and TCA_DLC_LATENCY64/JITTER64 (ns) values, limit and rate left 0 */
+void model_qopt(const struct model_params *mp, struct tc_dlc_qopt *qopt, s64 *latency, s64 *jitter);
+
+/* dlc_mod_init() with parameters converted the way tc does */
+int model_build(struct dlc_mod_data *m, const struct model_params *mp);
+
+/* netem .dist table as tc would pass it, NULL on error (reported) */
+struct disttable *dist_load(const char *path);
+
+#endif
@@ -0,0 +1,406 @@
+#include "pcap_io.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PCAP_MAGIC_USEC     0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAPNG_SHB          0x0a0d0d0a
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_SPB          0x00000003
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BOM          0x1a2b3c4d
+#define PCAPNG_OPT_TSRESOL  9
+
+#define NFULA_PAYLOAD       9
+
+/* drop already parsed pages every 64 MB */
+#define PCAP_RELEASE_CHUNK  (64UL << 20)
+
+#define PCAP_WRITE_BUF      (1UL << 20)
+#define PCAP_SNAPLEN        262144
+
+#define ETH_P_IP    0x0800
+#define ETH_P_IPV6  0x86dd
+#define ETH_P_8021Q 0x8100
+#define ETH_P_8021AD 0x88a8
+
+static inline uint16_t rd16(const struct pcap_reader *r, const uint8_t *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? __builtin_bswap16(v) : v;
+}
+
+static inline uint32_t rd32(const struct pcap_reader *r, const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t be16(const uint8_t *p)
+{
+    return (uint16_t)p[0] << 8 | p[1];
+}
+
+static void release_parsed(struct pcap_reader *r)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t upto;
+
+    if (r->off - r->released < PCAP_RELEASE_CHUNK)
+        return;
+    upto = r->off & ~(page - 1);
+    madvise((void *)(r->base + r->released), upto - r->released, MADV_DONTNEED);
+    r->released = upto;
+}
+
+static uint64_t tsresol_from_opt(uint8_t v)
+{
+    uint64_t res = 1;
+
+    if (v & 0x80)
+        return 1ULL << (v & 0x7f);
+    while (v--)
+        res *= 10;
+    return res;
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks, uint64_t resol)
+{
+    if (resol == 1000000000ULL)
+        return ticks;
+    if (resol == 1000000ULL)
+        return ticks * 1000;
+    return (uint64_t)((unsigned __int128)ticks * 1000000000ULL / resol);
+}
+
+static int pcapng_parse_idb(struct pcap_reader *r, const uint8_t *body, uint32_t body_len)
+{
+    uint32_t i = r->n_ifaces;
+    uint32_t off = 8;
+
+    if (body_len < 8)
+        return -1;
+    if (i >= PCAP_MAX_IFACES) {
+        fprintf(stderr, "pcap: too many interfaces, ignore extra ones\n");
+        return 0;
+    }
+    r->if_linktype[i] = rd16(r, body);
+    r->if_tsresol[i] = 1000000;   /* default 10^-6 */
+
+    while (off + 4 <= body_len) {
+        uint16_t code = rd16(r, body + off);
+        uint16_t len = rd16(r, body + off + 2);
+
+        if (code == 0)
+            break;
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1 && off + 5 <= body_len)
+            r->if_tsresol[i] = tsresol_from_opt(body[off + 4]);
+        off += 4 + ((len + 3) & ~3u);
+    }
+    r->n_ifaces++;
+    return 0;
+}
+
+int pcap_open(struct pcap_reader *r, const char *path)
+{
+    struct stat st;
+    uint32_t magic;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(r->fd, &st) < 0 || st.st_size < 24) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        goto err_close;
+    }
+    r->size = st.st_size;
+    r->base = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+    if (r->base == MAP_FAILED) {
+        perror("mmap");
+        goto err_close;
+    }
+    madvise((void *)r->base, r->size, MADV_SEQUENTIAL);
+
+    memcpy(&magic, r->base, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        r->ng = 1;
+        /* byte order is defined by the section header, parsed in pcap_next() */
+        return 0;
+    }
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        r->swapped = 0;
+    } else if (__builtin_bswap32(magic) == PCAP_MAGIC_USEC ||
+               __builtin_bswap32(magic) == PCAP_MAGIC_NSEC) {
+        r->swapped = 1;
+        magic = __builtin_bswap32(magic);
+    } else {
+        fprintf(stderr, "%s: unknown capture format (magic %#x)\n", path, magic);
+        goto err_unmap;
+    }
+    r->nsec = magic == PCAP_MAGIC_NSEC;
+    r->linktype = rd32(r, r->base + 20) & 0x0fffffff;
+    r->off = 24;
+    return 0;
+
+err_unmap:
+    munmap((void *)r->base, r->size);
+err_close:
+    close(r->fd);
+    return -1;
+}
+
+static int pcap_next_classic(struct pcap_reader *r, struct pcap_pkt *pkt)
+{
+    const uint8_t *hdr;
+    uint32_t sec, frac;
+
+    if (r->off + 16 > r->size)
+        return 0;
+    hdr = r->base + r->off;
+    sec = rd32(r, hdr);
+    frac = rd32(r, hdr + 4);
+    pkt->caplen = rd32(r, hdr + 8);
+    pkt->len = rd32(r, hdr + 12);
+    if (r->off + 16 + pkt->caplen > r->size)
+        return -1;
+
+    pkt->ts_ns = (uint64_t)sec * 1000000000ULL + (r->nsec ? frac : (uint64_t)frac * 1000);
+    pkt->linktype = r->linktype;
+    pkt->data = hdr + 16;
+    r->off += 16 + pkt->caplen;
+    return 1;
+}
+
+static int pcap_next_ng(struct pcap_reader *r, struct pcap_pkt *pkt)
+{
+    while (r->off + 12 <= r->size) {
+        const uint8_t *blk = r->base + r->off;
+        uint32_t type, blk_len, iface;
+        uint32_t bom;
+
+        memcpy(&type, blk, sizeof(type));
+        if (type == PCAPNG_SHB) {
+            memcpy(&bom, blk + 8, sizeof(bom));
+            if (bom == PCAPNG_BOM)
+                r->swapped = 0;
+            else if (__builtin_bswap32(bom) == PCAPNG_BOM)
+                r->swapped = 1;
+            else
+                return -1;
+            /* interface ids are local to a section */
+            r->n_ifaces = 0;
+        }
+        type = rd32(r, blk);
+        blk_len = rd32(r, blk + 4);
+        if (blk_len < 12 || (blk_len & 3) || r->off + blk_len > r->size)
+            return -1;
+        r->off += blk_len;
+
+        if (type == PCAPNG_IDB) {
+            if (pcapng_parse_idb(r, blk + 8, blk_len - 12))
+                return -1;
+        } else if (type == PCAPNG_EPB) {
+            uint64_t ticks;
+
+            if (blk_len < 32)
+                return -1;
+            iface = rd32(r, blk + 8);
+            if (iface >= r->n_ifaces)
+                continue;
+            ticks = (uint64_t)rd32(r, blk + 12) << 32 | rd32(r, blk + 16);
+            pkt->caplen = rd32(r, blk + 20);
+            pkt->len = rd32(r, blk + 24);
+            if (pkt->caplen > blk_len - 32)
+                return -1;
+            pkt->ts_ns = ticks_to_ns(ticks, r->if_tsresol[iface]);
+            pkt->linktype = r->if_linktype[iface];
+            pkt->data = blk + 28;
+            return 1;
+        }
+        /* SPB carry no timestamp, everything else is metadata */
+    }
+    return 0;
+}
+
+int pcap_next(struct pcap_reader *r, struct pcap_pkt *pkt)
+{
+    release_parsed(r);
+    if (r->ng)
+        return pcap_next_ng(r, pkt);
+    return pcap_next_classic(r, pkt);
+}
+
+void pcap_close(struct pcap_reader *r)
+{
+    if (r->base && r->base != MAP_FAILED)
+        munmap((void *)r->base, r->size);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->base = NULL;
+    r->fd = -1;
+}
+
+int pcap_writer_open(struct pcap_writer *w, const char *path)
+{
+    memset(w, 0, sizeof(*w));
+    w->f = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+    if (!w->f) {
+        perror(path);
+        return -1;
+    }
+    w->buf = malloc(PCAP_WRITE_BUF);
+    if (w->buf)
+        setvbuf(w->f, w->buf, _IOFBF, PCAP_WRITE_BUF);
+    return 0;
+}
+
+static int pcap_write_header(struct pcap_writer *w, uint32_t linktype)
+{
+    uint32_t hdr[6] = { PCAP_MAGIC_NSEC, 2 | 4 << 16, 0, 0, PCAP_SNAPLEN, linktype };
+
+    w->header = 1;
+    return fwrite(hdr, sizeof(hdr), 1, w->f) == 1 ? 0 : -1;
+}
+
+int pcap_write(struct pcap_writer *w, const struct pcap_pkt *pkt, uint64_t ts_ns)
+{
+    uint32_t rec[4];
+
+    if (!w->header && pcap_write_header(w, pkt->linktype))
+        return -1;
+    rec[0] = ts_ns / 1000000000ULL;
+    rec[1] = ts_ns % 1000000000ULL;
+    rec[2] = pkt->caplen;
+    rec[3] = pkt->len;
+    if (fwrite(rec, sizeof(rec), 1, w->f) != 1 ||
+        fwrite(pkt->data, 1, pkt->caplen, w->f) != pkt->caplen)
+        return -1;
+    return 0;
+}
+
+int pcap_writer_close(struct pcap_writer *w)
+{
+    int ret = 0;
+
+    /* no packets: still a valid, empty capture */
+    if (!w->header)
+        ret = pcap_write_header(w, PCAP_LINKTYPE_EN10MB);
+    if (w->f != stdout ? fclose(w->f) : fflush(w->f))
+        ret = -1;
+    free(w->buf);
+    w->f = NULL;
+    w->buf = NULL;
+    return ret;
+}
+
+/* NFLOG: 4 byte header then TLVs in host byte order, payload is the IP packet */
+static const uint8_t *nflog_payload(const uint8_t *p, uint32_t caplen, uint32_t *len)
+{
+    uint32_t off = 4;
+
+    while (off + 4 <= caplen) {
+        uint16_t tlv_len, tlv_type;
+
+        memcpy(&tlv_len, p + off, sizeof(tlv_len));
+        memcpy(&tlv_type, p + off + 2, sizeof(tlv_type));
+        if (tlv_len < 4 || off + tlv_len > caplen)
+            return NULL;
+        if (tlv_type == NFULA_PAYLOAD) {
+            *len = tlv_len - 4;
+            return p + off + 4;
+        }
+        off += (tlv_len + 3) & ~3u;
+    }
+    return NULL;
+}
+
+static const uint8_t *l3_header(const struct pcap_pkt *pkt, uint32_t *len)
+{
+    const uint8_t *p = pkt->data;
+    uint32_t caplen = pkt->caplen;
+    uint16_t proto;
+    uint32_t off;
+
+    switch (pkt->linktype) {
+    case PCAP_LINKTYPE_RAW:
+        *len = caplen;
+        return p;
+    case PCAP_LINKTYPE_NFLOG:
+        return nflog_payload(p, caplen, len);
+    case PCAP_LINKTYPE_LINUX_SLL:
+        if (caplen < 16)
+            return NULL;
+        proto = be16(p + 14);
+        off = 16;
+        break;
+    case PCAP_LINKTYPE_LINUX_SLL2:
+        if (caplen < 20)
+            return NULL;
+        proto = be16(p);
+        off = 20;
+        break;
+    case PCAP_LINKTYPE_EN10MB:
+        if (caplen < 14)
+            return NULL;
+        proto = be16(p + 12);
+        off = 14;
+        while ((proto == ETH_P_8021Q || proto == ETH_P_8021AD) && off + 4 <= caplen) {
+            proto = be16(p + off + 2);
+            off += 4;
+        }
+        break;
+    default:
+        return NULL;
+    }
+    if (proto != ETH_P_IP && proto != ETH_P_IPV6)
+        return NULL;
+    if (off >= caplen)
+        return NULL;
+    *len = caplen - off;
+    return p + off;
+}
+
+const uint8_t *pcap_udp_payload(const struct pcap_pkt *pkt, uint16_t *dport, uint32_t *len)
+{
+    const uint8_t *ip, *udp;
+    uint32_t ip_len, hlen;
+
+    ip = l3_header(pkt, &ip_len);
+    if (!ip || ip_len < 1)
+        return NULL;
+
+    switch (ip[0] >> 4) {
+    case 4:
+        hlen = (ip[0] & 0x0f) * 4;
+        /* protocol udp, first fragment only */
+        if (ip_len < 20 || hlen < 20 || ip[9] != 17 || (be16(ip + 6) & 0x1fff))
+            return NULL;
+        break;
+    case 6:
+        hlen = 40;
+        if (ip_len < 40 || ip[6] != 17)
+            return NULL;
+        break;
+    default:
+        return NULL;
+    }
+    if (hlen + 8 > ip_len)
+        return NULL;
+    udp = ip + hlen;
+    *dport = be16(udp + 2);
+    *len = ip_len - hlen - 8;
+    return udp + 8;
+}
@@ -0,0 +1,83 @@
+#ifndef _DLC_PCAP_IO_H
+#define _DLC_PCAP_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Link types we know how to strip down to the IP header */
+#define PCAP_LINKTYPE_EN10MB        1
+#define PCAP_LINKTYPE_RAW           101
+#define PCAP_LINKTYPE_LINUX_SLL     113
+#define PCAP_LINKTYPE_NFLOG         239
+#define PCAP_LINKTYPE_LINUX_SLL2    276
+
+#define PCAP_MAX_IFACES 16
+
+/*
+ * Streaming reader for classic pcap and pcapng files.
+ * The whole file is mmap'ed read-only, pages behind the cursor are
+ * dropped periodically, so resident memory stays constant for any capture size.
+ */
+struct pcap_reader {
+    int fd;
+    const uint8_t *base;
+    size_t size;
+    size_t off;
+    size_t released;            /* offset up to which pages were dropped */
+
+    int ng;                     /* pcapng file */
+    int swapped;                /* file byte order differs from host */
+
+    /* classic pcap */
+    uint32_t linktype;
+    int nsec;
+
+    /* pcapng: per interface description block */
+    uint32_t n_ifaces;
+    uint32_t if_linktype[PCAP_MAX_IFACES];
+    uint64_t if_tsresol[PCAP_MAX_IFACES];  /* ticks per second */
+};
+
+struct pcap_pkt {
+    uint64_t ts_ns;
+    uint32_t caplen;
+    uint32_t len;
+    uint32_t linktype;
+    const uint8_t *data;
+};
+
+int pcap_open(struct pcap_reader *r, const char *path);
+
+/* Returns 1 on packet, 0 on end of file, -1 on malformed input */
+int pcap_next(struct pcap_reader *r, struct pcap_pkt *pkt);
+
+void pcap_close(struct pcap_reader *r);
+
+/*
+ * Classic pcap writer with nanosecond timestamps, through a large stdio
+ * buffer. The link type is taken from the first packet, since pcapng input
+ * only tells it with its first interface block.
+ */
+struct pcap_writer {
+    FILE *f;
+    char *buf;
+    int header;                 /* file header written */
+};
+
+/* "-" writes to stdout */
+int pcap_writer_open(struct pcap_writer *w, const char *path);
+
+/* pkt->data, caplen, len and linktype are written with timestamp ts_ns */
+int pcap_write(struct pcap_writer *w, const struct pcap_pkt *pkt, uint64_t ts_ns);
+
+/* Returns -1 if anything failed to reach the file */
+int pcap_writer_close(struct pcap_writer *w);
+
+/*
+ * Locate UDP payload of an IPv4/IPv6 packet.
+ * Returns payload pointer (and fills dport, len) or NULL for non-UDP packets.
+ */
+const uint8_t *pcap_udp_payload(const struct pcap_pkt *pkt, uint16_t *dport, uint32_t *len);
+
+#endif
@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/if_link.h>
+
+#include "bpf_raw.h"
+#include "xsk.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+
+int xsk_umem_create(struct xsk_umem *umem, uint32_t num_frames, uint32_t frame_size)
+{
+    umem->frame_size = frame_size;
+    umem->num_frames = num_frames;
+    umem->size = (size_t)num_frames * frame_size;
+    umem->area = mmap(NULL, umem->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (umem->area == MAP_FAILED) {
+        umem->area = NULL;
+        return -errno;
+    }
+    return 0;
+}
+
+void xsk_umem_destroy(struct xsk_umem *umem)
+{
+    if (umem->area)
+        munmap(umem->area, umem->size);
+    umem->area = NULL;
+}
+
+static int ring_map(int fd, const struct xdp_ring_offset *off, off_t pgoff,
+                    uint32_t size, size_t entry, struct xsk_ring *r)
+{
+    r->map_len = off->desc + size * entry;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -errno;
+    }
+    r->producer = (uint32_t *)((char *)r->map + off->producer);
+    r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+    r->flags = (uint32_t *)((char *)r->map + off->flags);
+    r->descs = (char *)r->map + off->desc;
+    r->size = size;
+    r->mask = size - 1;
+    r->cached_prod = *r->producer;
+    r->cached_cons = *r->consumer;
+    return 0;
+}
+
+static void ring_unmap(struct xsk_ring *r)
+{
+    if (r->map)
+        munmap(r->map, r->map_len);
+    r->map = NULL;
+}
+
+static int socket_setup(struct xsk_socket *xs, struct xsk_umem *umem,
+                        const struct xsk_socket *shared, uint32_t ring_size, int zerocopy)
+{
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    struct xdp_options opts;
+    socklen_t optlen;
+    int ret;
+
+    xs->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xs->fd < 0)
+        return -errno;
+
+    if (!shared) {
+        struct xdp_umem_reg reg = {
+            .addr = (uintptr_t)umem->area,
+            .len = umem->size,
+            .chunk_size = umem->frame_size,
+        };
+
+        if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+            return -errno;
+    }
+    /* a socket on another device needs own fill and completion rings */
+    if (setsockopt(xs->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xs->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xs->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) ||
+        setsockopt(xs->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)))
+        return -errno;
+
+    optlen = sizeof(off);
+    if (getsockopt(xs->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen))
+        return -errno;
+    ret = ring_map(xs->fd, &off.rx, XDP_PGOFF_RX_RING, ring_size, sizeof(struct xdp_desc), &xs->rx);
+    if (!ret)
+        ret = ring_map(xs->fd, &off.tx, XDP_PGOFF_TX_RING, ring_size, sizeof(struct xdp_desc), &xs->tx);
+    if (!ret)
+        ret = ring_map(xs->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING, ring_size, sizeof(__u64), &xs->fill);
+    if (!ret)
+        ret = ring_map(xs->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, ring_size, sizeof(__u64), &xs->comp);
+    if (ret)
+        return ret;
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xs->ifindex;
+    sxdp.sxdp_queue_id = xs->queue;
+    if (shared) {
+        /* mode and wakeup flags are inherited from the UMEM owner */
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = shared->fd;
+    } else {
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (zerocopy ? XDP_ZEROCOPY : XDP_COPY);
+    }
+    if (bind(xs->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)))
+        return -errno;
+
+    optlen = sizeof(opts);
+    if (!getsockopt(xs->fd, SOL_XDP, XDP_OPTIONS, &opts, &optlen))
+        xs->zerocopy = !!(opts.flags & XDP_OPTIONS_ZEROCOPY);
+    return 0;
+}
+
+int xsk_socket_create(struct xsk_socket *xs, const char *ifname, uint32_t queue,
+                      struct xsk_umem *umem, const struct xsk_socket *shared,
+                      uint32_t ring_size, int mode)
+{
+    int ret;
+
+    memset(xs, 0, sizeof(*xs));
+    xs->fd = -1;
+    xs->ifindex = if_nametoindex(ifname);
+    if (!xs->ifindex)
+        return -errno;
+    xs->queue = queue;
+
+    ret = socket_setup(xs, umem, shared, ring_size, mode != XSK_MODE_COPY);
+    if (ret && mode == XSK_MODE_AUTO && !shared) {
+        xsk_socket_destroy(xs);
+        xs->ifindex = if_nametoindex(ifname);
+        xs->queue = queue;
+        ret = socket_setup(xs, umem, shared, ring_size, 0);
+    }
+    if (ret)
+        xsk_socket_destroy(xs);
+    return ret;
+}
+
+void xsk_socket_destroy(struct xsk_socket *xs)
+{
+    ring_unmap(&xs->rx);
+    ring_unmap(&xs->tx);
+    ring_unmap(&xs->fill);
+    ring_unmap(&xs->comp);
+    if (xs->fd >= 0)
+        close(xs->fd);
+    memset(xs, 0, sizeof(*xs));
+    xs->fd = -1;
+}
+
+/*
+ * return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ * Queues without a socket keep going up the stack.
+ */
+static int redirect_prog_load(int map_fd)
+{
+    struct bpf_insn insns[] = {
+        BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index)),
+        BPF_LD_MAP_FD(BPF_REG_1, map_fd),
+        BPF_MOV64_IMM(BPF_REG_3, XDP_PASS),
+        BPF_CALL_FUNC(BPF_FUNC_redirect_map),
+        BPF_EXIT_INSN(),
+    };
+
+    return bpf_raw_prog_load(BPF_PROG_TYPE_XDP, BPF_XDP, insns, sizeof(insns) / sizeof(insns[0]));
+}
+
+int xsk_redirect_attach(struct xsk_redirect *r, const struct xsk_socket *xs, int skb_mode)
+{
+    __u32 key = xs->queue;
+    __u32 val = xs->fd;
+    int ret;
+
+    r->map_fd = r->prog_fd = r->link_fd = -1;
+
+    r->map_fd = bpf_raw_map_create(BPF_MAP_TYPE_XSKMAP, sizeof(key), sizeof(val), xs->queue + 1);
+    if (r->map_fd < 0)
+        goto err;
+    if (bpf_raw_map_update(r->map_fd, &key, &val))
+        goto err;
+
+    r->prog_fd = redirect_prog_load(r->map_fd);
+    if (r->prog_fd < 0)
+        goto err;
+
+    /* bpf_link: the program goes away with the process */
+    r->link_fd = bpf_raw_link_create(r->prog_fd, xs->ifindex, BPF_XDP,
+                                     skb_mode ? XDP_FLAGS_SKB_MODE : 0);
+    if (r->link_fd < 0)
+        goto err;
+    return 0;
+
+err:
+    ret = -errno;
+    xsk_redirect_detach(r);
+    return ret;
+}
+
+void xsk_redirect_detach(struct xsk_redirect *r)
+{
+    if (r->link_fd >= 0)
+        close(r->link_fd);
+    if (r->prog_fd >= 0)
+        close(r->prog_fd);
+    if (r->map_fd >= 0)
+        close(r->map_fd);
+    r->map_fd = r->prog_fd = r->link_fd = -1;
+}
+
+void xsk_kick_tx(struct xsk_socket *xs)
+{
+    if (!(*xs->tx.flags & XDP_RING_NEED_WAKEUP))
+        return;
+    /* EAGAIN/EBUSY/ENOBUFS: kernel is busy with the ring already */
+    sendto(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+void xsk_kick_fill(struct xsk_socket *xs)
+{
+    if (!(*xs->fill.flags & XDP_RING_NEED_WAKEUP))
+        return;
+    recvfrom(xs->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+int xsk_get_stats(const struct xsk_socket *xs, struct xdp_statistics *st)
+{
+    socklen_t optlen = sizeof(*st);
+
+    memset(st, 0, sizeof(*st));
+    if (getsockopt(xs->fd, SOL_XDP, XDP_STATISTICS, st, &optlen))
+        return -errno;
+    return 0;
+}
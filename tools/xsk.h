@@ -0,0 +1,131 @@
+#ifndef _DLC_XSK_H
+#define _DLC_XSK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/if_xdp.h>
+
+/*
+ * Minimal AF_XDP plumbing on top of the kernel uapi only (no libbpf/libxdp):
+ * UMEM registration, socket rings, and a built-in XDP program that redirects
+ * every queue to its socket in an XSKMAP. Sockets may share one UMEM across
+ * devices (kernel >= 5.10), so a frame received on one port is transmitted on
+ * the other without a copy.
+ */
+
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;            /* struct xdp_desc[] or __u64[] */
+    uint32_t size;
+    uint32_t mask;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_len;
+};
+
+struct xsk_umem {
+    void *area;
+    size_t size;
+    uint32_t frame_size;    /* power of two, aligned chunk mode */
+    uint32_t num_frames;
+};
+
+struct xsk_socket {
+    int fd;
+    int ifindex;
+    uint32_t queue;
+    int zerocopy;
+    struct xsk_ring rx;
+    struct xsk_ring tx;
+    struct xsk_ring fill;
+    struct xsk_ring comp;
+};
+
+/* Attached redirect program, detached when link_fd is closed */
+struct xsk_redirect {
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+};
+
+enum {
+    XSK_MODE_AUTO,          /* zero-copy, copy mode if the driver has none */
+    XSK_MODE_ZEROCOPY,
+    XSK_MODE_COPY,
+};
+
+int xsk_umem_create(struct xsk_umem *umem, uint32_t num_frames, uint32_t frame_size);
+void xsk_umem_destroy(struct xsk_umem *umem);
+
+/* First socket registers the UMEM, others pass the socket owning it as shared */
+int xsk_socket_create(struct xsk_socket *xs, const char *ifname, uint32_t queue,
+                      struct xsk_umem *umem, const struct xsk_socket *shared,
+                      uint32_t ring_size, int mode);
+void xsk_socket_destroy(struct xsk_socket *xs);
+
+int xsk_redirect_attach(struct xsk_redirect *r, const struct xsk_socket *xs, int skb_mode);
+void xsk_redirect_detach(struct xsk_redirect *r);
+
+/* Kick the kernel when it asked for it (XDP_USE_NEED_WAKEUP) */
+void xsk_kick_tx(struct xsk_socket *xs);
+void xsk_kick_fill(struct xsk_socket *xs);
+
+int xsk_get_stats(const struct xsk_socket *xs, struct xdp_statistics *st);
+
+/* Producer side: reserve up to n entries starting at *idx, then submit */
+static inline uint32_t xsk_prod_reserve(struct xsk_ring *r, uint32_t n, uint32_t *idx)
+{
+    uint32_t free = r->size - (r->cached_prod - r->cached_cons);
+
+    if (free < n) {
+        r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+        free = r->size - (r->cached_prod - r->cached_cons);
+    }
+    if (n > free)
+        n = free;
+    *idx = r->cached_prod;
+    r->cached_prod += n;
+    return n;
+}
+
+static inline void xsk_prod_submit(struct xsk_ring *r)
+{
+    __atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+/* Consumer side: peek up to n entries starting at *idx, then release */
+static inline uint32_t xsk_cons_peek(struct xsk_ring *r, uint32_t n, uint32_t *idx)
+{
+    uint32_t avail = r->cached_prod - r->cached_cons;
+
+    if (avail < n) {
+        r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+        avail = r->cached_prod - r->cached_cons;
+    }
+    if (n > avail)
+        n = avail;
+    *idx = r->cached_cons;
+    r->cached_cons += n;
+    return n;
+}
+
+static inline void xsk_cons_release(struct xsk_ring *r)
+{
+    __atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline struct xdp_desc *xsk_desc(struct xsk_ring *r, uint32_t idx)
+{
+    return &((struct xdp_desc *)r->descs)[idx & r->mask];
+}
+
+static inline uint64_t *xsk_addr(struct xsk_ring *r, uint32_t idx)
+{
+    return &((uint64_t *)r->descs)[idx & r->mask];
+}
+
+#endif